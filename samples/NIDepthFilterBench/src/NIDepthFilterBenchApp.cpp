@@ -0,0 +1,209 @@
+/*
+ Copyright (C) 2012 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Times SpatialDepthFilter on one VGA depth frame with 1, 2, 4 and all hardware threads.
+// The frame is synthetic, or the first depth frame of the .oni recording passed as the first argument.
+
+#include <algorithm>
+#include <sstream>
+
+#include "cinder/Cinder.h"
+#include "cinder/app/AppBasic.h"
+#include "cinder/gl/gl.h"
+#include "cinder/gl/Texture.h"
+#include "cinder/Rand.h"
+#include "cinder/Surface.h"
+
+#include "CiNI.h"
+
+using namespace ci;
+using namespace ci::app;
+using namespace std;
+using namespace mndl;
+
+class NIDepthFilterBenchApp : public AppBasic
+{
+	public:
+		void prepareSettings( Settings *settings );
+		void setup();
+
+		void draw();
+
+	private:
+		static const int kWidth = 640;
+		static const int kHeight = 480;
+		static const int kWarmupRuns = 5;
+		static const int kRuns = 100;
+
+		void createSyntheticFrame();
+		bool loadRecordedFrame( const fs::path &recording );
+		void benchmark( int numThreads );
+		gl::Texture createDepthTexture( const uint16_t *depth );
+
+		vector<uint16_t> mDepth;
+		vector<uint16_t> mFilled;
+		string mSource;
+		vector<string> mResults;
+		gl::Texture mDepthTexture, mFilledTexture;
+};
+
+void NIDepthFilterBenchApp::prepareSettings( Settings *settings )
+{
+	settings->setWindowSize( 1280, 640 );
+}
+
+void NIDepthFilterBenchApp::setup()
+{
+	const vector<string> &args = getArgs();
+	if ( ( args.size() < 2 ) || !loadRecordedFrame( args[ 1 ] ) )
+		createSyntheticFrame();
+
+	size_t holes = std::count( mDepth.begin(), mDepth.end(), 0 );
+	stringstream ss;
+	ss << mSource << ", " << holes * 100 / mDepth.size() << "% holes, " << kRuns << " runs per configuration";
+	mResults.push_back( ss.str() );
+	console() << ss.str() << endl;
+
+	int hardwareThreads = std::max( (int)thread::hardware_concurrency(), 1 );
+	int numThreads[] = { 1, 2, 4, hardwareThreads };
+	for ( int i = 0; i < 4; i++ )
+	{
+		if ( ( i == 3 ) && ( hardwareThreads <= 4 ) )
+			break;
+		benchmark( numThreads[ i ] );
+	}
+
+	mDepthTexture = createDepthTexture( &mDepth[ 0 ] );
+	mFilledTexture = createDepthTexture( &mFilled[ 0 ] );
+}
+
+void NIDepthFilterBenchApp::createSyntheticFrame()
+{
+	// a floor rising to a back wall, a person-sized box in front of it casting a shadow to the right
+	// and speckle holes, roughly like a structured light frame of a room
+	mDepth.resize( kWidth * kHeight );
+	Rand rnd( 1 );
+	for ( int y = 0; y < kHeight; y++ )
+	{
+		for ( int x = 0; x < kWidth; x++ )
+		{
+			uint16_t d = uint16_t( y < 200 ? 4000 : 4000 - ( y - 200 ) * 8 );
+			if ( ( x >= 250 ) && ( x < 390 ) && ( y >= 90 ) )
+				d = uint16_t( 1300 + ( x - 320 ) * ( x - 320 ) / 40 );
+			else
+			if ( ( x >= 390 ) && ( x < 408 ) && ( y >= 90 ) )
+				d = 0;
+			if ( ( x < 8 ) || ( rnd.nextFloat() < .03f ) )
+				d = 0;
+			mDepth[ y * kWidth + x ] = d;
+		}
+	}
+	mSource = "synthetic frame";
+}
+
+bool NIDepthFilterBenchApp::loadRecordedFrame( const fs::path &recording )
+{
+	try
+	{
+		ni::OpenNI::Options options;
+		options.enableUserTracker( false ).enableImage( false ).depthFormat( ni::OpenNI::DEPTH_MILLIMETERS );
+		ni::OpenNI ni( recording, options );
+		ni.start();
+		if ( !ni.waitForDepthFrame( 5. ) )
+			return false;
+
+		ni::Frame<uint16_t> frame = ni.getDepthFrame();
+		if ( !frame || ( frame.getWidth() != kWidth ) || ( frame.getHeight() != kHeight ) )
+			return false;
+
+		mDepth.resize( kWidth * kHeight );
+		for ( int y = 0; y < kHeight; y++ )
+			std::copy( frame.getRow( y ), frame.getRow( y ) + kWidth, &mDepth[ y * kWidth ] );
+		mSource = recording.filename().string();
+		return true;
+	}
+	catch ( ni::OpenNIExc &exc )
+	{
+		console() << "Could not open recording " << recording << endl;
+		return false;
+	}
+}
+
+void NIDepthFilterBenchApp::benchmark( int numThreads )
+{
+	ni::SpatialDepthFilter filter( ni::SpatialDepthFilter::Options().numThreads( numThreads ) );
+	for ( int i = 0; i < kWarmupRuns; i++ )
+		filter.apply( &mDepth[ 0 ], kWidth, kHeight );
+
+	double minTime = 1e9;
+	double maxTime = 0;
+	double totalTime = 0;
+	const uint16_t *filled = NULL;
+	for ( int i = 0; i < kRuns; i++ )
+	{
+		double start = getElapsedSeconds();
+		filled = filter.apply( &mDepth[ 0 ], kWidth, kHeight );
+		double elapsed = getElapsedSeconds() - start;
+		minTime = std::min( minTime, elapsed );
+		maxTime = std::max( maxTime, elapsed );
+		totalTime += elapsed;
+	}
+	mFilled.assign( filled, filled + kWidth * kHeight );
+
+	// the filter's own stats also count the warm-up runs, only the filled pixels are taken from them
+	ni::FilterStats stats = filter.getStats();
+	stringstream ss;
+	ss << numThreads << " thread(s): mean " << totalTime * 1000 / kRuns << " ms, min " << minTime * 1000 << " ms, max "
+		<< maxTime * 1000 << " ms, " << stats.lastFilledPixels << " pixels filled";
+	mResults.push_back( ss.str() );
+	console() << ss.str() << endl;
+}
+
+gl::Texture NIDepthFilterBenchApp::createDepthTexture( const uint16_t *depth )
+{
+	// near is bright, holes are red
+	Surface8u surface( kWidth, kHeight, false );
+	Surface8u::Iter it = surface.getIter();
+	while ( it.line() )
+	{
+		while ( it.pixel() )
+		{
+			uint16_t d = depth[ it.y() * kWidth + it.x() ];
+			uint8_t v = uint8_t( 255 - std::min( d / 16, 255 ) );
+			it.r() = d == 0 ? 255 : v;
+			it.g() = d == 0 ? 0 : v;
+			it.b() = d == 0 ? 0 : v;
+		}
+	}
+	return gl::Texture( surface );
+}
+
+void NIDepthFilterBenchApp::draw()
+{
+	gl::clear( Color::black() );
+	gl::setMatricesWindow( getWindowWidth(), getWindowHeight() );
+
+	if ( mDepthTexture )
+		gl::draw( mDepthTexture );
+	if ( mFilledTexture )
+		gl::draw( mFilledTexture, Vec2i( kWidth, 0 ) );
+
+	for ( size_t i = 0; i < mResults.size(); i++ )
+		gl::drawString( mResults[ i ], Vec2f( 10, kHeight + 20 + i * 20 ) );
+}
+
+CINDER_APP_BASIC( NIDepthFilterBenchApp, RendererGl() )
@@ -41,8 +41,8 @@ namespace mndl { namespace ni {
 
 class ImageSourceOpenNIColor : public ImageSource {
 	public:
-		ImageSourceOpenNIColor( uint8_t *buffer, int w, int h, shared_ptr<OpenNI::Obj> ownerObj )
-			: ImageSource(), mData( buffer ), mOwnerObj( ownerObj )
+		ImageSourceOpenNIColor( uint8_t *buffer, int w, int h, size_t stride, shared_ptr<OpenNI::Obj> ownerObj )
+			: ImageSource(), mData( buffer ), mOwnerObj( ownerObj ), mStride( stride )
 		{
 			setSize( w, h );
 			setColorModel( ImageIo::CM_RGB );
@@ -61,18 +61,19 @@ class ImageSourceOpenNIColor : public ImageSource {
 			ImageSource::RowFunc func = setupRowFunc( target );
 
 			for( int32_t row = 0; row < mHeight; ++row )
-				((*this).*func)( target, row, mData + row * mWidth * 3 );
+				((*this).*func)( target, row, mData + row * mStride );
 		}
 
 	protected:
 		shared_ptr<OpenNI::Obj>     mOwnerObj;
 		uint8_t                     *mData;
+		size_t                      mStride;
 };
 
 class ImageSourceOpenNIInfrared : public ImageSource {
 	public:
-		ImageSourceOpenNIInfrared( uint8_t *buffer, int w, int h, shared_ptr<OpenNI::Obj> ownerObj )
-			: ImageSource(), mData( buffer ), mOwnerObj( ownerObj )
+		ImageSourceOpenNIInfrared( uint8_t *buffer, int w, int h, size_t stride, shared_ptr<OpenNI::Obj> ownerObj )
+			: ImageSource(), mData( buffer ), mOwnerObj( ownerObj ), mStride( stride )
 		{
 			setSize( w, h );
 			setColorModel( ImageIo::CM_GRAY );
@@ -83,7 +84,7 @@ class ImageSourceOpenNIInfrared : public ImageSource {
 		~ImageSourceOpenNIInfrared()
 		{
 			// let the owner know we are done with the buffer
-			mOwnerObj->mColorBuffers.derefBuffer( mData );
+			mOwnerObj->mIRBuffers.derefBuffer( mData );
 		}
 
 		virtual void load( ImageTargetRef target )
@@ -91,18 +92,19 @@ class ImageSourceOpenNIInfrared : public ImageSource {
 			ImageSource::RowFunc func = setupRowFunc( target );
 
 			for( int32_t row = 0; row < mHeight; ++row )
-				((*this).*func)( target, row, mData + row * mWidth );
+				((*this).*func)( target, row, mData + row * mStride );
 		}
 
 	protected:
 		shared_ptr<OpenNI::Obj>		mOwnerObj;
 		uint8_t						*mData;
+		size_t						mStride;
 };
 
 class ImageSourceOpenNIDepth : public ImageSource {
 	public:
-		ImageSourceOpenNIDepth( uint16_t *buffer, int w, int h, shared_ptr<OpenNI::Obj> ownerObj )
-			: ImageSource(), mData( buffer ), mOwnerObj( ownerObj )
+		ImageSourceOpenNIDepth( uint16_t *buffer, int w, int h, size_t stride, shared_ptr<OpenNI::Obj> ownerObj )
+			: ImageSource(), mData( buffer ), mOwnerObj( ownerObj ), mStride( stride )
 		{
 			setSize( w, h );
 			setColorModel( ImageIo::CM_GRAY );
@@ -121,17 +123,136 @@ class ImageSourceOpenNIDepth : public ImageSource {
 			ImageSource::RowFunc func = setupRowFunc( target );
 
 			for( int32_t row = 0; row < mHeight; ++row )
-				((*this).*func)( target, row, mData + row * mWidth );
+				((*this).*func)( target, row, mData + row * mStride );
+		}
+
+	protected:
+		shared_ptr<OpenNI::Obj>     mOwnerObj;
+		uint16_t                    *mData;
+		size_t                      mStride;
+};
+
+class ImageSourceOpenNIInfrared16 : public ImageSource {
+	public:
+		ImageSourceOpenNIInfrared16( uint16_t *buffer, int w, int h, size_t stride, shared_ptr<OpenNI::Obj> ownerObj )
+			: ImageSource(), mOwnerObj( ownerObj ), mData( buffer ), mStride( stride )
+		{
+			setSize( w, h );
+			setColorModel( ImageIo::CM_GRAY );
+			setChannelOrder( ImageIo::Y );
+			setDataType( ImageIo::UINT16 );
+		}
+
+		~ImageSourceOpenNIInfrared16()
+		{
+			// let the owner know we are done with the buffer
+			mOwnerObj->mIR16Buffers.derefBuffer( mData );
+		}
+
+		virtual void load( ImageTargetRef target )
+		{
+			ImageSource::RowFunc func = setupRowFunc( target );
+
+			for( int32_t row = 0; row < mHeight; ++row )
+				((*this).*func)( target, row, mData + row * mStride );
 		}
 
 	protected:
 		shared_ptr<OpenNI::Obj>     mOwnerObj;
 		uint16_t                    *mData;
+		size_t                      mStride;
 };
 
 OpenNI::OpenNI( Device device, const Options &options )
-	: mObj( new Obj( device.mIndex, options ) )
+	: mObj( new Obj( device, options ) )
+{
+}
+
+// sets \a mode if the generator supports it. Otherwise lists the supported modes and throws if the mode is \a required,
+// or keeps the device default if it is only the default of the options
+static void setMapOutputMode( MapGenerator &generator, const XnMapOutputMode &mode, bool required, const string &name )
+{
+	if ( ( mode.nXRes == 0 ) || ( mode.nYRes == 0 ) ) // keep the device default
+		return;
+
+	XnUInt32 count = generator.GetSupportedMapOutputModesCount();
+	vector< XnMapOutputMode > modes( count );
+	if ( count > 0 )
+		generator.GetSupportedMapOutputModes( &modes[ 0 ], count );
+
+	for ( XnUInt32 i = 0; i < count; i++ )
+	{
+		if ( ( modes[ i ].nXRes == mode.nXRes ) && ( modes[ i ].nYRes == mode.nYRes ) &&
+			 ( modes[ i ].nFPS == mode.nFPS ) )
+		{
+			checkRc( generator.SetMapOutputMode( mode ), name + ".SetMapOutputMode" );
+			return;
+		}
+	}
+
+	if ( !required )
+	{
+		XnMapOutputMode current;
+		generator.GetMapOutputMode( current );
+		console() << "OpenNI - " << name << " does not support " << mode.nXRes << "x" << mode.nYRes << "@" << mode.nFPS << ", keeping the device default "
+				  << current.nXRes << "x" << current.nYRes << "@" << current.nFPS << endl;
+		return;
+	}
+
+	console() << "OpenNI Error - " << name << " does not support " << mode.nXRes << "x" << mode.nYRes << "@" << mode.nFPS << ", supported modes:" << endl;
+	for ( XnUInt32 i = 0; i < count; i++ )
+		console() << "\t" << modes[ i ].nXRes << "x" << modes[ i ].nYRes << "@" << modes[ i ].nFPS << endl;
+	throw ExcUnsupportedOutputMode();
+}
+
+static void readDeviceIdentification( xn::Device &device, string *name, string *serial )
+{
+	if ( !device.IsCapabilitySupported( XN_CAPABILITY_DEVICE_IDENTIFICATION ) )
+		return;
+
+	XnChar buffer[ 256 ];
+	XnUInt32 length = sizeof( buffer );
+	if ( device.GetIdentificationCap().GetDeviceName( buffer, length ) == XN_STATUS_OK )
+		*name = string( buffer );
+	length = sizeof( buffer );
+	if ( device.GetIdentificationCap().GetSerialNumber( buffer, length ) == XN_STATUS_OK )
+		*serial = string( buffer );
+}
+
+vector< OpenNI::DeviceInfo > OpenNI::getDevices()
 {
+	vector< DeviceInfo > devices;
+
+	Context context;
+	XnStatus rc = context.Init();
+	if ( !checkRc( rc, "context" ) )
+		return devices;
+
+	NodeInfoList list;
+	rc = context.EnumerateProductionTrees( XN_NODE_TYPE_DEVICE, NULL, list );
+	if ( rc == XN_STATUS_OK )
+	{
+		int index = 0;
+		for ( NodeInfoList::Iterator it = list.Begin(); it != list.End(); ++it, index++ )
+		{
+			NodeInfo info = *it;
+			DeviceInfo deviceInfo;
+			deviceInfo.mIndex = index;
+			deviceInfo.mUri = info.GetCreationInfo();
+
+			// devices opened by another instance cannot be created here and are listed without identification
+			xn::Device device;
+			if ( context.CreateProductionTree( info, device ) == XN_STATUS_OK )
+			{
+				readDeviceIdentification( device, &deviceInfo.mName, &deviceInfo.mSerial );
+				device.Release();
+			}
+			devices.push_back( deviceInfo );
+		}
+	}
+
+	context.Shutdown();
+	return devices;
 }
 
 OpenNI::OpenNI( const fs::path &recording, const Options &options )
@@ -149,84 +270,149 @@ void OpenNI::stop()
 	mObj->stop();
 }
 
-OpenNI::Obj::Obj( int deviceIndex, const Options &options )
-	: mShouldDie( false ),
-	  mNewDepthFrame( false ),
-	  mNewVideoFrame( false ),
+OpenNI::Obj::Obj( const Device &device, const Options &options )
+	: mConvertedDepthFrameId( 0 ),
+	  mConvertedVideoFrameId( 0 ),
+	  mColorizedDepthFrameId( 0 ),
+	  mNewDataSignaled( false ),
 	  mRecording( false ),
-	  mOptions( options )
+	  mPlayback( false ),
+	  mOptions( options ),
+	  mDepthFullWidth( 0 ), mDepthFullHeight( 0 ),
+	  mImageFullWidth( 0 ), mImageFullHeight( 0 ),
+	  mIRFullWidth( 0 ), mIRFullHeight( 0 ),
+	  mDepthCropped( false ),
+	  mShouldDie( false ),
+	  mNewDepthFrame( 0 ),
+	  mNewVideoFrame( 0 ),
+	  mDepthAligned( false ),
+	  mSoftwareRegistration( false ),
+	  mRegisteredFrameId( 0 )
 {
 	XnStatus rc = mContext.Init();
 	checkRc( rc, "context" );
 
+	// device, by index or by URI or serial number
+	NodeInfoList devices;
+	rc = mContext.EnumerateProductionTrees( XN_NODE_TYPE_DEVICE, NULL, devices );
+	if ( !checkRc( rc, "EnumerateProductionTrees" ) )
+		throw ExcDeviceNotAvailable();
+
+	int index = 0;
+	for ( NodeInfoList::Iterator it = devices.Begin(); it != devices.End(); ++it, index++ )
+	{
+		NodeInfo info = *it;
+		bool match = device.mId.empty() ? ( index == device.mIndex ) : ( device.mId == info.GetCreationInfo() );
+		if ( !match && device.mId.empty() )
+			continue;
+
+		if ( mContext.CreateProductionTree( info, mDevice ) != XN_STATUS_OK )
+			continue;
+
+		if ( !match )
+		{
+			string name, serial;
+			readDeviceIdentification( mDevice, &name, &serial );
+			match = ( serial == device.mId );
+		}
+		if ( match )
+			break;
+		mDevice.Release();
+	}
+	if ( !mDevice.IsValid() )
+		throw ExcDeviceNotAvailable();
+
+	// generators are created on the selected device only
+	Query query;
+	query.AddNeededNode( mDevice.GetInfo().GetInstanceName() );
+
 	// depth
 	if ( options.getDepthEnabled() )
 	{
-		rc = mDepthGenerator.Create(mContext);
+		rc = mDepthGenerator.Create( mContext, &query );
 		if ( rc != XN_STATUS_OK )
 			throw ExcFailedDepthGeneratorInit();
-		// make new map mode -> default to 640 x 480 @ 30fps
 		// asus xtion default is 320x240 @ 60fps
-		XnMapOutputMode mapMode;
-		mapMode.nXRes = 640;
-		mapMode.nYRes = 480;
-		mapMode.nFPS  = 30;
-		mDepthGenerator.SetMapOutputMode( mapMode );
+		setMapOutputMode( mDepthGenerator, options.getDepthOutputMode(), options.isDepthOutputModeSet(), "DepthGenerator" );
 
 		mDepthGenerator.GetMetaData( mDepthMD );
-		mDepthWidth = mDepthMD.FullXRes();
-		mDepthHeight = mDepthMD.FullYRes();
+		mDepthFullWidth = mDepthMD.FullXRes();
+		mDepthFullHeight = mDepthMD.FullYRes();
 		mDepthMaxDepth = mDepthGenerator.GetDeviceMaxDepth();
-
-		mDepthBuffers = BufferManager<uint16_t>( mDepthWidth * mDepthHeight, this );
 	}
 
 	// image
 	if ( options.getImageEnabled() )
 	{
-		rc = mImageGenerator.Create(mContext);
+		rc = mImageGenerator.Create( mContext, &query );
 		if ( rc != XN_STATUS_OK )
 			throw ExcFailedImageGeneratorInit();
+		setMapOutputMode( mImageGenerator, options.getImageOutputMode(), options.isImageOutputModeSet(), "ImageGenerator" );
 		mImageGenerator.GetMetaData( mImageMD );
-		mImageWidth = mImageMD.FullXRes();
-		mImageHeight = mImageMD.FullYRes();
+		mImageFullWidth = mImageMD.FullXRes();
+		mImageFullHeight = mImageMD.FullYRes();
 	}
 
 	// IR
 	if ( options.getIREnabled() )
 	{
-		rc = mIRGenerator.Create(mContext);
+		rc = mIRGenerator.Create( mContext, &query );
 		if ( rc != XN_STATUS_OK )
 			throw ExcFailedIRGeneratorInit();
-		// make new map mode -> default to 640 x 480 @ 30fps
-		XnMapOutputMode mapMode;
-		mapMode.nXRes = 640;
-		mapMode.nYRes = 480;
-		mapMode.nFPS  = 30;
-		mIRGenerator.SetMapOutputMode( mapMode );
+		setMapOutputMode( mIRGenerator, options.getIROutputMode(), options.isIROutputModeSet(), "IRGenerator" );
 
 		mIRGenerator.GetMetaData( mIRMD );
-		mIRWidth = mIRMD.FullXRes();
-		mIRHeight = mIRMD.FullYRes();
+		mIRFullWidth = mIRMD.FullXRes();
+		mIRFullHeight = mIRMD.FullYRes();
 	}
 
-	if ( options.getImageEnabled() || options.getIREnabled() )
-		mColorBuffers = BufferManager<uint8_t>( 640 * 480 * 3, this );
-
 	mLastVideoFrameInfrared = mVideoInfrared = options.getIREnabled() && !options.getImageEnabled();
 
-	// user tracker
+	// let the device deliver depth and image frames in pairs
+	if ( options.getFrameSyncEnabled() && mDepthGenerator.IsValid() && mImageGenerator.IsValid() &&
+		 mDepthGenerator.IsCapabilitySupported( XN_CAPABILITY_FRAME_SYNC ) &&
+		 mDepthGenerator.GetFrameSyncCap().CanFrameSyncWith( mImageGenerator ) )
+	{
+		rc = mDepthGenerator.GetFrameSyncCap().FrameSyncWith( mImageGenerator );
+		checkRc( rc, "FrameSyncWith" );
+	}
+
+	setupRegionsOfInterest();
+	setupCropping();
+
+	// user tracker, its pools are allocated with the others
 	if ( options.getUserTrackerEnabled() )
+	{
 		mUserTracker = UserTracker( mContext );
+		mUserTracker.mObj->mLazyLabels = options.getLazyConversionEnabled();
+		if ( options.getFrameSyncEnabled() )
+			mUserTracker.mObj->setupFrameRing( kFrameSyncRingSize );
+		if ( hasRegionsOfInterest() && mDepthGenerator.IsValid() )
+			mUserTracker.mObj->setRegion( mDepthRoi, mOptions.getRegionsOfInterest() );
+	}
+
+	setupBuffers();
 }
 
 OpenNI::Obj::Obj( const fs::path &recording, const Options &options )
-	: mShouldDie( false ),
-	  mNewDepthFrame( false ),
-	  mNewVideoFrame( false ),
-	  mVideoInfrared( false ),
+	: mConvertedDepthFrameId( 0 ),
+	  mConvertedVideoFrameId( 0 ),
+	  mColorizedDepthFrameId( 0 ),
+	  mNewDataSignaled( false ),
 	  mRecording( false ),
-	  mOptions( options )
+	  mPlayback( true ),
+	  mOptions( options ),
+	  mDepthFullWidth( 0 ), mDepthFullHeight( 0 ),
+	  mImageFullWidth( 0 ), mImageFullHeight( 0 ),
+	  mIRFullWidth( 0 ), mIRFullHeight( 0 ),
+	  mDepthCropped( false ),
+	  mShouldDie( false ),
+	  mNewDepthFrame( 0 ),
+	  mNewVideoFrame( 0 ),
+	  mVideoInfrared( false ),
+	  mDepthAligned( false ),
+	  mSoftwareRegistration( false ),
+	  mRegisteredFrameId( 0 )
 {
 	XnStatus rc = mContext.Init();
 	checkRc( rc, "context" );
@@ -264,11 +450,9 @@ OpenNI::Obj::Obj( const fs::path &recording, const Options &options )
 	if ( mDepthGenerator.IsValid() )
 	{
 		mDepthGenerator.GetMetaData( mDepthMD );
-		mDepthWidth = mDepthMD.FullXRes();
-		mDepthHeight = mDepthMD.FullYRes();
+		mDepthFullWidth = mDepthMD.FullXRes();
+		mDepthFullHeight = mDepthMD.FullYRes();
 		mDepthMaxDepth = mDepthGenerator.GetDeviceMaxDepth();
-
-		mDepthBuffers = BufferManager<uint16_t>( mDepthWidth * mDepthHeight, this );
 	}
 	mOptions.setDepthEnabled( mDepthGenerator.IsValid() );
 
@@ -276,10 +460,8 @@ OpenNI::Obj::Obj( const fs::path &recording, const Options &options )
 	if ( mImageGenerator.IsValid() )
 	{
 		mImageGenerator.GetMetaData( mImageMD );
-		mImageWidth = mImageMD.FullXRes();
-		mImageHeight = mImageMD.FullYRes();
-
-		mColorBuffers = BufferManager<uint8_t>( mImageWidth * mImageHeight * 3, this );
+		mImageFullWidth = mImageMD.FullXRes();
+		mImageFullHeight = mImageMD.FullYRes();
 		mVideoInfrared = false;
 	}
 	mOptions.setImageEnabled( mImageGenerator.IsValid() );
@@ -287,27 +469,279 @@ OpenNI::Obj::Obj( const fs::path &recording, const Options &options )
 	// IR
 	if ( mIRGenerator.IsValid() )
 	{
-		// make new map mode -> default to 640 x 480 @ 30fps
-		XnMapOutputMode mapMode;
-		mapMode.nXRes = 640;
-		mapMode.nYRes = 480;
-		mapMode.nFPS  = 30;
-		mIRGenerator.SetMapOutputMode( mapMode );
-
+		// recordings are played back in the mode they were recorded in
 		mIRGenerator.GetMetaData( mIRMD );
-		mIRWidth = mIRMD.FullXRes();
-		mIRHeight = mIRMD.FullYRes();
-
-		mColorBuffers = BufferManager<uint8_t>( mIRWidth * mIRHeight * 3, this );
+		mIRFullWidth = mIRMD.FullXRes();
+		mIRFullHeight = mIRMD.FullYRes();
 		mVideoInfrared = true;
 	}
 	mOptions.setIREnabled( mIRGenerator.IsValid() );
 
-	// user tracker
+	// user tracker, its pools are allocated with the others
 	if ( mOptions.getUserTrackerEnabled() )
+	{
 		mUserTracker = UserTracker( mContext );
+		mUserTracker.mObj->mLazyLabels = mOptions.getLazyConversionEnabled();
+		if ( mOptions.getFrameSyncEnabled() )
+			mUserTracker.mObj->setupFrameRing( kFrameSyncRingSize );
+	}
 
 	mLastVideoFrameInfrared = mVideoInfrared;
+
+	// recordings are played back uncropped, the regions are cropped on the CPU
+	setupRegionsOfInterest();
+	if ( mUserTracker && hasRegionsOfInterest() && mDepthGenerator.IsValid() )
+		mUserTracker.mObj->setRegion( mDepthRoi, mOptions.getRegionsOfInterest() );
+	setupBuffers();
+}
+
+// scales \a area of a frame of \a fromWidth x \a fromHeight to a frame of \a toWidth x \a toHeight, rounding outwards
+static Area scaleArea( const Area &area, int fromWidth, int fromHeight, int toWidth, int toHeight )
+{
+	return Area( area.x1 * toWidth / fromWidth, area.y1 * toHeight / fromHeight,
+				 ( area.x2 * toWidth + fromWidth - 1 ) / fromWidth, ( area.y2 * toHeight + fromHeight - 1 ) / fromHeight );
+}
+
+void OpenNI::Obj::setupRegionsOfInterest()
+{
+	// the regions are given in the coordinates of the depth frame, or the video frame without depth
+	int width = mDepthFullWidth;
+	int height = mDepthFullHeight;
+	if ( !mDepthGenerator.IsValid() )
+	{
+		width = mImageGenerator.IsValid() ? mImageFullWidth : mIRFullWidth;
+		height = mImageGenerator.IsValid() ? mImageFullHeight : mIRFullHeight;
+	}
+
+	const vector< Area > &regions = mOptions.getRegionsOfInterest();
+	Area frame( 0, 0, width, height );
+	Area bounds( frame );
+	if ( !regions.empty() )
+	{
+		bounds = regions[ 0 ];
+		for ( size_t i = 1; i < regions.size(); i++ )
+		{
+			bounds.x1 = std::min( bounds.x1, regions[ i ].x1 );
+			bounds.y1 = std::min( bounds.y1, regions[ i ].y1 );
+			bounds.x2 = std::max( bounds.x2, regions[ i ].x2 );
+			bounds.y2 = std::max( bounds.y2, regions[ i ].y2 );
+		}
+		bounds.clipBy( frame );
+		if ( ( bounds.getWidth() <= 0 ) || ( bounds.getHeight() <= 0 ) )
+		{
+			console() << "OpenNI regions of interest are outside of the frame, capturing the full frame" << endl;
+			mOptions.setRegionsOfInterest( vector< Area >() );
+			bounds = frame;
+		}
+	}
+
+	mDepthRoi = mDepthGenerator.IsValid() ? bounds : Area( 0, 0, 0, 0 );
+	mDepthWidth = mDepthRoi.getWidth();
+	mDepthHeight = mDepthRoi.getHeight();
+	mImageRoi = mImageGenerator.IsValid() ? scaleArea( bounds, width, height, mImageFullWidth, mImageFullHeight ) : Area( 0, 0, 0, 0 );
+	mImageWidth = mImageRoi.getWidth();
+	mImageHeight = mImageRoi.getHeight();
+	mIRRoi = mIRGenerator.IsValid() ? scaleArea( bounds, width, height, mIRFullWidth, mIRFullHeight ) : Area( 0, 0, 0, 0 );
+	mIRWidth = mIRRoi.getWidth();
+	mIRHeight = mIRRoi.getHeight();
+
+	mRoiCoverage.clear();
+	mRoiDepth.clear();
+	if ( !hasRegionsOfInterest() || !mDepthGenerator.IsValid() )
+		return;
+
+	mRoiDepth.resize( mDepthWidth * mDepthHeight );
+	if ( mOptions.getRegionsOfInterest().size() > 1 )
+	{
+		// the pixels of the bounding rectangle outside of every region are masked
+		mRoiCoverage.resize( mDepthWidth * mDepthHeight, 0 );
+		for ( size_t i = 0; i < regions.size(); i++ )
+		{
+			Area region = regions[ i ].getClipBy( mDepthRoi );
+			for ( int y = region.y1; y < region.y2; y++ )
+			{
+				uint8_t *row = &mRoiCoverage[ ( y - mDepthRoi.y1 ) * mDepthWidth ];
+				std::fill( row + region.x1 - mDepthRoi.x1, row + region.x2 - mDepthRoi.x1, 1 );
+			}
+		}
+	}
+}
+
+// sets the cropping of \a generator to \a area if the device supports it
+static void setCropping( MapGenerator &generator, const Area &area, const string &name )
+{
+	if ( !generator.IsValid() || !generator.IsCapabilitySupported( XN_CAPABILITY_CROPPING ) )
+		return;
+
+	XnCropping cropping;
+	cropping.bEnabled = TRUE;
+	cropping.nXOffset = area.x1;
+	cropping.nYOffset = area.y1;
+	cropping.nXSize = area.getWidth();
+	cropping.nYSize = area.getHeight();
+	checkRc( generator.GetCroppingCap().SetCropping( cropping ), name + ".SetCropping" );
+}
+
+void OpenNI::Obj::setupCropping()
+{
+	// the user generator needs the full depth frame
+	if ( !hasRegionsOfInterest() || mOptions.getUserTrackerEnabled() )
+		return;
+
+	// the driver frames are cropped to the bounding rectangle, their metadata offsets are handled by the conversions
+	setCropping( mDepthGenerator, mDepthRoi, "DepthGenerator" );
+	setCropping( mImageGenerator, mImageRoi, "ImageGenerator" );
+	setCropping( mIRGenerator, mIRRoi, "IRGenerator" );
+}
+
+void OpenNI::Obj::setupBuffers()
+{
+	bool padded = mOptions.getPaddedStrideEnabled();
+
+	size_t depthSize = 0;
+	if ( mDepthGenerator.IsValid() )
+	{
+		mDepthStride = BufferManager<uint16_t>::calcStride( mDepthWidth, padded );
+		depthSize = mDepthStride * mDepthHeight;
+	}
+
+	// the pyramid levels are stored after the full resolution depth in the same buffer
+	mDepthPyramid = PyramidLayout();
+	size_t pyramidSize = 0;
+	if ( depthSize > 0 )
+	{
+		for ( int32_t l = 1; l <= mOptions.getDepthPyramidLevels(); l++ )
+		{
+			int levelWidth = mDepthWidth >> l;
+			int levelHeight = mDepthHeight >> l;
+			if ( ( levelWidth == 0 ) || ( levelHeight == 0 ) )
+				break;
+			mDepthPyramid.offsets[ l - 1 ] = depthSize + pyramidSize;
+			mDepthPyramid.strides[ l - 1 ] = BufferManager<uint16_t>::calcStride( levelWidth, padded );
+			mDepthPyramid.numLevels = l;
+			pyramidSize += mDepthPyramid.strides[ l - 1 ] * levelHeight;
+		}
+	}
+
+	size_t colorSize = 0;
+	if ( mImageGenerator.IsValid() )
+	{
+		mImageStride = BufferManager<uint8_t>::calcStride( mImageWidth * 3, padded );
+		colorSize = mImageStride * mImageHeight;
+	}
+
+	size_t irSize = 0;
+	size_t ir16Size = 0;
+	mIR16Stride = 0;
+	if ( mIRGenerator.IsValid() )
+	{
+		mIRStride = BufferManager<uint8_t>::calcStride( mIRWidth, padded );
+		irSize = mIRStride * mIRHeight;
+		if ( mOptions.getFullPrecisionIREnabled() )
+		{
+			mIR16Stride = BufferManager<uint16_t>::calcStride( mIRWidth, padded );
+			ir16Size = mIR16Stride * mIRHeight;
+		}
+	}
+
+	size_t filteredDepthSize = mOptions.getTemporalFilterEnabled() ? depthSize : 0;
+	size_t windowedDepthSize = 0;
+	size_t depthMaskSize = 0;
+	mDepth8Stride = 0;
+	if ( ( depthSize > 0 ) && ( mOptions.getWindowedDepthEnabled() || mOptions.getDepthMaskEnabled() ) )
+	{
+		mDepth8Stride = BufferManager<uint8_t>::calcStride( mDepthWidth, padded );
+		windowedDepthSize = mOptions.getWindowedDepthEnabled() ? mDepth8Stride * mDepthHeight : 0;
+		depthMaskSize = mOptions.getDepthMaskEnabled() ? mDepth8Stride * mDepthHeight : 0;
+	}
+	size_t colorizedDepthSize = 0;
+	mColorizedDepthStride = 0;
+	if ( ( depthSize > 0 ) && mOptions.getDepthColorizerEnabled() )
+	{
+		mColorizedDepthStride = BufferManager<uint8_t>::calcStride( mDepthWidth * 3, padded );
+		colorizedDepthSize = mColorizedDepthStride * mDepthHeight;
+	}
+
+	int bufferCount = mOptions.getBufferCount();
+	size_t frameBytes = ( depthSize + pyramidSize + filteredDepthSize + ir16Size ) * sizeof( uint16_t ) + ( colorSize + irSize + colorizedDepthSize + windowedDepthSize + depthMaskSize ) * sizeof( uint8_t );
+	if ( mUserTracker )
+		frameBytes += mUserTracker.mObj->getFrameBytes( padded );
+	size_t budget = mOptions.getMemoryBudget();
+	if ( ( budget > 0 ) && ( frameBytes > 0 ) && ( bufferCount * frameBytes > budget ) )
+	{
+		bufferCount = std::max( int( budget / frameBytes ), 2 );
+		console() << "OpenNI buffer count reduced to " << bufferCount << " to fit memory budget of " << budget << " bytes" << endl;
+	}
+
+	// frames retained for synchronization are referenced on top of the buffers the capture thread cycles through
+	int32_t ringSize = mOptions.getFrameSyncEnabled() ? kFrameSyncRingSize : 0;
+
+	int flags = ( padded ? BUFFER_PADDED_STRIDE : 0 ) | ( mOptions.getHugePagesEnabled() ? BUFFER_HUGE_PAGES : 0 );
+	// parts of the regions a driver frame does not cover stay empty
+	if ( hasRegionsOfInterest() )
+		flags |= BUFFER_ZERO_FILL;
+	if ( depthSize > 0 )
+	{
+		mDepthBuffers.setup( depthSize + pyramidSize, bufferCount + ringSize, mOptions.getOverflowPolicy(), flags );
+		mDepthRing.setup( &mDepthBuffers, ringSize );
+	}
+	if ( colorSize > 0 )
+	{
+		mColorBuffers.setup( colorSize, bufferCount + ringSize, mOptions.getOverflowPolicy(), flags );
+		mColorRing.setup( &mColorBuffers, ringSize );
+	}
+	if ( irSize > 0 )
+	{
+		mIRBuffers.setup( irSize, bufferCount + ringSize, mOptions.getOverflowPolicy(), flags );
+		mIRRing.setup( &mIRBuffers, ringSize );
+	}
+	if ( ir16Size > 0 )
+		mIR16Buffers.setup( ir16Size, bufferCount, mOptions.getOverflowPolicy(), flags );
+	if ( filteredDepthSize > 0 )
+	{
+		mFilteredDepthBuffers.setup( filteredDepthSize, bufferCount, mOptions.getOverflowPolicy(), flags );
+		mTemporalFilter = TemporalDepthFilter( mOptions.getTemporalFilterOptions() );
+	}
+	if ( windowedDepthSize > 0 )
+		mWindowedDepthBuffers.setup( windowedDepthSize, bufferCount, mOptions.getOverflowPolicy(), flags );
+	if ( depthMaskSize > 0 )
+		mDepthMaskBuffers.setup( depthMaskSize, bufferCount, mOptions.getOverflowPolicy(), flags );
+	if ( colorizedDepthSize > 0 )
+	{
+		mColorizedDepthBuffers.setup( colorizedDepthSize, bufferCount, mOptions.getOverflowPolicy(), flags );
+		mDepthColorizer = DepthColorizer( mOptions.getDepthColorizerOptions() );
+	}
+	if ( ( depthSize > 0 ) && mOptions.getSpatialFilterEnabled() )
+		mSpatialFilter = shared_ptr<SpatialDepthFilter>( new SpatialDepthFilter( mOptions.getSpatialFilterOptions() ) );
+	if ( mUserTracker )
+		mUserTracker.mObj->setupBuffers( bufferCount, mOptions.getOverflowPolicy(), flags );
+}
+
+void OpenNI::Obj::cancelBufferWaits( bool cancel )
+{
+	mDepthBuffers.cancelWait( cancel );
+	mFilteredDepthBuffers.cancelWait( cancel );
+	mColorizedDepthBuffers.cancelWait( cancel );
+	mWindowedDepthBuffers.cancelWait( cancel );
+	mDepthMaskBuffers.cancelWait( cancel );
+	mColorBuffers.cancelWait( cancel );
+	mIRBuffers.cancelWait( cancel );
+	mIR16Buffers.cancelWait( cancel );
+	mRawDepth.cancelWait( cancel );
+	mRawImage.cancelWait( cancel );
+	mRawIR.cancelWait( cancel );
+	if ( mUserTracker )
+	{
+		mUserTracker.mObj->mLabelBuffers.cancelWait( cancel );
+		mUserTracker.mObj->mBitMaskBuffers.cancelWait( cancel );
+		mUserTracker.mObj->mRawLabels.cancelWait( cancel );
+	}
+	if ( cancel )
+	{
+		// wakes a capture thread waiting for new data
+		lock_guard< mutex > lock( mNewDataMutex );
+		mNewDataCond.notify_all();
+	}
 }
 
 OpenNI::Obj::~Obj()
@@ -339,9 +773,11 @@ void OpenNI::Obj::start()
 	if ( mThread )
 	{
 		mShouldDie = true;
+		cancelBufferWaits( true );
 		mThread->join();
 	}
 	mShouldDie = false;
+	cancelBufferWaits( false );
 	mThread = shared_ptr< thread >( new thread( threadedFunc, this ) );
 	mIsCapturing = true;
 }
@@ -350,6 +786,8 @@ void OpenNI::Obj::stop()
 {
 	mIsCapturing = false;
 	mShouldDie = true;
+	// a capture thread blocked on a full pool would never see mShouldDie
+	cancelBufferWaits( true );
 	if ( mThread )
 	{
 		mThread->join();
@@ -378,160 +816,1171 @@ void OpenNI::Obj::stop()
 
 void OpenNI::Obj::threadedFunc( OpenNI::Obj *obj )
 {
+	// on demand the driver frames have to be revoked before the update, so the thread waits for new data itself
+	XnCallbackHandle depthNewData = NULL, imageNewData = NULL, irNewData = NULL;
+	if ( obj->isDepthOnDemand() && !obj->mPlayback )
+	{
+		if ( obj->mDepthGenerator.IsValid() )
+			obj->mDepthGenerator.RegisterToNewDataAvailable( newDataAvailableCB, obj, depthNewData );
+		if ( obj->mImageGenerator.IsValid() )
+			obj->mImageGenerator.RegisterToNewDataAvailable( newDataAvailableCB, obj, imageNewData );
+		if ( obj->mIRGenerator.IsValid() )
+			obj->mIRGenerator.RegisterToNewDataAvailable( newDataAvailableCB, obj, irNewData );
+	}
+
 	while ( !obj->mShouldDie )
 	{
 		{
-			// TODO: this really drops framerate
-			//lock_guard<recursive_mutex> lock( obj->mMutex );
+			// frames are exchanged through the lock-free buffer managers, no lock is held while capturing
 			XnStatus status;
+
+			xn::Generator *generator = NULL;
 			if ( obj->mDepthGenerator.IsValid() )
-			{
-				status = obj->mContext.WaitOneUpdateAll( obj->mDepthGenerator );
-			}
+				generator = &obj->mDepthGenerator;
 			else
 				if ( obj->mImageGenerator.IsValid() && obj->mImageGenerator.IsGenerating() )
-				{
-					status = obj->mContext.WaitOneUpdateAll( obj->mImageGenerator );
-				}
+					generator = &obj->mImageGenerator;
 				else
 					if ( obj->mIRGenerator.IsValid() && obj->mIRGenerator.IsGenerating() )
-					{
-						status = obj->mContext.WaitOneUpdateAll( obj->mIRGenerator );
-					}
-			checkRc( status, "WaitOneUpdateAll" );
+						generator = &obj->mIRGenerator;
+
+			if ( generator == NULL )
+			{
+				this_thread::sleep_for( chrono::milliseconds( 1 ) );
+				continue;
+			}
+
+			bool lowLatency = obj->mOptions.getLowLatencyEnabled();
+			if ( obj->isDepthOnDemand() )
+			{
+				// keep the current driver frames pinnable until the next one arrives, recordings
+				// only read new data when updated
+				if ( !obj->mPlayback )
+					obj->waitForNewData( generator, lowLatency );
+				if ( obj->mShouldDie )
+					break;
+
+				// the update replaces the pinned driver frames
+				if ( !obj->revokeRawFrames() )
+					continue;
+			}
+
+			if ( lowLatency )
+			{
+				// publish whichever streams have new data, the generators skip the others
+				status = obj->mContext.WaitAnyUpdateAll();
+				checkRc( status, "WaitAnyUpdateAll" );
+			}
+			else
+			{
+				status = obj->mContext.WaitOneUpdateAll( *generator );
+				checkRc( status, "WaitOneUpdateAll" );
+			}
 		}
 
 		obj->generateDepth();
+		obj->generateUsers();
 		obj->generateImage();
 		obj->generateIR();
 	}
+
+	if ( depthNewData != NULL )
+		obj->mDepthGenerator.UnregisterFromNewDataAvailable( depthNewData );
+	if ( imageNewData != NULL )
+		obj->mImageGenerator.UnregisterFromNewDataAvailable( imageNewData );
+	if ( irNewData != NULL )
+		obj->mIRGenerator.UnregisterFromNewDataAvailable( irNewData );
 }
 
-void OpenNI::Obj::generateDepth()
+void XN_CALLBACK_TYPE OpenNI::Obj::newDataAvailableCB( xn::ProductionNode &node, void *pCookie )
 {
-	if ( !mDepthGenerator.IsValid() )
-		return;
+	OpenNI::Obj *obj = static_cast< OpenNI::Obj * >( pCookie );
+	lock_guard< mutex > lock( obj->mNewDataMutex );
+	obj->mNewDataSignaled = true;
+	obj->mNewDataCond.notify_all();
+}
 
+void OpenNI::Obj::waitForNewData( xn::Generator *generator, bool lowLatency )
+{
+	while ( !mShouldDie && !( lowLatency ? isNewDataAvailable() : generator->IsNewDataAvailable() ) )
 	{
-		lock_guard<recursive_mutex> lock( mMutex );
-		mDepthGenerator.GetMetaData( mDepthMD );
+		// a signal between the query and the wait is kept in the flag, a stale one only repeats the query
+		unique_lock< mutex > lock( mNewDataMutex );
+		while ( !mNewDataSignaled && !mShouldDie )
+			mNewDataCond.wait( lock );
+		mNewDataSignaled = false;
+	}
+}
 
-		const uint16_t *depth = reinterpret_cast<const uint16_t*>( mDepthMD.Data() );
-		mDepthBuffers.derefActiveBuffer(); // finished with current active buffer
-		uint16_t *destPixels = mDepthBuffers.getNewBuffer(); // request a new buffer
-		uint32_t depthScale = 0xffff0000 / mDepthMaxDepth;
+bool OpenNI::Obj::isNewDataAvailable()
+{
+	return ( mDepthGenerator.IsValid() && mDepthGenerator.IsNewDataAvailable() ) ||
+		   ( mImageGenerator.IsValid() && mImageGenerator.IsGenerating() && mImageGenerator.IsNewDataAvailable() ) ||
+		   ( mIRGenerator.IsValid() && mIRGenerator.IsGenerating() && mIRGenerator.IsNewDataAvailable() );
+}
 
-		for (size_t p = 0; p < mDepthWidth * mDepthHeight; ++p )
-		{
-			uint32_t v = depth[p];
-			destPixels[p] = ( depthScale * v ) >> 16;
-		}
-		mDepthBuffers.setActiveBuffer( destPixels ); // set this new buffer to be the current active buffer
-		mNewDepthFrame = true; // flag that there's a new depth frame
-	}
+static FrameInfo makeFrameInfo( const MapMetaData &metaData, const AtomicInt &frameId )
+{
+	FrameInfo info;
+	info.frameId = frameId.load() + 1; // ids are only incremented on the capture thread
+	info.sourceFrameId = metaData.FrameID();
+	info.timestamp = metaData.Timestamp();
+	return info;
 }
 
-void OpenNI::Obj::generateImage()
+bool OpenNI::Obj::revokeRawFrames()
 {
-	if (!mImageGenerator.IsValid() || !mImageGenerator.IsGenerating())
+	bool revoked = mRawDepth.revoke();
+	revoked = mRawImage.revoke() && revoked;
+	revoked = mRawIR.revoke() && revoked;
+	if ( mUserTracker )
+		revoked = mUserTracker.mObj->mRawLabels.revoke() && revoked;
+	return revoked;
+}
+
+void OpenNI::Obj::generateDepth()
+{
+	if ( !mDepthGenerator.IsValid() )
 		return;
 
-	{
-		lock_guard<recursive_mutex> lock(mMutex);
-		mImageGenerator.GetMetaData( mImageMD );
+	mDepthGenerator.GetMetaData( mDepthMD );
+	const uint16_t *depth = reinterpret_cast<const uint16_t*>( mDepthMD.Data() );
+	Area area( mDepthMD.XOffset(), mDepthMD.YOffset(), mDepthMD.XOffset() + mDepthMD.XRes(), mDepthMD.YOffset() + mDepthMD.YRes() );
 
-		mColorBuffers.derefActiveBuffer(); // finished with current active buffer
-		uint8_t *destPixels = mColorBuffers.getNewBuffer();  // request a new buffer
+	if ( !mDepthMD.IsDataNew() )
+	{
+		// the driver frame did not change, only make it pinnable again
+		if ( isDepthOnDemand() )
+			mRawDepth.publish( mDepthCropped ? &mRoiDepth[ 0 ] : depth );
+		return;
+	}
 
-		const XnRGB24Pixel *src = mImageMD.RGB24Data();
-		uint8_t *dst = destPixels + ( mImageMD.XOffset() + mImageMD.YOffset() * mImageWidth ) * 3;
-		for (int y = 0; y < mImageMD.YRes(); ++y)
+	// from here on \a area is in the coordinates of the published frames
+	mDepthCropped = false;
+	if ( hasRegionsOfInterest() )
+	{
+		// device cropping delivers the bounding rectangle, only several regions have to be masked then
+		if ( ( area.x1 != mDepthRoi.x1 ) || ( area.y1 != mDepthRoi.y1 ) || ( area.x2 != mDepthRoi.x2 ) || ( area.y2 != mDepthRoi.y2 ) ||
+			 !mRoiCoverage.empty() )
 		{
-			memcpy(dst, src, mImageMD.XRes() * 3);
-
-			src += mImageMD.XRes(); // FIXME: FullXRes
-			dst += mImageWidth * 3;
+			cropDepth( depth, area, &mRoiDepth[ 0 ] );
+			depth = &mRoiDepth[ 0 ];
+			mDepthCropped = true;
 		}
-
-		mColorBuffers.setActiveBuffer( destPixels ); // set this new buffer to be the current active buffer
-		mNewVideoFrame = true; // flag that there's a new color frame
-		mLastVideoFrameInfrared = false;
+		area = Area( 0, 0, mDepthWidth, mDepthHeight );
 	}
-}
 
-void OpenNI::Obj::generateIR()
-{
-	if ( !mIRGenerator.IsValid() || !mIRGenerator.IsGenerating() )
-		return;
+	FrameInfo info = makeFrameInfo( mDepthMD, mDepthFrameId );
+	// the filter has to see every frame, it runs here even if depth is converted on demand
+	filterDepth( depth, area, info );
+	// lazily the pinned frame is colorized on its first read
+	if ( !mOptions.getLazyConversionEnabled() )
+		generateColorizedDepth( depth, area, info );
 
+	if ( isDepthOnDemand() )
 	{
-		lock_guard<recursive_mutex> lock( mMutex );
-
-		mColorBuffers.derefActiveBuffer(); // finished with current active buffer
-		uint8_t *destPixels = mColorBuffers.getNewBuffer();  // request a new buffer
-		const XnIRPixel *src = reinterpret_cast<const XnIRPixel *>( mIRGenerator.GetData() );
-
-		for (size_t p = 0; p < mIRWidth * mIRHeight; ++p )
+		// only reference the driver frame, depth is converted on demand
+		mDepthFrameId.increment();
+		mRawDepthArea = area;
+		mRawDepthInfo = info;
+		mRawDepth.publish( depth );
+		mNewDepthFrame.store( 1 ); // flag that there's a new depth frame
+		notifyFrame( FRAME_DEPTH, info );
+
+		if ( !hasFrameCallbacks( mDepthFrameCallbacks ) )
+			return;
+
+		if ( mOptions.getZeroCopyDepthEnabled() )
 		{
-			destPixels[p] = src[p] / 4;
+			// the driver frame stays valid until the next update on this thread
+			callFrameCallbacks( mDepthFrameCallbacks, DepthFrameEvent( depth, area.getWidth(), area.getHeight(), 1, area.getWidth() ), &mDepthCallbackStats );
 		}
+		else
+		{
+			updateDepthOnDemand();
+			uint16_t *activeDepth = mDepthBuffers.refActiveBuffer();
+			if ( activeDepth != NULL )
+				callFrameCallbacks( mDepthFrameCallbacks, DepthFrameEvent( activeDepth, mDepthWidth, mDepthHeight, 1, mDepthStride ), &mDepthCallbackStats );
+			mDepthBuffers.derefBuffer( activeDepth );
+		}
+		return;
+	}
 
-		mColorBuffers.setActiveBuffer( destPixels ); // set this new buffer to be the current active buffer
-		mNewVideoFrame = true; // flag that there's a new color frame
-		mLastVideoFrameInfrared = true;
+	uint16_t *destPixels = mDepthBuffers.getNewBuffer(); // request a new buffer
+	if ( destPixels == NULL ) // every buffer is held by consumers, drop this frame
+	{
+		// the next frame gets the same id, the registration of this one must not be reused for it
+		lock_guard<mutex> registrationLock( mRegistrationMutex );
+		mRegisteredFrameId = 0;
+		return;
 	}
-}
 
-bool OpenNI::checkNewDepthFrame()
-{
-	lock_guard<recursive_mutex> lock( mObj->mMutex );
-	bool oldValue = mObj->mNewDepthFrame;
-	mObj->mNewDepthFrame = false;
-	return oldValue;
+	uint8_t *destWindowed, *destMask;
+	getDepth8Buffers( &destWindowed, &destMask );
+	convertDepth( depth, destPixels, area, info.frameId, destWindowed, destMask );
+	buildDepthPyramid( destPixels );
+	BufferManager<uint16_t>::getFrameInfo( destPixels ) = info;
+	mDepthBuffers.setActiveBuffer( destPixels ); // set this new buffer to be the current active buffer
+	publishDepth8Buffers( destWindowed, destMask, info );
+	mDepthRing.push( destPixels );
+	mDepthFrameId.increment();
+	mNewDepthFrame.store( 1 ); // flag that there's a new depth frame
+	notifyFrame( FRAME_DEPTH, info );
+
+	// the active buffer is only replaced by this thread, it stays valid during the callbacks
+	callFrameCallbacks( mDepthFrameCallbacks, DepthFrameEvent( destPixels, mDepthWidth, mDepthHeight, 1, mDepthStride ), &mDepthCallbackStats );
 }
 
-bool OpenNI::checkNewVideoFrame()
+// \a depth is packed and covers \a area of the published frame, see generateDepth()
+const uint16_t *OpenNI::Obj::registerDepth( const uint16_t *depth, Area *area, int32_t frameId, unique_lock<mutex> *lock )
 {
-	lock_guard<recursive_mutex> lock( mObj->mMutex );
-	bool oldValue = mObj->mNewVideoFrame;
-	mObj->mNewVideoFrame = false;
-	return oldValue;
+	if ( !mSoftwareRegistration )
+		return depth;
+	if ( !lock->owns_lock() )
+		lock->lock();
+	if ( !mRegistration )
+		return depth;
+
+	// the converter and the colorizer read the same frame, it is only registered for the first of them
+	if ( ( frameId == 0 ) || ( frameId != mRegisteredFrameId ) )
+	{
+		// the registered map covers the full frame, it is cropped to the regions of interest again
+		Area fullArea( area->x1 + mDepthRoi.x1, area->y1 + mDepthRoi.y1, area->x2 + mDepthRoi.x1, area->y2 + mDepthRoi.y1 );
+		mRegisteredDepth.resize( mDepthFullWidth * mDepthFullHeight );
+		mRegistration->registerDepth( depth, fullArea, mDepthFullWidth, mDepthFullHeight, mMirrored, &mRegisteredDepth[ 0 ] );
+		if ( hasRegionsOfInterest() )
+			cropDepth( &mRegisteredDepth[ 0 ], Area( 0, 0, mDepthFullWidth, mDepthFullHeight ), &mRegisteredDepth[ 0 ] );
+		mRegisteredFrameId = frameId;
+	}
+	*area = Area( 0, 0, mDepthWidth, mDepthHeight );
+	return &mRegisteredDepth[ 0 ];
 }
 
-ImageSourceRef OpenNI::getDepthImage()
+// \a depth is packed and covers \a area of the published frame, see generateDepth()
+// \a destWindowed and \a destMask are optional, they are produced in the same pass
+void OpenNI::Obj::convertDepth( const uint16_t *depth, uint16_t *destPixels, const Area &depthArea, int32_t frameId, uint8_t *destWindowed, uint8_t *destMask )
 {
-	// register a reference to the active buffer
-	uint16_t *activeDepth = mObj->mDepthBuffers.refActiveBuffer();
-	return ImageSourceRef( new ImageSourceOpenNIDepth( activeDepth, mObj->mDepthWidth, mObj->mDepthHeight, this->mObj ) );
+	Area area( depthArea );
+	unique_lock<mutex> registrationLock( mRegistrationMutex, defer_lock );
+	depth = registerDepth( depth, &area, frameId, &registrationLock );
+	writeDepth( depth, destPixels, area, destWindowed, destMask );
 }
 
-ImageSourceRef OpenNI::getVideoImage()
+// \a depth is packed, already registered and covers \a area of the published frame, see convertDepth()
+void OpenNI::Obj::writeDepth( const uint16_t *depth, uint16_t *destPixels, const Area &area, uint8_t *destWindowed, uint8_t *destMask )
 {
-	uint8_t *activeColor = mObj->mColorBuffers.refActiveBuffer();
-	if (mObj->mLastVideoFrameInfrared)
+	uint32_t depthScale = 0xffff0000 / mDepthMaxDepth;
+	bool millimeters = mOptions.getDepthFormat() == DEPTH_MILLIMETERS;
+
+	unique_lock<mutex> spatialFilterLock( mSpatialFilterMutex, defer_lock );
+	if ( mSpatialFilter )
 	{
-		return ImageSourceRef( new ImageSourceOpenNIInfrared( activeColor, mObj->mIRWidth, mObj->mIRHeight, this->mObj ) );
+		spatialFilterLock.lock();
+		depth = mSpatialFilter->apply( depth, area.getWidth(), area.getHeight() );
 	}
-	else
+
+	int width = area.getWidth();
+
+	if ( ( destWindowed != NULL ) || ( destMask != NULL ) )
 	{
-		return ImageSourceRef( new ImageSourceOpenNIColor( activeColor, mObj->mImageWidth, mObj->mImageHeight, this->mObj ) );
+		uint16_t nearClip = (uint16_t)mOptions.getDepthNearClip();
+		uint16_t farClip = (uint16_t)mOptions.getDepthFarClip();
+		uint32_t windowScale = ( 255 << 16 ) / std::max( farClip - nearClip, 1 );
+		for ( int y = area.y1; y < area.y2; ++y )
+		{
+			size_t offset8 = y * mDepth8Stride + area.x1;
+			convertDepthMulti( depth, destPixels + y * mDepthStride + area.x1, millimeters ? 0x10000 : depthScale,
+							   destWindowed ? destWindowed + offset8 : NULL, destMask ? destMask + offset8 : NULL,
+							   nearClip, farClip, windowScale, width );
+			depth += width;
+		}
+		return;
 	}
-}
 
-std::shared_ptr<uint8_t> OpenNI::getVideoData()
+	for ( int y = area.y1; y < area.y2; ++y )
+	{
+		uint16_t *dst = destPixels + y * mDepthStride + area.x1;
+		if ( millimeters )
+			memcpy( dst, depth, width * sizeof( uint16_t ) );
+		else
+			scaleDepth( depth, dst, width, depthScale );
+		depth += width;
+	}
+}
+
+// \a depth is packed and covers \a area of the full frame, \a dst receives mDepthRoi packed with the pixels outside of
+// \a area and of the regions cleared. \a dst may be \a depth if \a area contains mDepthRoi, the rows only move backwards then.
+void OpenNI::Obj::cropDepth( const uint16_t *depth, const Area &area, uint16_t *dst )
+{
+	Area clipped = area.getClipBy( mDepthRoi );
+	int width = mDepthRoi.getWidth();
+	int left = clipped.x1 - mDepthRoi.x1;
+	int right = clipped.x2 - mDepthRoi.x1;
+	for ( int y = mDepthRoi.y1; y < mDepthRoi.y2; y++ )
+	{
+		uint16_t *row = dst + ( y - mDepthRoi.y1 ) * width;
+		if ( ( y < clipped.y1 ) || ( y >= clipped.y2 ) || ( left >= right ) )
+		{
+			std::fill( row, row + width, 0 );
+			continue;
+		}
+
+		memmove( row + left, depth + ( y - area.y1 ) * area.getWidth() + clipped.x1 - area.x1, ( right - left ) * sizeof( uint16_t ) );
+		std::fill( row, row + left, 0 );
+		std::fill( row + right, row + width, 0 );
+		if ( !mRoiCoverage.empty() )
+		{
+			const uint8_t *coverage = &mRoiCoverage[ ( y - mDepthRoi.y1 ) * width ];
+			for ( int x = left; x < right; x++ )
+				row[ x ] = coverage[ x ] ? row[ x ] : 0;
+		}
+	}
+}
+
+void OpenNI::Obj::buildDepthPyramid( uint16_t *destPixels )
+{
+	// each level is reduced from the previous one, which is still in the cache
+	bool median = mOptions.getDepthPyramidReduction() == PYRAMID_MEDIAN;
+	const uint16_t *src = destPixels;
+	size_t srcStride = mDepthStride;
+	for ( int32_t l = 0; l < mDepthPyramid.numLevels; l++ )
+	{
+		uint16_t *dst = destPixels + mDepthPyramid.offsets[ l ];
+		size_t dstStride = mDepthPyramid.strides[ l ];
+		int width = mDepthWidth >> ( l + 1 );
+		int height = mDepthHeight >> ( l + 1 );
+		for ( int y = 0; y < height; y++ )
+			downsampleDepth( src + y * 2 * srcStride, src + ( y * 2 + 1 ) * srcStride, dst + y * dstStride, width, median );
+		src = dst;
+		srcStride = dstStride;
+	}
+}
+
+void OpenNI::Obj::getDepth8Buffers( uint8_t **windowed, uint8_t **mask )
+{
+	// a full pool drops only the frames of its own output
+	*windowed = mOptions.getWindowedDepthEnabled() ? mWindowedDepthBuffers.getNewBuffer() : NULL;
+	*mask = mOptions.getDepthMaskEnabled() ? mDepthMaskBuffers.getNewBuffer() : NULL;
+}
+
+void OpenNI::Obj::publishDepth8Buffers( uint8_t *windowed, uint8_t *mask, const FrameInfo &info )
+{
+	if ( windowed )
+	{
+		BufferManager<uint8_t>::getFrameInfo( windowed ) = info;
+		mWindowedDepthBuffers.setActiveBuffer( windowed );
+	}
+	if ( mask )
+	{
+		BufferManager<uint8_t>::getFrameInfo( mask ) = info;
+		mDepthMaskBuffers.setActiveBuffer( mask );
+	}
+}
+
+void OpenNI::Obj::filterDepth( const uint16_t *depth, const Area &depthArea, const FrameInfo &info )
+{
+	if ( !mOptions.getTemporalFilterEnabled() )
+		return;
+
+	// the filter runs on the registered frame, the registration is kept for the conversion and the colorizer of the same frame
+	Area area( depthArea );
+	unique_lock<mutex> registrationLock( mRegistrationMutex, defer_lock );
+	depth = registerDepth( depth, &area, info.frameId, &registrationLock );
+
+	// the history advances even if the filtered frame has to be dropped
+	const uint16_t *filtered = mTemporalFilter.apply( depth, area.getWidth(), area.getHeight() );
+	if ( registrationLock.owns_lock() )
+		registrationLock.unlock();
+	uint16_t *destPixels = mFilteredDepthBuffers.getNewBuffer();
+	if ( ( filtered == NULL ) || ( destPixels == NULL ) )
+	{
+		mFilteredDepthBuffers.derefBuffer( destPixels );
+		return;
+	}
+
+	writeDepth( filtered, destPixels, area );
+	BufferManager<uint16_t>::getFrameInfo( destPixels ) = info;
+	mFilteredDepthBuffers.setActiveBuffer( destPixels );
+}
+
+void OpenNI::Obj::generateColorizedDepth( const uint16_t *depth, const Area &area, const FrameInfo &info )
+{
+	if ( !mOptions.getDepthColorizerEnabled() )
+		return;
+
+	uint8_t *destPixels = mColorizedDepthBuffers.getNewBuffer();
+	if ( destPixels )
+		colorizeDepth( depth, area, info, destPixels );
+}
+
+void OpenNI::Obj::colorizeDepth( const uint16_t *depth, const Area &depthArea, const FrameInfo &info, uint8_t *destPixels )
+{
+	// the colorized frame shows the same view as the converted depth
+	Area area( depthArea );
+	unique_lock<mutex> registrationLock( mRegistrationMutex, defer_lock );
+	depth = registerDepth( depth, &area, info.frameId, &registrationLock );
+
+	// \a depth is packed and covers \a area of the full frame, the pixels outside of it are cleared
+	size_t rowBytes = mDepthWidth * 3;
+	for ( int y = 0; y < mDepthHeight; y++ )
+	{
+		uint8_t *row = destPixels + y * mColorizedDepthStride;
+		if ( ( y < area.y1 ) || ( y >= area.y2 ) )
+		{
+			std::fill( row, row + rowBytes, 0 );
+			continue;
+		}
+		std::fill( row, row + area.x1 * 3, 0 );
+		std::fill( row + area.x2 * 3, row + rowBytes, 0 );
+	}
+	mDepthColorizer.apply( depth, area.getWidth(), area.getHeight(), destPixels + area.y1 * mColorizedDepthStride + area.x1 * 3, mColorizedDepthStride );
+	BufferManager<uint8_t>::getFrameInfo( destPixels ) = info;
+	mColorizedDepthBuffers.setActiveBuffer( destPixels );
+}
+
+void OpenNI::Obj::updateColorizedDepthOnDemand()
+{
+	if ( !mOptions.getLazyConversionEnabled() || !mOptions.getDepthColorizerEnabled() )
+		return;
+
+	// the colorizer tables are not shared, the lock makes readers colorize once per frame
+	lock_guard<mutex> lock( mColorizeMutex );
+	int32_t frameId = mDepthFrameId.load();
+	if ( frameId == mColorizedDepthFrameId )
+		return;
+
+	// the buffer is taken before the pin, a pool waiting for consumers must not hold up the capture thread through the pin
+	uint8_t *destPixels = mColorizedDepthBuffers.getNewBuffer();
+	if ( destPixels == NULL )
+		return;
+
+	const uint16_t *depth = mRawDepth.pin();
+	if ( depth == NULL ) // the capture thread is updating, keep the last colorized frame
+	{
+		mColorizedDepthBuffers.derefBuffer( destPixels );
+		return;
+	}
+
+	colorizeDepth( depth, mRawDepthArea, mRawDepthInfo, destPixels );
+	mRawDepth.unpin();
+	mColorizedDepthFrameId = frameId;
+}
+
+void OpenNI::Obj::updateDepthOnDemand()
+{
+	if ( !isDepthOnDemand() )
+		return;
+
+	// consumers convert the pinned driver frame, the lock makes it happen once per frame
+	lock_guard<mutex> lock( mDepthConvertMutex );
+	int32_t frameId = mDepthFrameId.load();
+	if ( frameId == mConvertedDepthFrameId )
+		return;
+
+	// the buffers are taken before the pin, a pool waiting for consumers must not hold up the capture thread through the pin
+	uint16_t *destPixels = mDepthBuffers.getNewBuffer();
+	if ( destPixels == NULL )
+		return;
+	uint8_t *destWindowed, *destMask;
+	getDepth8Buffers( &destWindowed, &destMask );
+
+	const uint16_t *depth = mRawDepth.pin();
+	if ( depth == NULL ) // the capture thread is updating, keep the last converted frame
+	{
+		mDepthBuffers.derefBuffer( destPixels );
+		mWindowedDepthBuffers.derefBuffer( destWindowed );
+		mDepthMaskBuffers.derefBuffer( destMask );
+		return;
+	}
+
+	FrameInfo info = mRawDepthInfo;
+	convertDepth( depth, destPixels, mRawDepthArea, info.frameId, destWindowed, destMask );
+	mRawDepth.unpin();
+
+	buildDepthPyramid( destPixels );
+	BufferManager<uint16_t>::getFrameInfo( destPixels ) = info;
+	mDepthBuffers.setActiveBuffer( destPixels );
+	publishDepth8Buffers( destWindowed, destMask, info );
+	mDepthRing.push( destPixels );
+	mConvertedDepthFrameId = frameId;
+}
+
+void OpenNI::Obj::generateUsers()
+{
+	if ( !mUserTracker )
+		return;
+
+	const uint8_t *labelMap = mUserTracker.mObj->generateLabels();
+	if ( mUserTracker.mObj->mLazyLabels && hasFrameCallbacks( mUserFrameCallbacks ) )
+	{
+		mUserTracker.mObj->updateLabelsOnDemand();
+		uint8_t *activeLabels = mUserTracker.mObj->mLabelBuffers.refActiveBuffer();
+		if ( activeLabels != NULL )
+			callFrameCallbacks( mUserFrameCallbacks, UserFrameEvent( activeLabels, mDepthWidth, mDepthHeight, 1, mUserTracker.mObj->mLabelStride ), &mUserCallbackStats );
+		mUserTracker.mObj->mLabelBuffers.derefBuffer( activeLabels );
+	}
+	else if ( labelMap != NULL )
+		callFrameCallbacks( mUserFrameCallbacks, UserFrameEvent( labelMap, mDepthWidth, mDepthHeight, 1, mUserTracker.mObj->mLabelStride ), &mUserCallbackStats );
+}
+
+void OpenNI::Obj::generateImage()
+{
+	if (!mImageGenerator.IsValid() || !mImageGenerator.IsGenerating())
+		return;
+
+	mImageGenerator.GetMetaData( mImageMD );
+	const uint8_t *image = reinterpret_cast<const uint8_t *>( mImageMD.RGB24Data() );
+	Area area( mImageMD.XOffset(), mImageMD.YOffset(), mImageMD.XOffset() + mImageMD.XRes(), mImageMD.YOffset() + mImageMD.YRes() );
+
+	if ( !mImageMD.IsDataNew() )
+	{
+		// the driver frame did not change, only make it pinnable again
+		if ( mOptions.getLazyConversionEnabled() )
+			mRawImage.publish( image );
+		return;
+	}
+
+	FrameInfo info = makeFrameInfo( mImageMD, mVideoFrameId );
+	if ( mOptions.getLazyConversionEnabled() )
+	{
+		mLastVideoFrameInfrared = false;
+		mVideoFrameId.increment();
+		mRawImageArea = area;
+		mRawImageInfo = info;
+		mRawImage.publish( image );
+		mNewVideoFrame.store( 1 ); // flag that there's a new color frame
+		notifyFrame( FRAME_VIDEO, info );
+
+		if ( hasFrameCallbacks( mVideoFrameCallbacks ) )
+		{
+			updateVideoOnDemand();
+			uint8_t *activeColor = mColorBuffers.refActiveBuffer();
+			if ( activeColor != NULL )
+				callFrameCallbacks( mVideoFrameCallbacks, VideoFrameEvent( activeColor, mImageWidth, mImageHeight, 3, mImageStride ), &mVideoCallbackStats );
+			mColorBuffers.derefBuffer( activeColor );
+		}
+		return;
+	}
+
+	uint8_t *destPixels = mColorBuffers.getNewBuffer();  // request a new buffer
+	if ( destPixels == NULL ) // every buffer is held by consumers, drop this frame
+		return;
+
+	convertImage( image, destPixels, area );
+	BufferManager<uint8_t>::getFrameInfo( destPixels ) = info;
+
+	mLastVideoFrameInfrared = false;
+	mColorBuffers.setActiveBuffer( destPixels ); // set this new buffer to be the current active buffer
+	mColorRing.push( destPixels );
+	mVideoFrameId.increment();
+	mNewVideoFrame.store( 1 ); // flag that there's a new color frame
+	notifyFrame( FRAME_VIDEO, info );
+
+	callFrameCallbacks( mVideoFrameCallbacks, VideoFrameEvent( destPixels, mImageWidth, mImageHeight, 3, mImageStride ), &mVideoCallbackStats );
+}
+
+// \a image is packed RGB and covers \a area of the full frame, as in the map metadata, the part inside mImageRoi is converted
+void OpenNI::Obj::convertImage( const uint8_t *image, uint8_t *destPixels, const Area &area )
+{
+	Area clipped = area.getClipBy( mImageRoi );
+	int srcRowBytes = area.getWidth() * 3;
+	int rowBytes = clipped.getWidth() * 3;
+	image += ( clipped.y1 - area.y1 ) * srcRowBytes + ( clipped.x1 - area.x1 ) * 3;
+	uint8_t *dst = destPixels + ( clipped.x1 - mImageRoi.x1 ) * 3 + ( clipped.y1 - mImageRoi.y1 ) * mImageStride;
+	for ( int y = clipped.y1; y < clipped.y2; ++y )
+	{
+		memcpy( dst, image, rowBytes );
+
+		image += srcRowBytes; // the metadata is packed, cropped frames are XRes wide
+		dst += mImageStride;
+	}
+}
+
+void OpenNI::Obj::generateIR()
+{
+	if ( !mIRGenerator.IsValid() || !mIRGenerator.IsGenerating() )
+		return;
+
+	mIRGenerator.GetMetaData( mIRMD );
+	const uint16_t *ir = reinterpret_cast<const uint16_t *>( mIRMD.Data() );
+	Area area( mIRMD.XOffset(), mIRMD.YOffset(), mIRMD.XOffset() + mIRMD.XRes(), mIRMD.YOffset() + mIRMD.YRes() );
+
+	if ( !mIRMD.IsDataNew() )
+	{
+		// the driver frame did not change, only make it pinnable again
+		if ( mOptions.getLazyConversionEnabled() )
+			mRawIR.publish( ir );
+		return;
+	}
+
+	FrameInfo info = makeFrameInfo( mIRMD, mVideoFrameId );
+	if ( mOptions.getLazyConversionEnabled() )
+	{
+		mLastVideoFrameInfrared = true;
+		mVideoFrameId.increment();
+		mRawIRArea = area;
+		mRawIRInfo = info;
+		mRawIR.publish( ir );
+		mNewVideoFrame.store( 1 ); // flag that there's a new IR frame
+		notifyFrame( FRAME_VIDEO, info );
+
+		if ( hasFrameCallbacks( mVideoFrameCallbacks ) )
+		{
+			updateVideoOnDemand();
+			uint8_t *activeIR = mIRBuffers.refActiveBuffer();
+			if ( activeIR != NULL )
+				callFrameCallbacks( mVideoFrameCallbacks, VideoFrameEvent( activeIR, mIRWidth, mIRHeight, 1, mIRStride, true ), &mVideoCallbackStats );
+			mIRBuffers.derefBuffer( activeIR );
+		}
+		return;
+	}
+
+	uint8_t *destPixels = mIRBuffers.getNewBuffer();  // request a new buffer
+	if ( destPixels == NULL ) // every buffer is held by consumers, drop this frame
+		return;
+
+	uint16_t *destPixels16 = NULL;
+	if ( mOptions.getFullPrecisionIREnabled() )
+		destPixels16 = mIR16Buffers.getNewBuffer();
+
+	convertInfrared( ir, destPixels, destPixels16, area );
+	BufferManager<uint8_t>::getFrameInfo( destPixels ) = info;
+
+	if ( destPixels16 )
+	{
+		BufferManager<uint16_t>::getFrameInfo( destPixels16 ) = info;
+		mIR16Buffers.setActiveBuffer( destPixels16 );
+	}
+
+	mLastVideoFrameInfrared = true;
+	mIRBuffers.setActiveBuffer( destPixels ); // set this new buffer to be the current active buffer
+	mIRRing.push( destPixels );
+	mVideoFrameId.increment();
+	mNewVideoFrame.store( 1 ); // flag that there's a new color frame
+	notifyFrame( FRAME_VIDEO, info );
+
+	callFrameCallbacks( mVideoFrameCallbacks, VideoFrameEvent( destPixels, mIRWidth, mIRHeight, 1, mIRStride, true ), &mVideoCallbackStats );
+}
+
+// \a ir is packed and covers \a area of the full frame, the part inside mIRRoi is converted, \a destPixels16 is optional
+void OpenNI::Obj::convertInfrared( const uint16_t *ir, uint8_t *destPixels, uint16_t *destPixels16, const Area &area )
+{
+	Area clipped = area.getClipBy( mIRRoi );
+	int srcWidth = area.getWidth();
+	int width = clipped.getWidth();
+	int x = clipped.x1 - mIRRoi.x1;
+	ir += ( clipped.y1 - area.y1 ) * srcWidth + clipped.x1 - area.x1;
+	for ( int y = clipped.y1 - mIRRoi.y1; y < clipped.y2 - mIRRoi.y1; ++y )
+	{
+		convertIR( ir, destPixels + y * mIRStride + x, width );
+		if ( destPixels16 )
+			memcpy( destPixels16 + y * mIR16Stride + x, ir, width * sizeof( uint16_t ) );
+		ir += srcWidth;
+	}
+}
+
+void OpenNI::Obj::updateVideoOnDemand()
+{
+	if ( !mOptions.getLazyConversionEnabled() )
+		return;
+
+	lock_guard<mutex> lock( mVideoConvertMutex );
+	int32_t frameId = mVideoFrameId.load();
+	if ( frameId == mConvertedVideoFrameId )
+		return;
+
+	// the buffers are taken before the pin, a pool waiting for consumers must not hold up the capture thread through the pin
+	if ( mLastVideoFrameInfrared )
+	{
+		uint8_t *destPixels = mIRBuffers.getNewBuffer();
+		if ( destPixels == NULL )
+			return;
+		uint16_t *destPixels16 = NULL;
+		if ( mOptions.getFullPrecisionIREnabled() )
+			destPixels16 = mIR16Buffers.getNewBuffer();
+
+		const uint16_t *ir = mRawIR.pin();
+		if ( ir == NULL ) // the capture thread is updating, keep the last converted frame
+		{
+			mIRBuffers.derefBuffer( destPixels );
+			mIR16Buffers.derefBuffer( destPixels16 );
+			return;
+		}
+
+		FrameInfo info = mRawIRInfo;
+		convertInfrared( ir, destPixels, destPixels16, mRawIRArea );
+		mRawIR.unpin();
+
+		BufferManager<uint8_t>::getFrameInfo( destPixels ) = info;
+		if ( destPixels16 )
+		{
+			BufferManager<uint16_t>::getFrameInfo( destPixels16 ) = info;
+			mIR16Buffers.setActiveBuffer( destPixels16 );
+		}
+		mIRBuffers.setActiveBuffer( destPixels );
+		mIRRing.push( destPixels );
+		mConvertedVideoFrameId = frameId;
+	}
+	else
+	{
+		uint8_t *destPixels = mColorBuffers.getNewBuffer();
+		if ( destPixels == NULL )
+			return;
+
+		const uint8_t *image = mRawImage.pin();
+		if ( image == NULL )
+		{
+			mColorBuffers.derefBuffer( destPixels );
+			return;
+		}
+
+		FrameInfo info = mRawImageInfo;
+		convertImage( image, destPixels, mRawImageArea );
+		mRawImage.unpin();
+
+		BufferManager<uint8_t>::getFrameInfo( destPixels ) = info;
+		mColorBuffers.setActiveBuffer( destPixels );
+		mColorRing.push( destPixels );
+		mConvertedVideoFrameId = frameId;
+	}
+}
+
+bool OpenNI::checkNewDepthFrame()
+{
+	return mObj->mNewDepthFrame.exchange( 0 ) != 0;
+}
+
+bool OpenNI::checkNewVideoFrame()
+{
+	return mObj->mNewVideoFrame.exchange( 0 ) != 0;
+}
+
+// advances \a cursor to \a frameId, returns whether it was behind
+static bool advanceCursor( int32_t frameId, int32_t *cursorFrameId, int32_t *numSkipped )
+{
+	int32_t behind = frameId - *cursorFrameId;
+	if ( behind <= 0 )
+		return false;
+
+	*numSkipped = behind - 1;
+	*cursorFrameId = frameId;
+	return true;
+}
+
+bool OpenNI::checkNewDepthFrame( FrameCursor *cursor )
+{
+	return advanceCursor( mObj->mDepthFrameId.load(), &cursor->mFrameId, &cursor->mNumSkipped );
+}
+
+bool OpenNI::checkNewVideoFrame( FrameCursor *cursor )
 {
+	return advanceCursor( mObj->mVideoFrameId.load(), &cursor->mFrameId, &cursor->mNumSkipped );
+}
+
+bool OpenNI::waitForDepthFrame( FrameCursor *cursor, double timeout )
+{
+	return mObj->waitForCursor( mObj->mDepthFrameId, cursor, timeout );
+}
+
+bool OpenNI::waitForVideoFrame( FrameCursor *cursor, double timeout )
+{
+	return mObj->waitForCursor( mObj->mVideoFrameId, cursor, timeout );
+}
+
+bool OpenNI::waitForDepthFrame( double timeout )
+{
+	return mObj->waitForFrames( FRAME_DEPTH, timeout ) != FRAME_NONE;
+}
+
+bool OpenNI::waitForVideoFrame( double timeout )
+{
+	return mObj->waitForFrames( FRAME_VIDEO, timeout ) != FRAME_NONE;
+}
+
+int OpenNI::waitForFrame( double timeout )
+{
+	return mObj->waitForFrames( FRAME_DEPTH | FRAME_VIDEO, timeout );
+}
+
+template< typename T >
+bool OpenNI::Obj::hasFrameCallbacks( const CallbackMgr< void ( const FrameEvent< T > & ) > &callbacks ) const
+{
+	lock_guard<mutex> lock( mCallbackMutex );
+	return !callbacks.empty();
+}
+
+template< typename T >
+void OpenNI::Obj::callFrameCallbacks( CallbackMgr< void ( const FrameEvent< T > & ) > &callbacks, const FrameEvent< T > &event, CallbackStats *stats )
+{
+	lock_guard<mutex> lock( mCallbackMutex );
+	if ( callbacks.empty() )
+		return;
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	for ( typename CallbackMgr< void ( const FrameEvent< T > & ) >::iterator it = callbacks.begin(); it != callbacks.end(); ++it )
+		it->second( event );
+	double elapsed = chrono::duration<double>( chrono::steady_clock::now() - start ).count();
+
+	lock_guard<mutex> statsLock( mCallbackStatsMutex );
+	stats->numFrames++;
+	stats->lastTime = elapsed;
+	stats->maxTime = std::max( stats->maxTime, elapsed );
+	stats->totalTime += elapsed;
+}
+
+CallbackId OpenNI::registerDepthFrame( std::function< void ( const DepthFrameEvent & ) > callback )
+{
+	lock_guard<mutex> lock( mObj->mCallbackMutex );
+	return mObj->mDepthFrameCallbacks.registerCb( callback );
+}
+
+void OpenNI::unregisterDepthFrame( CallbackId id )
+{
+	lock_guard<mutex> lock( mObj->mCallbackMutex );
+	mObj->mDepthFrameCallbacks.unregisterCb( id );
+}
+
+CallbackId OpenNI::registerVideoFrame( std::function< void ( const VideoFrameEvent & ) > callback )
+{
+	lock_guard<mutex> lock( mObj->mCallbackMutex );
+	return mObj->mVideoFrameCallbacks.registerCb( callback );
+}
+
+void OpenNI::unregisterVideoFrame( CallbackId id )
+{
+	lock_guard<mutex> lock( mObj->mCallbackMutex );
+	mObj->mVideoFrameCallbacks.unregisterCb( id );
+}
+
+CallbackId OpenNI::registerUserFrame( std::function< void ( const UserFrameEvent & ) > callback )
+{
+	lock_guard<mutex> lock( mObj->mCallbackMutex );
+	return mObj->mUserFrameCallbacks.registerCb( callback );
+}
+
+void OpenNI::unregisterUserFrame( CallbackId id )
+{
+	lock_guard<mutex> lock( mObj->mCallbackMutex );
+	mObj->mUserFrameCallbacks.unregisterCb( id );
+}
+
+CallbackStats OpenNI::getDepthCallbackStats() const
+{
+	lock_guard<mutex> lock( mObj->mCallbackStatsMutex );
+	return mObj->mDepthCallbackStats;
+}
+
+CallbackStats OpenNI::getVideoCallbackStats() const
+{
+	lock_guard<mutex> lock( mObj->mCallbackStatsMutex );
+	return mObj->mVideoCallbackStats;
+}
+
+CallbackStats OpenNI::getUserCallbackStats() const
+{
+	lock_guard<mutex> lock( mObj->mCallbackStatsMutex );
+	return mObj->mUserCallbackStats;
+}
+
+FilterStats OpenNI::getSpatialFilterStats() const
+{
+	// the filter keeps its stats behind its own lock, mSpatialFilterMutex is held for a whole fill
+	return mObj->mSpatialFilter ? mObj->mSpatialFilter->getStats() : FilterStats();
+}
+
+// returns the deadline of a wait of \a timeout seconds, negative and very long timeouts wait for a year so the time point cannot overflow
+static chrono::steady_clock::time_point calcDeadline( double timeout )
+{
+	const double kMaxTimeout = 365. * 24. * 60. * 60.;
+	if ( ( timeout < 0 ) || !( timeout <= kMaxTimeout ) )
+		timeout = kMaxTimeout;
+	return chrono::steady_clock::now() + chrono::duration_cast<chrono::steady_clock::duration>( chrono::duration<double>( timeout ) );
+}
+
+bool OpenNI::Obj::waitForCursor( const AtomicInt &frameId, FrameCursor *cursor, double timeout )
+{
+	chrono::steady_clock::time_point deadline = calcDeadline( timeout );
+
+	unique_lock<mutex> lock( mFrameMutex );
+	while ( !advanceCursor( frameId.load(), &cursor->mFrameId, &cursor->mNumSkipped ) )
+	{
+		if ( mFrameCond.wait_until( lock, deadline ) == cv_status::timeout )
+			return advanceCursor( frameId.load(), &cursor->mFrameId, &cursor->mNumSkipped );
+	}
+	return true;
+}
+
+void OpenNI::Obj::notifyFrame( FrameType type, const FrameInfo &info )
+{
+	// taking the lock orders the flag store before a waiter's check, no wakeup is lost
+	{
+		lock_guard<mutex> lock( mFrameMutex );
+		if ( type == FRAME_DEPTH )
+			mDepthFrameInfo = info;
+		else
+			mVideoFrameInfo = info;
+	}
+	mFrameCond.notify_all();
+}
+
+FrameInfo OpenNI::getDepthFrameInfo() const
+{
+	lock_guard<mutex> lock( mObj->mFrameMutex );
+	return mObj->mDepthFrameInfo;
+}
+
+FrameInfo OpenNI::getVideoFrameInfo() const
+{
+	lock_guard<mutex> lock( mObj->mFrameMutex );
+	return mObj->mVideoFrameInfo;
+}
+
+int OpenNI::Obj::newFramesSince( int frames, int32_t depthFrameId, int32_t videoFrameId ) const
+{
+	int newFrames = FRAME_NONE;
+	if ( ( frames & FRAME_DEPTH ) && ( mDepthFrameId.load() - depthFrameId > 0 ) )
+		newFrames |= FRAME_DEPTH;
+	if ( ( frames & FRAME_VIDEO ) && ( mVideoFrameId.load() - videoFrameId > 0 ) )
+		newFrames |= FRAME_VIDEO;
+	return newFrames;
+}
+
+int OpenNI::Obj::waitForFrames( int frames, double timeout )
+{
+	// the waiter compares against the frame ids at the call, so it leaves the new frame flags and other waiters alone
+	int32_t depthFrameId = mDepthFrameId.load();
+	int32_t videoFrameId = mVideoFrameId.load();
+	chrono::steady_clock::time_point deadline = calcDeadline( timeout );
+
+	unique_lock<mutex> lock( mFrameMutex );
+	int newFrames = newFramesSince( frames, depthFrameId, videoFrameId );
+	while ( newFrames == FRAME_NONE )
+	{
+		if ( mFrameCond.wait_until( lock, deadline ) == cv_status::timeout )
+			return newFramesSince( frames, depthFrameId, videoFrameId );
+		newFrames = newFramesSince( frames, depthFrameId, videoFrameId );
+	}
+	return newFrames;
+}
+
+// sets the position of \a frame, which covers \a area of a full frame of \a fullWidth x \a fullHeight
+template<typename T>
+static Frame<T> placeFrame( Frame<T> frame, const Area &area, int fullWidth, int fullHeight )
+{
+	frame.setRegion( area.x1, area.y1, fullWidth, fullHeight );
+	return frame;
+}
+
+bool OpenNI::getSynchronizedFrames( SynchronizedFrames *frames, uint64_t tolerance )
+{
+	mObj->updateDepthOnDemand();
+	mObj->updateVideoOnDemand();
+
+	bool infrared = mObj->mLastVideoFrameInfrared;
+	BufferManager<uint8_t> *videoBuffers = infrared ? &mObj->mIRBuffers : &mObj->mColorBuffers;
+	FrameRing<uint8_t> *videoRing = infrared ? &mObj->mIRRing : &mObj->mColorRing;
+
+	// the newest depth frame that has a video frame within tolerance
+	for ( int32_t i = 0; i < FrameRing<uint16_t>::kMaxFrames; i++ )
+	{
+		uint16_t *depth = mObj->mDepthRing.ref( i );
+		if ( depth == NULL )
+			break;
+
+		const FrameInfo &depthInfo = BufferManager<uint16_t>::getFrameInfo( depth );
+		uint8_t *video = videoRing->refClosest( depthInfo.timestamp, tolerance );
+		if ( video == NULL )
+		{
+			mObj->mDepthBuffers.derefBuffer( depth );
+			continue;
+		}
+
+		frames->depth = placeFrame( makeFrame( &mObj->mDepthBuffers, depth, mObj, mObj->mDepthWidth, mObj->mDepthHeight, 1, mObj->mDepthStride, mObj->getDepthFrameFormat() ),
+									mObj->mDepthRoi, mObj->mDepthFullWidth, mObj->mDepthFullHeight );
+		frames->depth.setPyramid( mObj->mDepthPyramid );
+		if ( infrared )
+			frames->video = placeFrame( makeFrame( videoBuffers, video, mObj, mObj->mIRWidth, mObj->mIRHeight, 1, mObj->mIRStride, FORMAT_IR ),
+										mObj->mIRRoi, mObj->mIRFullWidth, mObj->mIRFullHeight );
+		else
+			frames->video = placeFrame( makeFrame( videoBuffers, video, mObj, mObj->mImageWidth, mObj->mImageHeight, 3, mObj->mImageStride, FORMAT_RGB ),
+										mObj->mImageRoi, mObj->mImageFullWidth, mObj->mImageFullHeight );
+
+		// labels are computed from the depth frame and share its timestamp. With lazy conversion only the latest labels are converted here,
+		// an older depth frame only has labels if they were converted while it was the latest one
+		frames->userLabels.reset();
+		if ( mObj->mUserTracker )
+		{
+			shared_ptr<UserTracker::Obj> userObj = mObj->mUserTracker.mObj;
+			userObj->updateLabelsOnDemand();
+			uint8_t *labels = userObj->mLabelRing.refClosest( depthInfo.timestamp, 0 );
+			frames->userLabels = makeFrame( &userObj->mLabelBuffers, labels, userObj, userObj->mDepthWidth, userObj->mDepthHeight, 1, userObj->mLabelStride, FORMAT_USER_LABELS );
+		}
+		return true;
+	}
+	return false;
+}
+
+ImageSourceRef OpenNI::getDepthImage()
+{
+	mObj->updateDepthOnDemand();
+
+	// register a reference to the active buffer
+	uint16_t *activeDepth = mObj->mDepthBuffers.refActiveBuffer();
+	if ( activeDepth == NULL )
+		return ImageSourceRef();
+	return ImageSourceRef( new ImageSourceOpenNIDepth( activeDepth, mObj->mDepthWidth, mObj->mDepthHeight, mObj->mDepthStride, this->mObj ) );
+}
+
+ImageSourceRef OpenNI::getVideoImage()
+{
+	mObj->updateVideoOnDemand();
+
+	if (mObj->mLastVideoFrameInfrared)
+	{
+		uint8_t *activeIR = mObj->mIRBuffers.refActiveBuffer();
+		if ( activeIR == NULL )
+			return ImageSourceRef();
+		return ImageSourceRef( new ImageSourceOpenNIInfrared( activeIR, mObj->mIRWidth, mObj->mIRHeight, mObj->mIRStride, this->mObj ) );
+	}
+	else
+	{
+		uint8_t *activeColor = mObj->mColorBuffers.refActiveBuffer();
+		if ( activeColor == NULL )
+			return ImageSourceRef();
+		return ImageSourceRef( new ImageSourceOpenNIColor( activeColor, mObj->mImageWidth, mObj->mImageHeight, mObj->mImageStride, this->mObj ) );
+	}
+}
+
+ImageSourceRef OpenNI::getInfraredImage()
+{
+	mObj->updateVideoOnDemand();
+
+	uint16_t *activeIR = mObj->mIR16Buffers.refActiveBuffer();
+	if ( activeIR == NULL )
+		return ImageSourceRef();
+	return ImageSourceRef( new ImageSourceOpenNIInfrared16( activeIR, mObj->mIRWidth, mObj->mIRHeight, mObj->mIR16Stride, this->mObj ) );
+}
+
+std::shared_ptr<uint8_t> OpenNI::getVideoData()
+{
+	mObj->updateVideoOnDemand();
+
+	// register a reference to the active buffer
+	BufferManager<uint8_t> *buffers = mObj->mLastVideoFrameInfrared ? &mObj->mIRBuffers : &mObj->mColorBuffers;
+	uint8_t *activeColor = buffers->refActiveBuffer();
+	return shared_ptr<uint8_t>( activeColor, DataDeleter<uint8_t>( buffers, mObj ) );
+}
+
+std::shared_ptr<uint16_t> OpenNI::getInfraredData()
+{
+	mObj->updateVideoOnDemand();
+
 	// register a reference to the active buffer
-	uint8_t *activeColor = mObj->mColorBuffers.refActiveBuffer();
-	return shared_ptr<uint8_t>( activeColor, DataDeleter<uint8_t>( &mObj->mColorBuffers, mObj ) );
+	uint16_t *activeIR = mObj->mIR16Buffers.refActiveBuffer();
+	return shared_ptr<uint16_t>( activeIR, DataDeleter<uint16_t>( &mObj->mIR16Buffers, mObj ) );
 }
 
 std::shared_ptr<uint16_t> OpenNI::getDepthData()
 {
+	mObj->updateDepthOnDemand();
+
 	// register a reference to the active buffer
 	uint16_t *activeDepth = mObj->mDepthBuffers.refActiveBuffer();
 	return shared_ptr<uint16_t>( activeDepth, DataDeleter<uint16_t>( &mObj->mDepthBuffers, mObj ) );
 }
 
+Frame<uint16_t> OpenNI::getDepthFrame()
+{
+	mObj->updateDepthOnDemand();
+
+	uint16_t *activeDepth = mObj->mDepthBuffers.refActiveBuffer();
+	Frame<uint16_t> frame = placeFrame( makeFrame( &mObj->mDepthBuffers, activeDepth, mObj, mObj->mDepthWidth, mObj->mDepthHeight, 1, mObj->mDepthStride, mObj->getDepthFrameFormat() ),
+										mObj->mDepthRoi, mObj->mDepthFullWidth, mObj->mDepthFullHeight );
+	frame.setPyramid( mObj->mDepthPyramid );
+	return frame;
+}
+
+Frame<uint8_t> OpenNI::getVideoFrame()
+{
+	mObj->updateVideoOnDemand();
+
+	// the format follows the pool the frame was referenced from, not a later switch of the video stream
+	if ( mObj->mLastVideoFrameInfrared )
+	{
+		uint8_t *activeIR = mObj->mIRBuffers.refActiveBuffer();
+		return placeFrame( makeFrame( &mObj->mIRBuffers, activeIR, mObj, mObj->mIRWidth, mObj->mIRHeight, 1, mObj->mIRStride, FORMAT_IR ),
+						   mObj->mIRRoi, mObj->mIRFullWidth, mObj->mIRFullHeight );
+	}
+	else
+	{
+		uint8_t *activeColor = mObj->mColorBuffers.refActiveBuffer();
+		return placeFrame( makeFrame( &mObj->mColorBuffers, activeColor, mObj, mObj->mImageWidth, mObj->mImageHeight, 3, mObj->mImageStride, FORMAT_RGB ),
+						   mObj->mImageRoi, mObj->mImageFullWidth, mObj->mImageFullHeight );
+	}
+}
+
+Frame<uint16_t> OpenNI::getInfraredFrame()
+{
+	mObj->updateVideoOnDemand();
+
+	uint16_t *activeIR = mObj->mIR16Buffers.refActiveBuffer();
+	return placeFrame( makeFrame( &mObj->mIR16Buffers, activeIR, mObj, mObj->mIRWidth, mObj->mIRHeight, 1, mObj->mIR16Stride, FORMAT_IR16 ),
+					   mObj->mIRRoi, mObj->mIRFullWidth, mObj->mIRFullHeight );
+}
+
+Frame<uint16_t> OpenNI::getFilteredDepthFrame()
+{
+	uint16_t *activeDepth = mObj->mFilteredDepthBuffers.refActiveBuffer();
+	return placeFrame( makeFrame( &mObj->mFilteredDepthBuffers, activeDepth, mObj, mObj->mDepthWidth, mObj->mDepthHeight, 1, mObj->mDepthStride, mObj->getDepthFrameFormat() ),
+					   mObj->mDepthRoi, mObj->mDepthFullWidth, mObj->mDepthFullHeight );
+}
+
+Frame<uint8_t> OpenNI::getWindowedDepthFrame()
+{
+	mObj->updateDepthOnDemand();
+
+	uint8_t *active = mObj->mWindowedDepthBuffers.refActiveBuffer();
+	return placeFrame( makeFrame( &mObj->mWindowedDepthBuffers, active, mObj, mObj->mDepthWidth, mObj->mDepthHeight, 1, mObj->mDepth8Stride, FORMAT_DEPTH_WINDOWED ),
+					   mObj->mDepthRoi, mObj->mDepthFullWidth, mObj->mDepthFullHeight );
+}
+
+Frame<uint8_t> OpenNI::getDepthMaskFrame()
+{
+	mObj->updateDepthOnDemand();
+
+	uint8_t *active = mObj->mDepthMaskBuffers.refActiveBuffer();
+	return placeFrame( makeFrame( &mObj->mDepthMaskBuffers, active, mObj, mObj->mDepthWidth, mObj->mDepthHeight, 1, mObj->mDepth8Stride, FORMAT_DEPTH_MASK ),
+					   mObj->mDepthRoi, mObj->mDepthFullWidth, mObj->mDepthFullHeight );
+}
+
+Frame<uint8_t> OpenNI::getColorizedDepthFrame()
+{
+	mObj->updateColorizedDepthOnDemand();
+
+	uint8_t *activeColor = mObj->mColorizedDepthBuffers.refActiveBuffer();
+	return placeFrame( makeFrame( &mObj->mColorizedDepthBuffers, activeColor, mObj, mObj->mDepthWidth, mObj->mDepthHeight, 3, mObj->mColorizedDepthStride, FORMAT_RGB ),
+					   mObj->mDepthRoi, mObj->mDepthFullWidth, mObj->mDepthFullHeight );
+}
+
+std::shared_ptr<const uint16_t> OpenNI::getRawDepthData()
+{
+	if ( !mObj->mOptions.getZeroCopyDepthEnabled() )
+		return shared_ptr<const uint16_t>();
+
+	// the frame is lent, not pinned, a reader holding it for long must not stall the capture thread
+	int32_t generation;
+	const uint16_t *rawDepth = mObj->mRawDepth.lend( &generation );
+	if ( rawDepth == NULL )
+		return shared_ptr<const uint16_t>();
+	return shared_ptr<const uint16_t>( rawDepth, LendDeleter<uint16_t>( generation, mObj ) );
+}
+
+bool OpenNI::isRawDepthDataValid( const std::shared_ptr<const uint16_t> &data ) const
+{
+	const LendDeleter<uint16_t> *deleter = std::get_deleter< LendDeleter<uint16_t> >( data );
+	return ( deleter != NULL ) && mObj->mRawDepth.isCurrent( deleter->mGeneration );
+}
+
 void OpenNI::setVideoInfrared( bool infrared )
 {
 	if ( ( mObj->mVideoInfrared == infrared ) ||
@@ -582,11 +2031,34 @@ void OpenNI::setDepthAligned( bool aligned )
 		}
 		else
 		{
-			console() << "DepthGenerator alternative view point not supported. " << endl;
+			lock_guard<mutex> registrationLock( mObj->mRegistrationMutex );
+			if ( mObj->mRegistration )
+			{
+				// registered on the CPU by registerDepth()
+				mObj->mSoftwareRegistration = aligned;
+				mObj->mDepthAligned = aligned;
+			}
+			else
+			{
+				console() << "DepthGenerator alternative view point not supported, set a calibration with setDepthRegistration(). " << endl;
+			}
 		}
 	}
 }
 
+void OpenNI::setDepthRegistration( const RegistrationCalibration &calibration, int numThreads )
+{
+	lock_guard<mutex> lock( mObj->mRegistrationMutex );
+	// the worker threads are kept if only the calibration changes
+	if ( numThreads <= 0 )
+		numThreads = std::max( (int)thread::hardware_concurrency(), 1 );
+	if ( mObj->mRegistration && ( mObj->mRegistration->getNumThreads() == numThreads ) )
+		mObj->mRegistration->setCalibration( calibration );
+	else
+		mObj->mRegistration = shared_ptr<DepthRegistration>( new DepthRegistration( calibration, numThreads ) );
+	mObj->mRegisteredFrameId = 0;
+}
+
 void OpenNI::setMirrored( bool mirror )
 {
 	if ( mObj->mMirrored == mirror )
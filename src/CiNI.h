@@ -34,6 +34,7 @@
 #include <iostream>
 #include <map>
 #include <string>
+#include <vector>
 
 #include "cinder/Cinder.h"
 #include "cinder/Thread.h"
@@ -54,6 +55,10 @@
 #include <XnLog.h>
 
 #include "CiNIBufferManager.h"
+#include "CiNIDepthColorizer.h"
+#include "CiNIDepthFilter.h"
+#include "CiNIKernels.h"
+#include "CiNIRegistration.h"
 #include "CiNIUserTracker.h"
 
 namespace mndl { namespace ni {
@@ -69,9 +74,92 @@ inline bool checkRc( XnStatus rc, std::string what )
 		return true;
 }
 
+inline XnMapOutputMode makeMapOutputMode( XnUInt32 xRes, XnUInt32 yRes, XnUInt32 fps )
+{
+	XnMapOutputMode mode;
+	mode.nXRes = xRes;
+	mode.nYRes = yRes;
+	mode.nFPS = fps;
+	return mode;
+}
+
+//! Read-only view of a frame passed to the OpenNI frame callbacks. The data is only valid during the callback.
+template< typename T >
+class FrameEvent
+{
+	public:
+		FrameEvent( const T *data, int width, int height, int channels, size_t stride, bool infrared = false )
+			: mData( data ), mWidth( width ), mHeight( height ), mChannels( channels ), mStride( stride ), mInfrared( infrared )
+		{}
+
+		const T *getData() const { return mData; }
+		int getWidth() const { return mWidth; }
+		int getHeight() const { return mHeight; }
+		int getChannels() const { return mChannels; }
+		//! Returns the number of elements between the start of two rows.
+		size_t getStride() const { return mStride; }
+		//! Returns whether a video frame comes from the IR generator.
+		bool isInfrared() const { return mInfrared; }
+
+	private:
+		const T *mData;
+		int mWidth;
+		int mHeight;
+		int mChannels;
+		size_t mStride;
+		bool mInfrared;
+};
+
+typedef FrameEvent< uint16_t > DepthFrameEvent;
+typedef FrameEvent< uint8_t > VideoFrameEvent;
+typedef FrameEvent< uint8_t > UserFrameEvent;
+
+//! Time spent in the frame callbacks of a stream on the capture thread
+struct CallbackStats
+{
+	CallbackStats() : numFrames( 0 ), lastTime( 0 ), maxTime( 0 ), totalTime( 0 ) {}
+
+	uint32_t numFrames;		//!< number of frames the callbacks were called with
+	double lastTime;		//!< seconds spent in the callbacks for the last frame
+	double maxTime;			//!< longest time spent in the callbacks for a frame in seconds
+	double totalTime;		//!< seconds spent in the callbacks in total
+};
+
+//! Position of a consumer in a stream. Every consumer keeps its own cursor, so several of them can follow the same stream independently.
+class FrameCursor
+{
+	public:
+		FrameCursor() : mFrameId( 0 ), mNumSkipped( 0 ) {}
+
+		//! Returns the id of the latest frame seen through this cursor, 0 if none. Frame ids increase monotonically from 1.
+		int32_t getFrameId() const { return mFrameId; }
+		//! Returns the number of frames published but not seen through this cursor before the latest one.
+		int32_t getNumSkipped() const { return mNumSkipped; }
+
+	private:
+		int32_t mFrameId;
+		int32_t mNumSkipped;
+
+		friend class OpenNI;
+};
+
 class OpenNI
 {
 	public:
+		//! Format of the depth returned by getDepthImage() and getDepthData()
+		enum DepthFormat
+		{
+			DEPTH_SCALED,		//!< Depth scaled from 0 to the device max depth onto 0 to 65535 (the default).
+			DEPTH_MILLIMETERS	//!< Raw depth in millimetres.
+		};
+
+		//! Reduction of the 2x2 blocks of the depth pyramid levels, zeros are skipped by both
+		enum PyramidReduction
+		{
+			PYRAMID_MIN,		//!< Nearest depth of the block (the default).
+			PYRAMID_MEDIAN		//!< Median depth of the block, the lower one of the middle values for an even count.
+		};
+
 		//! Options for specifying OpenNI generators
 		class Options
 		{
@@ -79,7 +167,21 @@ class OpenNI
 				Options( bool enableDepth = true, bool enableImage = true,
 						 bool enableIR = true, bool enableUserTracker = true )
 					: mDepthEnabled( enableDepth ), mImageEnabled( enableImage ),
-					  mIREnabled( enableIR ), mUserTrackerEnabled( enableUserTracker )
+					  mIREnabled( enableIR ), mUserTrackerEnabled( enableUserTracker ),
+					  mBufferCount( BufferManager<uint8_t>::kDefaultNumBuffers ),
+					  mOverflowPolicy( OVERFLOW_DROP_NEWEST ), mMemoryBudget( 0 ),
+					  mPaddedStrideEnabled( false ), mHugePagesEnabled( false ),
+					  mZeroCopyDepthEnabled( false ), mDepthFormat( DEPTH_SCALED ),
+					  mFullPrecisionIREnabled( false ), mLazyConversionEnabled( false ),
+					  mLowLatencyEnabled( false ), mFrameSyncEnabled( false ),
+					  mTemporalFilterEnabled( false ), mSpatialFilterEnabled( false ),
+					  mDepthColorizerEnabled( false ), mWindowedDepthEnabled( false ), mDepthMaskEnabled( false ),
+					  mDepthNearClip( 500 ), mDepthFarClip( 4000 ),
+					  mDepthPyramidLevels( 0 ), mDepthPyramidReduction( PYRAMID_MIN ),
+					  mDepthOutputMode( makeMapOutputMode( 640, 480, 30 ) ),
+					  mImageOutputMode( makeMapOutputMode( 0, 0, 0 ) ),
+					  mIROutputMode( makeMapOutputMode( 640, 480, 30 ) ),
+					  mOutputModesSet( 0 )
 				{}
 
 				Options &enableDepth( bool enable = true ) { mDepthEnabled = enable; return *this; }
@@ -98,11 +200,191 @@ class OpenNI
 				bool getUserTrackerEnabled() const { return mUserTrackerEnabled; }
 				void setUserTrackerEnabled( bool enable = true ) { mUserTrackerEnabled = enable; }
 
+				//! Sets the number of preallocated buffers per stream. Consumers can hold \a count - 1 frames of a stream before the overflow policy applies.
+				Options &bufferCount( int count ) { mBufferCount = count; return *this; }
+				int getBufferCount() const { return mBufferCount; }
+				void setBufferCount( int count ) { mBufferCount = count; }
+
+				//! Sets what happens to a new frame when every buffer of its stream is held by consumers.
+				Options &overflowPolicy( OverflowPolicy policy ) { mOverflowPolicy = policy; return *this; }
+				OverflowPolicy getOverflowPolicy() const { return mOverflowPolicy; }
+				void setOverflowPolicy( OverflowPolicy policy ) { mOverflowPolicy = policy; }
+
+				//! Limits the memory of all stream buffers to \a bytes by reducing the buffer count. 0 means no limit (the default).
+				Options &memoryBudget( size_t bytes ) { mMemoryBudget = bytes; return *this; }
+				size_t getMemoryBudget() const { return mMemoryBudget; }
+				void setMemoryBudget( size_t bytes ) { mMemoryBudget = bytes; }
+
+				//! Pads every row of the frame buffers to start at a 64-byte boundary. Use getDepthRowBytes() and getVideoRowBytes() to walk the buffers.
+				Options &enablePaddedStride( bool enable = true ) { mPaddedStrideEnabled = enable; return *this; }
+				bool getPaddedStrideEnabled() const { return mPaddedStrideEnabled; }
+				void setPaddedStrideEnabled( bool enable = true ) { mPaddedStrideEnabled = enable; }
+
+				//! Backs the frame buffers with huge pages where the OS supports it.
+				Options &enableHugePages( bool enable = true ) { mHugePagesEnabled = enable; return *this; }
+				bool getHugePagesEnabled() const { return mHugePagesEnabled; }
+				void setHugePagesEnabled( bool enable = true ) { mHugePagesEnabled = enable; }
+
+				//! Publishes depth frames without copying them out of the OpenNI driver, see getRawDepthData().
+				//! Scaled depth is only converted when getDepthImage() or getDepthData() is called, at most once per frame.
+				Options &enableZeroCopyDepth( bool enable = true ) { mZeroCopyDepthEnabled = enable; return *this; }
+				bool getZeroCopyDepthEnabled() const { return mZeroCopyDepthEnabled; }
+				void setZeroCopyDepthEnabled( bool enable = true ) { mZeroCopyDepthEnabled = enable; }
+
+				Options &depthFormat( DepthFormat format ) { mDepthFormat = format; return *this; }
+				DepthFormat getDepthFormat() const { return mDepthFormat; }
+				void setDepthFormat( DepthFormat format ) { mDepthFormat = format; }
+
+				//! Publishes IR frames with the full 16-bit precision of the sensor as well, see getInfraredImage() and getInfraredData().
+				Options &enableFullPrecisionIR( bool enable = true ) { mFullPrecisionIREnabled = enable; return *this; }
+				bool getFullPrecisionIREnabled() const { return mFullPrecisionIREnabled; }
+				void setFullPrecisionIREnabled( bool enable = true ) { mFullPrecisionIREnabled = enable; }
+
+				//! Converts depth, video and user label frames when they are first requested instead of on the capture thread, at most once per frame.
+				//! The capture thread only pins the driver frames, streams that are not read, e.g. depth and video when only skeletons are used, are not processed.
+				//! Frame callbacks still receive converted frames, registering one converts its stream on the capture thread.
+				//! A driver frame is pinned only while it is converted, the output buffer is taken first, so a full pool never holds up the capture thread.
+				Options &enableLazyConversion( bool enable = true ) { mLazyConversionEnabled = enable; return *this; }
+				bool getLazyConversionEnabled() const { return mLazyConversionEnabled; }
+				void setLazyConversionEnabled( bool enable = true ) { mLazyConversionEnabled = enable; }
+
+				//! Wakes up on whichever generator has new data and publishes each stream as soon as its frame arrives, instead of updating every stream on the depth cadence.
+				//! Streams are no longer updated together, use the frame timestamps to pair them, see getDepthFrameInfo() and getVideoFrameInfo().
+				Options &enableLowLatency( bool enable = true ) { mLowLatencyEnabled = enable; return *this; }
+				bool getLowLatencyEnabled() const { return mLowLatencyEnabled; }
+				void setLowLatencyEnabled( bool enable = true ) { mLowLatencyEnabled = enable; }
+
+				//! Keeps the last few depth, video and user label frames for getSynchronizedFrames(). Depth is also synchronized with the image by the device if it supports the FrameSync capability.
+				//! The pools are allocated with additional buffers for the retained frames.
+				Options &enableFrameSync( bool enable = true ) { mFrameSyncEnabled = enable; return *this; }
+				bool getFrameSyncEnabled() const { return mFrameSyncEnabled; }
+				void setFrameSyncEnabled( bool enable = true ) { mFrameSyncEnabled = enable; }
+
+				//! Filters the depth frames over time on the capture thread and publishes the results as a separate stream, see getFilteredDepthFrame().
+				//! The unfiltered depth frames are still available.
+				Options &enableTemporalFilter( bool enable = true ) { mTemporalFilterEnabled = enable; return *this; }
+				bool getTemporalFilterEnabled() const { return mTemporalFilterEnabled; }
+				void setTemporalFilterEnabled( bool enable = true ) { mTemporalFilterEnabled = enable; }
+
+				Options &temporalFilter( const TemporalDepthFilter::Options &options ) { mTemporalFilterOptions = options; return *this; }
+				const TemporalDepthFilter::Options &getTemporalFilterOptions() const { return mTemporalFilterOptions; }
+				void setTemporalFilterOptions( const TemporalDepthFilter::Options &options ) { mTemporalFilterOptions = options; }
+
+				//! Fills the holes of the depth frames during the conversion, after the temporal filter and the registration. See getSpatialFilterStats() for its timing.
+				Options &enableSpatialFilter( bool enable = true ) { mSpatialFilterEnabled = enable; return *this; }
+				bool getSpatialFilterEnabled() const { return mSpatialFilterEnabled; }
+				void setSpatialFilterEnabled( bool enable = true ) { mSpatialFilterEnabled = enable; }
+
+				Options &spatialFilter( const SpatialDepthFilter::Options &options ) { mSpatialFilterOptions = options; return *this; }
+				const SpatialDepthFilter::Options &getSpatialFilterOptions() const { return mSpatialFilterOptions; }
+				void setSpatialFilterOptions( const SpatialDepthFilter::Options &options ) { mSpatialFilterOptions = options; }
+
+				//! Colorizes the depth frames delivered by the device on the capture thread and publishes them as a separate RGB stream, see getColorizedDepthFrame().
+				//! With lazy conversion the frames are colorized on their first read instead.
+				Options &enableDepthColorizer( bool enable = true ) { mDepthColorizerEnabled = enable; return *this; }
+				bool getDepthColorizerEnabled() const { return mDepthColorizerEnabled; }
+				void setDepthColorizerEnabled( bool enable = true ) { mDepthColorizerEnabled = enable; }
+
+				Options &depthColorizer( const DepthColorizer::Options &options ) { mDepthColorizerOptions = options; return *this; }
+				const DepthColorizer::Options &getDepthColorizerOptions() const { return mDepthColorizerOptions; }
+				void setDepthColorizerOptions( const DepthColorizer::Options &options ) { mDepthColorizerOptions = options; }
+
+				//! Produces an 8-bit image of the depth range in the same pass as the depth conversion, see getWindowedDepthFrame().
+				Options &enableWindowedDepth( bool enable = true ) { mWindowedDepthEnabled = enable; return *this; }
+				bool getWindowedDepthEnabled() const { return mWindowedDepthEnabled; }
+				void setWindowedDepthEnabled( bool enable = true ) { mWindowedDepthEnabled = enable; }
+
+				//! Produces an 8-bit mask of the pixels in the depth range in the same pass as the depth conversion, see getDepthMaskFrame().
+				Options &enableDepthMask( bool enable = true ) { mDepthMaskEnabled = enable; return *this; }
+				bool getDepthMaskEnabled() const { return mDepthMaskEnabled; }
+				void setDepthMaskEnabled( bool enable = true ) { mDepthMaskEnabled = enable; }
+
+				//! Sets the depth range in millimetres of the windowed depth and the depth mask, 500 to 4000 by default.
+				//! The near clip is at least 1, so holes are never in range.
+				Options &depthRange( int nearClip, int farClip ) { setDepthRange( nearClip, farClip ); return *this; }
+				int getDepthNearClip() const { return mDepthNearClip; }
+				int getDepthFarClip() const { return mDepthFarClip; }
+				void setDepthRange( int nearClip, int farClip )
+				{
+					mDepthNearClip = std::min( std::max( nearClip, 1 ), 0xffff );
+					mDepthFarClip = std::min( std::max( farClip, mDepthNearClip ), 0xffff );
+				}
+
+				//! Stores \a numLevels downsampled levels of half, a quarter and an eighth of the resolution with every depth frame, up to kMaxPyramidLevels.
+				//! The levels are reduced from the depth frame once per frame, see Frame::getLevel().
+				Options &depthPyramid( int32_t numLevels, PyramidReduction reduction = PYRAMID_MIN ) { setDepthPyramid( numLevels, reduction ); return *this; }
+				int32_t getDepthPyramidLevels() const { return mDepthPyramidLevels; }
+				PyramidReduction getDepthPyramidReduction() const { return mDepthPyramidReduction; }
+				void setDepthPyramid( int32_t numLevels, PyramidReduction reduction = PYRAMID_MIN )
+				{
+					mDepthPyramidLevels = std::min( std::max( numLevels, 0 ), kMaxPyramidLevels );
+					mDepthPyramidReduction = reduction;
+				}
+
+				//! Adds a region of interest in the coordinates of the depth frame, or the video frame if depth is disabled. Depth, image and IR
+				//! frames only cover the bounding rectangle of the regions, scaled to the resolution of each generator, the pools are sized
+				//! accordingly. Depth pixels outside of every region are cleared, user labels are only computed inside the regions.
+				//! The regions are cropped by the device where supported, unless the user tracker is enabled, see Frame::getX() and Frame::getY().
+				Options &regionOfInterest( const ci::Area &region ) { mRegionsOfInterest.push_back( region ); return *this; }
+				const std::vector< ci::Area > &getRegionsOfInterest() const { return mRegionsOfInterest; }
+				void setRegionsOfInterest( const std::vector< ci::Area > &regions ) { mRegionsOfInterest = regions; }
+
+				//! Sets the resolution and frame rate of the depth generator. A mode set here has to be supported by the device, otherwise
+				//! ExcUnsupportedOutputMode is thrown, a zero resolution keeps the device default. Without it 640x480@30 is used where the device supports it.
+				Options &depthOutputMode( const XnMapOutputMode &mode ) { setDepthOutputMode( mode ); return *this; }
+				const XnMapOutputMode &getDepthOutputMode() const { return mDepthOutputMode; }
+				void setDepthOutputMode( const XnMapOutputMode &mode ) { mDepthOutputMode = mode; mOutputModesSet |= OUTPUT_MODE_DEPTH; }
+				//! Returns whether the depth output mode was set, an unsupported default mode falls back to the device default.
+				bool isDepthOutputModeSet() const { return ( mOutputModesSet & OUTPUT_MODE_DEPTH ) != 0; }
+
+				//! Sets the resolution and frame rate of the image generator with the same rules as depthOutputMode(), the device default is kept by default.
+				Options &imageOutputMode( const XnMapOutputMode &mode ) { setImageOutputMode( mode ); return *this; }
+				const XnMapOutputMode &getImageOutputMode() const { return mImageOutputMode; }
+				void setImageOutputMode( const XnMapOutputMode &mode ) { mImageOutputMode = mode; mOutputModesSet |= OUTPUT_MODE_IMAGE; }
+				bool isImageOutputModeSet() const { return ( mOutputModesSet & OUTPUT_MODE_IMAGE ) != 0; }
+
+				//! Sets the resolution and frame rate of the IR generator with the same rules as depthOutputMode(), 640x480@30 where supported by default.
+				Options &irOutputMode( const XnMapOutputMode &mode ) { setIROutputMode( mode ); return *this; }
+				const XnMapOutputMode &getIROutputMode() const { return mIROutputMode; }
+				void setIROutputMode( const XnMapOutputMode &mode ) { mIROutputMode = mode; mOutputModesSet |= OUTPUT_MODE_IR; }
+				bool isIROutputModeSet() const { return ( mOutputModesSet & OUTPUT_MODE_IR ) != 0; }
+
 			private:
 				bool mDepthEnabled;
 				bool mImageEnabled;
 				bool mIREnabled;
 				bool mUserTrackerEnabled;
+
+				int mBufferCount;
+				OverflowPolicy mOverflowPolicy;
+				size_t mMemoryBudget;
+				bool mPaddedStrideEnabled;
+				bool mHugePagesEnabled;
+				bool mZeroCopyDepthEnabled;
+				DepthFormat mDepthFormat;
+				bool mFullPrecisionIREnabled;
+				bool mLazyConversionEnabled;
+				bool mLowLatencyEnabled;
+				bool mFrameSyncEnabled;
+				bool mTemporalFilterEnabled;
+				TemporalDepthFilter::Options mTemporalFilterOptions;
+				bool mSpatialFilterEnabled;
+				SpatialDepthFilter::Options mSpatialFilterOptions;
+				bool mDepthColorizerEnabled;
+				DepthColorizer::Options mDepthColorizerOptions;
+				bool mWindowedDepthEnabled;
+				bool mDepthMaskEnabled;
+				int mDepthNearClip, mDepthFarClip;
+				int32_t mDepthPyramidLevels;
+				PyramidReduction mDepthPyramidReduction;
+				std::vector< ci::Area > mRegionsOfInterest;
+
+				XnMapOutputMode mDepthOutputMode;
+				XnMapOutputMode mImageOutputMode;
+				XnMapOutputMode mIROutputMode;
+
+				enum { OUTPUT_MODE_DEPTH = 1, OUTPUT_MODE_IMAGE = 2, OUTPUT_MODE_IR = 4 };
+				int mOutputModesSet; // output modes set explicitly, the others are defaults
 		};
 
 		//! Represents the identifier for a particular OpenNI device
@@ -111,13 +393,33 @@ class OpenNI
 				: mIndex( index )
 			{}
 
-			int     mIndex;
+			//! Identifies the device by its serial number or by its URI as returned by getDevices().
+			Device( const std::string &id )
+				: mIndex( -1 ), mId( id )
+			{}
+
+			int         mIndex;
+			std::string mId;
 		};
 
+		//! Describes a connected OpenNI device
+		struct DeviceInfo {
+			int         mIndex;
+			std::string mUri;		//!< creation info of the device node
+			std::string mName;
+			std::string mSerial;	//!< empty if the device does not support identification or it is already open
+		};
+
+		//! Returns the connected devices.
+		static std::vector< DeviceInfo > getDevices();
+		//! Returns the number of connected devices.
+		static size_t getNumDevices() { return getDevices().size(); }
+
 		//! Default constructor - creates an uninitialized instance
 		OpenNI() {}
 
 		//! Creates a new OpenNI based on Device # \a device. 0 is the typical value for \a deviceIndex.
+		//! Every instance has its own context, capture thread and buffers, several devices can be opened by creating an instance for each.
 		OpenNI( Device device, const Options &options = Options() );
 
 		//! Creates a new OpenNI based on the OpenNI recording from the file path \a path.
@@ -135,7 +437,97 @@ class OpenNI
 		//! Returns whether there is a new video frame available since the last call to checkNewVideoFrame(). Call getVideoImage() to retrieve it.
 		bool			checkNewVideoFrame();
 
-		//! Returns latest depth frame.
+		//! Returns whether there is a depth frame newer than the one \a cursor has seen and advances the cursor to the latest frame. Does not affect other cursors or checkNewDepthFrame().
+		bool			checkNewDepthFrame( FrameCursor *cursor );
+
+		//! Returns whether there is a video frame newer than the one \a cursor has seen and advances the cursor to the latest frame. Does not affect other cursors or checkNewVideoFrame().
+		bool			checkNewVideoFrame( FrameCursor *cursor );
+
+		//! Returns the id of the latest depth frame, 0 if there was none.
+		int32_t			getDepthFrameId() const { return mObj->mDepthFrameId.load(); }
+
+		//! Returns the id of the latest video frame, 0 if there was none.
+		int32_t			getVideoFrameId() const { return mObj->mVideoFrameId.load(); }
+
+		//! Returns the id and the timestamp of the latest depth frame.
+		FrameInfo		getDepthFrameInfo() const;
+
+		//! Returns the id and the timestamp of the latest video frame.
+		FrameInfo		getVideoFrameInfo() const;
+
+		//! Depth, video and user label frames matched by their timestamps, see getSynchronizedFrames()
+		struct SynchronizedFrames
+		{
+			Frame<uint16_t>	depth;
+			Frame<uint8_t>	video;
+			Frame<uint8_t>	userLabels;		//!< label map computed from the depth frame, empty if the user tracker is disabled or the labels of the frame were not converted
+		};
+
+		//! Returns the newest depth and video frames whose timestamps differ by at most \a tolerance microseconds. Frame sync has to be enabled in the Options.
+		//! Lazily converted frames are converted first. Returns false if there are no matching frames.
+		//! With lazy conversion the retained frames are only the ones converted on demand, by this call or by the getters. The label map of an older
+		//! depth frame is only available if it was converted while it was the latest one, the raw labels are not retained, \a userLabels is empty otherwise.
+		bool			getSynchronizedFrames( SynchronizedFrames *frames, uint64_t tolerance = 16000 );
+
+		//! Streams signalled by waitForFrame()
+		enum FrameType
+		{
+			FRAME_NONE = 0,
+			FRAME_DEPTH = 1,
+			FRAME_VIDEO = 2
+		};
+
+		//! Blocks until a depth frame is published after the call or \a timeout seconds elapse, a negative \a timeout waits without limit. Returns true if a frame arrived.
+		//! Does not affect checkNewDepthFrame() or other waiters. Frames published between two calls are not seen, use a FrameCursor for that.
+		bool			waitForDepthFrame( double timeout );
+
+		//! Blocks until a video frame is published after the call or \a timeout seconds elapse, a negative \a timeout waits without limit. Returns true if a frame arrived.
+		//! Does not affect checkNewVideoFrame() or other waiters. Frames published between two calls are not seen, use a FrameCursor for that.
+		bool			waitForVideoFrame( double timeout );
+
+		//! Blocks until a depth or video frame is published after the call or \a timeout seconds elapse, a negative \a timeout waits without limit.
+		//! Returns the FrameType flags of the new frames.
+		int				waitForFrame( double timeout );
+
+		//! Blocks until there is a depth frame newer than the one \a cursor has seen or \a timeout seconds elapse, a negative \a timeout waits without limit. Returns true and advances the cursor if a frame arrived.
+		bool			waitForDepthFrame( FrameCursor *cursor, double timeout );
+
+		//! Blocks until there is a video frame newer than the one \a cursor has seen or \a timeout seconds elapse, a negative \a timeout waits without limit. Returns true and advances the cursor if a frame arrived.
+		bool			waitForVideoFrame( FrameCursor *cursor, double timeout );
+
+		//! Registers \a callback to be called from the capture thread as soon as a depth frame is published.
+		//! The frame is the scaled or millimetre depth selected in the Options, or the raw driver frame in millimetres if zero-copy depth is enabled.
+		//! Callbacks delay the capture of the next frame, they should return well within the frame period, see getDepthCallbackStats().
+		//! Callbacks must not re-enter the OpenNI instance: they must not block on it, e.g. with waitForDepthFrame(), nor register or unregister
+		//! callbacks, which waits for the running callbacks and deadlocks. Reading the callback stats from a callback or another thread does not block.
+		ci::CallbackId	registerDepthFrame( std::function< void ( const DepthFrameEvent & ) > callback );
+		template< typename T >
+		ci::CallbackId	registerDepthFrame( T *obj, void ( T::*callback )( const DepthFrameEvent & ) ) { return registerDepthFrame( std::bind( callback, obj, std::placeholders::_1 ) ); }
+		void			unregisterDepthFrame( ci::CallbackId id );
+
+		//! Registers \a callback to be called from the capture thread with each RGB or 8-bit IR video frame, with the same constraints as registerDepthFrame().
+		ci::CallbackId	registerVideoFrame( std::function< void ( const VideoFrameEvent & ) > callback );
+		template< typename T >
+		ci::CallbackId	registerVideoFrame( T *obj, void ( T::*callback )( const VideoFrameEvent & ) ) { return registerVideoFrame( std::bind( callback, obj, std::placeholders::_1 ) ); }
+		void			unregisterVideoFrame( ci::CallbackId id );
+
+		//! Registers \a callback to be called from the capture thread with the user label map of each frame, with the same constraints as registerDepthFrame().
+		//! Labels are the low byte of the user ids, 0 is the background.
+		ci::CallbackId	registerUserFrame( std::function< void ( const UserFrameEvent & ) > callback );
+		template< typename T >
+		ci::CallbackId	registerUserFrame( T *obj, void ( T::*callback )( const UserFrameEvent & ) ) { return registerUserFrame( std::bind( callback, obj, std::placeholders::_1 ) ); }
+		void			unregisterUserFrame( ci::CallbackId id );
+
+		//! Returns the time spent in the depth frame callbacks.
+		CallbackStats	getDepthCallbackStats() const;
+		//! Returns the time spent in the video frame callbacks.
+		CallbackStats	getVideoCallbackStats() const;
+		//! Returns the time spent in the user frame callbacks.
+		CallbackStats	getUserCallbackStats() const;
+		//! Returns the time spent filling depth holes, counted per converted depth frame, filtered frames included.
+		FilterStats		getSpatialFilterStats() const;
+
+		//! Returns latest depth frame in the format set in the Options.
 		ci::ImageSourceRef	getDepthImage();
 
 		//! Returns latest video frame.
@@ -144,15 +536,74 @@ class OpenNI
 		std::shared_ptr<uint8_t> getVideoData();
 		std::shared_ptr<uint16_t> getDepthData();
 
+		//! Returns the latest depth frame with its id, timestamp, layout and format. Returns an empty Frame if there is none.
+		//! The depth pyramid levels enabled in the Options are returned by Frame::getLevel().
+		Frame<uint16_t>	getDepthFrame();
+		//! Returns the latest video frame with its id, timestamp, layout and format. The format tells RGB and IR apart, isVideoInfrared() does not have to be queried.
+		Frame<uint8_t>	getVideoFrame();
+		//! Returns the latest 16-bit IR frame. Only available if full precision IR is enabled in the Options, returns an empty Frame otherwise.
+		Frame<uint16_t>	getInfraredFrame();
+		//! Returns the latest temporally filtered depth frame, with the id and timestamp of the depth frame it was filtered with.
+		//! Only available if the temporal filter is enabled in the Options, returns an empty Frame otherwise.
+		Frame<uint16_t>	getFilteredDepthFrame();
+		//! Returns the latest windowed 8-bit depth frame, produced with the depth frame of the same id.
+		//! Only available if windowed depth is enabled in the Options, returns an empty Frame otherwise.
+		Frame<uint8_t>	getWindowedDepthFrame();
+		//! Returns the latest depth range mask, produced with the depth frame of the same id.
+		//! Only available if the depth mask is enabled in the Options, returns an empty Frame otherwise.
+		Frame<uint8_t>	getDepthMaskFrame();
+		//! Returns the latest colorized depth frame, an RGB frame with the id and timestamp of the depth frame it was colorized from.
+		//! Only available if the depth colorizer is enabled in the Options, returns an empty Frame otherwise.
+		Frame<uint8_t>	getColorizedDepthFrame();
+
+		//! Returns latest 16-bit IR frame. Only available if full precision IR is enabled in the Options, returns an empty ref otherwise.
+		ci::ImageSourceRef	getInfraredImage();
+		//! Returns latest 16-bit IR frame. Only available if full precision IR is enabled in the Options, returns an empty pointer otherwise.
+		std::shared_ptr<uint16_t> getInfraredData();
+
+		//! Returns the latest depth frame in millimetres, referencing the memory of the OpenNI driver. Only available if zero-copy depth is enabled in the Options, returns an empty pointer otherwise.
+		//! The capture thread does not wait for the pointer, the driver may overwrite the frame once the depth generator is updated for the next one.
+		//! Check isRawDepthDataValid() after reading the frame, a reader that was too slow loses it. Rows are packed, getDepthRowBytes() does not apply.
+		std::shared_ptr<const uint16_t> getRawDepthData();
+		//! Returns whether \a data returned by getRawDepthData() is still the current driver frame, i.e. whatever was read from it before the call is intact.
+		bool			isRawDepthDataValid( const std::shared_ptr<const uint16_t> &data ) const;
+
+		//! Returns the number of bytes between rows of the buffer returned by getDepthData().
+		size_t			getDepthRowBytes() const { return mObj->mDepthStride * sizeof( uint16_t ); }
+		//! Returns the number of bytes between rows of the buffer returned by getVideoData().
+		size_t			getVideoRowBytes() const { return ( mObj->mLastVideoFrameInfrared ? mObj->mIRStride : mObj->mImageStride ) * sizeof( uint8_t ); }
+		//! Returns the number of bytes between rows of the buffer returned by getInfraredData().
+		size_t			getInfraredRowBytes() const { return mObj->mIR16Stride * sizeof( uint16_t ); }
+
+		//! Returns the occupancy and drop counters of the depth buffer pool.
+		BufferStats		getDepthBufferStats() const { return mObj->mDepthBuffers.getStats(); }
+		//! Returns the occupancy and drop counters of the filtered depth buffer pool.
+		BufferStats		getFilteredDepthBufferStats() const { return mObj->mFilteredDepthBuffers.getStats(); }
+		//! Returns the occupancy and drop counters of the colorized depth buffer pool.
+		BufferStats		getColorizedDepthBufferStats() const { return mObj->mColorizedDepthBuffers.getStats(); }
+		//! Returns the occupancy and drop counters of the windowed depth buffer pool.
+		BufferStats		getWindowedDepthBufferStats() const { return mObj->mWindowedDepthBuffers.getStats(); }
+		//! Returns the occupancy and drop counters of the depth mask buffer pool.
+		BufferStats		getDepthMaskBufferStats() const { return mObj->mDepthMaskBuffers.getStats(); }
+		//! Returns the occupancy and drop counters of the video buffer pool.
+		BufferStats		getVideoBufferStats() const { return mObj->mLastVideoFrameInfrared ? mObj->mIRBuffers.getStats() : mObj->mColorBuffers.getStats(); }
+
 		//! Sets the video image returned by getVideoImage() and getVideoData() to be infrared when \a infrared is true, color when it's false (the default)
 		void			setVideoInfrared( bool infrared = true );
 
 		//! Returns whether the video image returned by getVideoImage() and getVideoData() is infrared when \c true, or color when it's \c false (the default)
 		bool			isVideoInfrared() const { return mObj->mVideoInfrared; }
 
-		//! Calibrates depth to video frame.
+		//! Calibrates depth to video frame. Devices without the alternative view point capability, like most recordings, register
+		//! the depth on the CPU if a calibration was set with setDepthRegistration(). The user labels stay in the depth view point then.
 		void			setDepthAligned( bool aligned = true );
 		bool			isDepthAligned() const { return mObj->mDepthAligned; }
+		//! Returns whether the aligned depth is registered on the CPU.
+		bool			isDepthAlignedInSoftware() const { return mObj->mSoftwareRegistration; }
+
+		//! Sets the calibration of the depth and color cameras for the CPU registration of setDepthAligned(), split to \a numThreads threads,
+		//! 0 uses the number of hardware threads. A new calibration with the same number of threads keeps the worker threads.
+		void			setDepthRegistration( const RegistrationCalibration &calibration, int numThreads = 0 );
 
 		void			setMirrored( bool mirror = true );
 		bool			isMirrored() const { return mObj->mMirrored; }
@@ -171,7 +622,7 @@ class OpenNI
 	protected:
 		class Obj : public BufferObj {
 			public:
-				Obj( int deviceIndex, const Options &options );
+				Obj( const Device &device, const Options &options );
 				Obj( const ci::fs::path &recording, const Options &options );
 				~Obj();
 
@@ -179,54 +630,188 @@ class OpenNI
 				void stop();
 
 				BufferManager<uint8_t> mColorBuffers;
+				BufferManager<uint8_t> mIRBuffers;
+				BufferManager<uint16_t> mIR16Buffers;
 				BufferManager<uint16_t> mDepthBuffers;
+				BufferManager<uint16_t> mFilteredDepthBuffers;
+				BufferManager<uint8_t> mColorizedDepthBuffers;
+				BufferManager<uint8_t> mWindowedDepthBuffers;
+				BufferManager<uint8_t> mDepthMaskBuffers;
+				//! only used by the capture thread
+				TemporalDepthFilter mTemporalFilter;
+				DepthColorizer mDepthColorizer;
+				//! used during the conversion, guarded by mSpatialFilterMutex, created with the pools
+				std::mutex mSpatialFilterMutex;
+				std::shared_ptr<SpatialDepthFilter> mSpatialFilter;
+
+				// zero-copy depth and lazy conversion, driver frames are pinned until the next update
+				// and converted on demand at most once per frame
+				PinnedBuffer<uint16_t> mRawDepth;
+				ci::Area mRawDepthArea; // area of the full frame covered by the published driver frame
+				FrameInfo mRawDepthInfo;
+				std::mutex mDepthConvertMutex;
+				int32_t mConvertedDepthFrameId;
+				PinnedBuffer<uint8_t> mRawImage;
+				ci::Area mRawImageArea;
+				FrameInfo mRawImageInfo;
+				PinnedBuffer<uint16_t> mRawIR;
+				ci::Area mRawIRArea;
+				FrameInfo mRawIRInfo;
+				std::mutex mVideoConvertMutex;
+				int32_t mConvertedVideoFrameId;
+				std::mutex mColorizeMutex;
+				int32_t mColorizedDepthFrameId;
+				bool isDepthOnDemand() const { return mOptions.getZeroCopyDepthEnabled() || mOptions.getLazyConversionEnabled(); }
+				bool revokeRawFrames();
+				bool isNewDataAvailable();
+
+				// the capture thread sleeps until a generator signals new data, the driver is not queried under the lock
+				std::mutex mNewDataMutex;
+				std::condition_variable mNewDataCond;
+				bool mNewDataSignaled;
+				static void XN_CALLBACK_TYPE newDataAvailableCB( xn::ProductionNode &node, void *pCookie );
+				//! Blocks until \a generator, or any generator with \a lowLatency, has new data or the capture thread has to die.
+				void waitForNewData( xn::Generator *generator, bool lowLatency );
+
+				// the last frames of each pool for timestamp matching, declared after the pools they reference
+				static const int32_t kFrameSyncRingSize = 3;
+				FrameRing<uint16_t> mDepthRing;
+				FrameRing<uint8_t> mColorRing;
+				FrameRing<uint8_t> mIRRing;
+
+				// frame notification, the capture thread signals waiters after incrementing the frame ids
+				// and records the info of the latest frames
+				mutable std::mutex mFrameMutex;
+				std::condition_variable mFrameCond;
+				FrameInfo mDepthFrameInfo;
+				FrameInfo mVideoFrameInfo;
+				void notifyFrame( FrameType type, const FrameInfo &info );
+				//! Returns the FrameType flags of \a frames with a frame newer than \a depthFrameId and \a videoFrameId.
+				int newFramesSince( int frames, int32_t depthFrameId, int32_t videoFrameId ) const;
+				int waitForFrames( int frames, double timeout );
+				bool waitForCursor( const AtomicInt &frameId, FrameCursor *cursor, double timeout );
+
+				// ids of the latest published frames, increasing monotonically from 1
+				AtomicInt mDepthFrameId;
+				AtomicInt mVideoFrameId;
+
+				// frame callbacks, called on the capture thread with the callback lock held, the stats have
+				// their own lock, so they can be read while the callbacks run
+				mutable std::mutex mCallbackMutex;
+				ci::CallbackMgr< void ( const DepthFrameEvent & ) > mDepthFrameCallbacks;
+				ci::CallbackMgr< void ( const VideoFrameEvent & ) > mVideoFrameCallbacks;
+				ci::CallbackMgr< void ( const UserFrameEvent & ) > mUserFrameCallbacks;
+				mutable std::mutex mCallbackStatsMutex;
+				CallbackStats mDepthCallbackStats;
+				CallbackStats mVideoCallbackStats;
+				CallbackStats mUserCallbackStats;
+				template< typename T >
+				bool hasFrameCallbacks( const ci::CallbackMgr< void ( const FrameEvent< T > & ) > &callbacks ) const;
+				template< typename T >
+				void callFrameCallbacks( ci::CallbackMgr< void ( const FrameEvent< T > & ) > &callbacks, const FrameEvent< T > &event, CallbackStats *stats );
 
 				static void threadedFunc( struct OpenNI::Obj *arg );
 
 				xn::Context mContext;
+				xn::Device mDevice;
 
 				xn::DepthGenerator mDepthGenerator;
 				xn::DepthMetaData mDepthMD;
 				int mDepthWidth;
 				int mDepthHeight;
 				int mDepthMaxDepth;
+				size_t mDepthStride;
+				size_t mColorizedDepthStride;
+				size_t mDepth8Stride;	//!< of the windowed depth and the depth mask
+				PyramidLayout mDepthPyramid;
 
 				xn::ImageGenerator mImageGenerator;
 				xn::ImageMetaData mImageMD;
 				int mImageWidth;
 				int mImageHeight;
+				size_t mImageStride;
 
 				xn::IRGenerator mIRGenerator;
 				xn::IRMetaData mIRMD;
 				int mIRWidth;
 				int mIRHeight;
+				size_t mIRStride;
+				size_t mIR16Stride;
 
 				UserTracker mUserTracker;
 
 				xn::Recorder mRecorder;
 				bool mRecording;
+				bool mPlayback;
 
 				Options mOptions;
 
+				// regions of interest, the published frames cover these areas of the full frames
+				int mDepthFullWidth, mDepthFullHeight;
+				int mImageFullWidth, mImageFullHeight;
+				int mIRFullWidth, mIRFullHeight;
+				ci::Area mDepthRoi;
+				ci::Area mImageRoi;
+				ci::Area mIRRoi;
+				std::vector< uint8_t > mRoiCoverage; // nonzero inside the regions over mDepthRoi, only used for several regions
+				std::vector< uint16_t > mRoiDepth; // cropped driver depth, only written by the capture thread
+				bool mDepthCropped; // the published driver depth is mRoiDepth
+				bool hasRegionsOfInterest() const { return !mOptions.getRegionsOfInterest().empty(); }
+				void setupRegionsOfInterest();
+				void setupCropping();
+				void cropDepth( const uint16_t *depth, const ci::Area &area, uint16_t *dst );
+
+				void setupBuffers();
+				void cancelBufferWaits( bool cancel );
+
 				void generateDepth();
+				void generateUsers();
+				//! Returns \a depth registered to the color view point and sets \a area to the published frame if software registration is on, \a depth otherwise.
+				//! Frame \a frameId is registered once for all readers, an id of 0 is registered every time. \a lock is locked while the result is read.
+				const uint16_t *registerDepth( const uint16_t *depth, ci::Area *area, int32_t frameId, std::unique_lock< std::mutex > *lock );
+				//! Registers frame \a frameId and writes it with writeDepth().
+				void convertDepth( const uint16_t *depth, uint16_t *destPixels, const ci::Area &area, int32_t frameId, uint8_t *destWindowed = NULL, uint8_t *destMask = NULL );
+				//! Writes registered \a depth to \a destPixels and to the optional windowed depth and depth mask.
+				void writeDepth( const uint16_t *depth, uint16_t *destPixels, const ci::Area &area, uint8_t *destWindowed = NULL, uint8_t *destMask = NULL );
+				void buildDepthPyramid( uint16_t *destPixels );
+				void getDepth8Buffers( uint8_t **windowed, uint8_t **mask );
+				void publishDepth8Buffers( uint8_t *windowed, uint8_t *mask, const FrameInfo &info );
+				void updateDepthOnDemand();
+				void filterDepth( const uint16_t *depth, const ci::Area &area, const FrameInfo &info );
+				void generateColorizedDepth( const uint16_t *depth, const ci::Area &area, const FrameInfo &info );
+				void colorizeDepth( const uint16_t *depth, const ci::Area &area, const FrameInfo &info, uint8_t *destPixels );
+				//! Colorizes the pinned driver depth frame if it has not been colorized yet, lazy conversion only.
+				void updateColorizedDepthOnDemand();
 				void generateImage();
+				void convertImage( const uint8_t *image, uint8_t *destPixels, const ci::Area &area );
 				void generateIR();
+				void convertInfrared( const uint16_t *ir, uint8_t *destPixels, uint16_t *destPixels16, const ci::Area &area );
+				void updateVideoOnDemand();
+				FrameFormat getDepthFrameFormat() const { return mOptions.getDepthFormat() == DEPTH_MILLIMETERS ? FORMAT_DEPTH_MILLIMETERS : FORMAT_DEPTH_SCALED; }
 
 				std::shared_ptr<std::thread> mThread;
 
 				volatile bool mShouldDie;
-				volatile bool mNewDepthFrame, mNewVideoFrame;
+				AtomicInt mNewDepthFrame, mNewVideoFrame;
 				volatile bool mVideoInfrared;
 				volatile bool mLastVideoFrameInfrared;
 
 				volatile bool mDepthAligned;
 				volatile bool mMirrored;
+
+				//! CPU registration of the depth frames, guarded by mRegistrationMutex during the conversion
+				volatile bool mSoftwareRegistration;
+				std::mutex mRegistrationMutex;
+				std::shared_ptr<DepthRegistration> mRegistration;
+				std::vector<uint16_t> mRegisteredDepth;
+				int32_t mRegisteredFrameId; // frame registered to mRegisteredDepth, 0 if it has to be registered again
 				volatile bool mIsCapturing;
 		};
 
 		friend class ImageSourceOpenNIColor;
 		friend class ImageSourceOpenNIInfrared;
 		friend class ImageSourceOpenNIDepth;
+		friend class ImageSourceOpenNIInfrared16;
 
 		//friend class UserTracker;
 
@@ -244,6 +829,12 @@ class OpenNI
 //! Parent class for all OpenNI exceptions
 class OpenNIExc : std::exception {};
 
+//! Exception thrown from a failure to find or open the requested device
+class ExcDeviceNotAvailable : public OpenNIExc {};
+
+//! Exception thrown when an output mode is requested that the generator does not support
+class ExcUnsupportedOutputMode : public OpenNIExc {};
+
 //! Exception thrown from a failure to open a file recording
 class ExcFailedOpenFileRecording : public OpenNIExc {};
 
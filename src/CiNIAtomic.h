@@ -0,0 +1,122 @@
+/*
+ Copyright (c) 2012, Gabor Papp, All rights reserved.
+
+ This code is intended for use with the Cinder C++ library:
+ http://libcinder.org
+
+ Partially based on the Cinder-Kinect block:
+ https://github.com/cinder/Cinder-Kinect
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "cinder/Cinder.h"
+
+#if defined( _MSC_VER )
+#include <intrin.h>
+#pragma intrinsic( _InterlockedIncrement, _InterlockedDecrement, _InterlockedExchange, _InterlockedCompareExchange, _ReadWriteBarrier )
+#endif
+
+namespace mndl { namespace ni {
+
+//! Sequentially consistent 32-bit integer shared between the capture thread and its consumers.
+//! Thin wrapper over the compiler intrinsics, since <atomic> is not available on every supported toolchain.
+class AtomicInt
+{
+	public:
+		AtomicInt( int32_t value = 0 ) : mValue( value ) {}
+
+		int32_t load() const
+		{
+#if defined( _MSC_VER )
+			long v = mValue;
+			_ReadWriteBarrier();
+			return v;
+#else
+			return __atomic_load_n( &mValue, __ATOMIC_SEQ_CST );
+#endif
+		}
+
+		void store( int32_t value )
+		{
+#if defined( _MSC_VER )
+			_InterlockedExchange( &mValue, value );
+#else
+			__atomic_store_n( &mValue, value, __ATOMIC_SEQ_CST );
+#endif
+		}
+
+		//! Returns the new value.
+		int32_t increment()
+		{
+#if defined( _MSC_VER )
+			return _InterlockedIncrement( &mValue );
+#else
+			return __atomic_add_fetch( &mValue, 1, __ATOMIC_SEQ_CST );
+#endif
+		}
+
+		//! Returns the new value.
+		int32_t decrement()
+		{
+#if defined( _MSC_VER )
+			return _InterlockedDecrement( &mValue );
+#else
+			return __atomic_sub_fetch( &mValue, 1, __ATOMIC_SEQ_CST );
+#endif
+		}
+
+		//! Returns the previous value.
+		int32_t exchange( int32_t value )
+		{
+#if defined( _MSC_VER )
+			return _InterlockedExchange( &mValue, value );
+#else
+			return __atomic_exchange_n( &mValue, value, __ATOMIC_SEQ_CST );
+#endif
+		}
+
+		//! Sets the value to \a desired if it equals \a expected. Returns whether the swap happened.
+		bool compareExchange( int32_t expected, int32_t desired )
+		{
+#if defined( _MSC_VER )
+			return _InterlockedCompareExchange( &mValue, desired, expected ) == expected;
+#else
+			return __atomic_compare_exchange_n( &mValue, &expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST );
+#endif
+		}
+
+	private:
+		// not copyable, the value is shared between threads
+		AtomicInt( const AtomicInt & );
+		AtomicInt &operator=( const AtomicInt & );
+
+#if defined( _MSC_VER )
+		volatile long mValue;
+#else
+		volatile int32_t mValue;
+#endif
+};
+
+} } // namespace mndl::ni
+
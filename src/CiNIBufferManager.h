@@ -33,97 +33,625 @@
 #include "cinder/Cinder.h"
 #include "cinder/Thread.h"
 
-#include <map>
+#include <algorithm>
+#include <chrono>
+#include <new>
+#include <utility>
+
+#if defined( _MSC_VER )
+#include <malloc.h>
+#else
+#include <stdlib.h>
+#include <sys/mman.h>
+#endif
+
+#include "CiNIAtomic.h"
 
 namespace mndl { namespace ni {
 
+//! Default allocator policy of BufferManager. Returns cache-line and SIMD aligned memory,
+//! optionally backed by transparent huge pages to reduce TLB misses on large frames.
+struct AlignedAllocator
+{
+	static const size_t kAlignment = 64;
+	static const size_t kHugePageSize = 2 * 1024 * 1024;
+
+	static void* allocate( size_t bytes, bool hugePages )
+	{
+#if defined( _MSC_VER )
+		// large pages require the SeLockMemoryPrivilege on Windows, fall back to regular pages
+		return _aligned_malloc( bytes, kAlignment );
+#else
+		void *ptr = NULL;
+		if ( hugePages )
+		{
+			bytes = ( bytes + kHugePageSize - 1 ) & ~( kHugePageSize - 1 );
+			if ( posix_memalign( &ptr, kHugePageSize, bytes ) != 0 )
+				return NULL;
+#if defined( MADV_HUGEPAGE )
+			madvise( ptr, bytes, MADV_HUGEPAGE );
+#endif
+			return ptr;
+		}
+		if ( posix_memalign( &ptr, kAlignment, bytes ) != 0 )
+			return NULL;
+		return ptr;
+#endif
+	}
+
+	static void deallocate( void *ptr )
+	{
+#if defined( _MSC_VER )
+		_aligned_free( ptr );
+#else
+		free( ptr );
+#endif
+	}
+};
+
+//! Allocation flags of BufferManager::setup()
+enum BufferFlags
+{
+	BUFFER_PADDED_STRIDE	= 1 << 0,	//!< Rows padded to start at an aligned address, see calcStride().
+	BUFFER_HUGE_PAGES		= 1 << 1,	//!< Backs the pool with huge pages where the OS supports it.
+	BUFFER_ZERO_FILL		= 1 << 2	//!< Clears the buffers once, for producers that write only part of a frame.
+};
+
 struct BufferObj
 {
 	public:
 		std::recursive_mutex mMutex;
 };
 
-template<typename T>
+//! What the capture thread does when every buffer of a pool is referenced.
+enum OverflowPolicy
+{
+	OVERFLOW_DROP_NEWEST,	//!< Drops the incoming frame and keeps the published one.
+	//! Writes the incoming frame into the published buffer if no consumer holds it, otherwise drops the incoming frame.
+	//! The stream has no published frame until the new one is written, reads in the meantime return no frame.
+	//! A FrameRing holds the published buffer as well, with a ring this policy drops like OVERFLOW_DROP_NEWEST.
+	OVERFLOW_REPLACE_PUBLISHED,
+	OVERFLOW_BLOCK			//!< Waits until a consumer releases a buffer.
+};
+
+//! Snapshot of the occupancy of a buffer pool.
+struct BufferStats
+{
+	BufferStats() : numBuffers( 0 ), numReferenced( 0 ), bytes( 0 ), framesPublished( 0 ), framesDropped( 0 ) {}
+
+	int32_t		numBuffers;			//!< preallocated buffers in the pool
+	int32_t		numReferenced;		//!< buffers currently published or held by a consumer
+	size_t		bytes;				//!< memory allocated by the pool
+	uint32_t	framesPublished;
+	uint32_t	framesDropped;
+};
+
+//! Identification and timing of a published frame, stored in the header of its buffer.
+struct FrameInfo
+{
+	FrameInfo() : frameId( 0 ), sourceFrameId( 0 ), timestamp( 0 ) {}
+
+	int32_t		frameId;		//!< id assigned when the frame was published, increasing monotonically from 1
+	uint32_t	sourceFrameId;	//!< frame id reported by the generator
+	uint64_t	timestamp;		//!< timestamp reported by the generator in microseconds
+};
+
+//! Lock-free single-producer/multi-consumer frame exchange over a bounded, preallocated pool.
+//! The capture thread requests a free buffer with getNewBuffer(), fills it and publishes it with setActiveBuffer().
+//! Consumers reference the latest published buffer with refActiveBuffer() and release it with derefBuffer().
+//! Every buffer has an atomic reference count, the active buffer holds one reference itself, so it is never
+//! handed out for writing. All buffers are allocated in one block in setup(), nothing is allocated while capturing.
+//! Every buffer starts at an Allocator::kAlignment boundary.
+template<typename T, typename Allocator = AlignedAllocator>
 struct BufferManager
 {
-	BufferManager() {};
-	BufferManager( size_t allocationSize, BufferObj *bufferObj )
-		: mAllocationSize( allocationSize ), mBufferObj( bufferObj ), mActiveBuffer( 0 )
-	{}
+	static const int32_t kMaxBuffers = 32;
+	static const int32_t kDefaultNumBuffers = 4;
 
+	BufferManager();
 	~BufferManager();
 
+	//! Returns the number of elements between rows of \a rowElements elements. Padded rows start at an Allocator::kAlignment boundary.
+	static size_t	calcStride( size_t rowElements, bool padded );
+
+	//! Allocates \a numBuffers buffers of \a allocationSize elements. \a flags is a combination of BufferFlags. Has to be called before the capture thread is started.
+	void		setup( size_t allocationSize, int32_t numBuffers = kDefaultNumBuffers, OverflowPolicy policy = OVERFLOW_DROP_NEWEST, int flags = 0 );
+
+	//! Returns a buffer with a reference count of 1 for the producer or NULL if the frame has to be dropped according to the overflow policy.
 	T*			getNewBuffer();
+	//! Publishes \a buffer and releases the previously active buffer. The producer's reference is handed over to the active slot.
 	void		setActiveBuffer( T *buffer );
-	void		derefActiveBuffer();
+	//! Returns the active buffer with an additional reference or NULL if nothing is published.
 	T*			refActiveBuffer();
+	//! Adds a reference to \a buffer, which the caller has to hold a reference to already.
+	void		refBuffer( T *buffer ) { mSlots[ slotIndex( buffer ) ].mRefCount.increment(); }
 	void		derefBuffer( T *buffer );
 
-	BufferObj				*mBufferObj;
-	size_t					mAllocationSize;
-	// map from pointer to reference count
-	std::map< T*, size_t >	mBuffers;
-	T						*mActiveBuffer;
+	//! Wakes up and fails a getNewBuffer() blocked by OVERFLOW_BLOCK until \a cancel is reset to false.
+	void		cancelWait( bool cancel = true );
+
+	size_t		getAllocationSize() const { return mAllocationSize; }
+	int32_t		getNumBuffers() const { return mNumBuffers; }
+	size_t		getBytesPerBuffer() const { return mAllocationSize * sizeof( T ); }
+	BufferStats	getStats() const;
+
+	//! Returns the frame info stored with \a buffer. The producer sets it before setActiveBuffer(), consumers may read it while they hold a reference.
+	static FrameInfo &getFrameInfo( T *buffer ) { return reinterpret_cast< Header * >( reinterpret_cast< uint8_t * >( buffer ) - kHeaderSize )->mInfo; }
+
+	protected:
+		// buffer memory is prefixed with a header storing the slot index, so derefBuffer() does not have to search,
+		// and the info of the frame
+		struct Header
+		{
+			int32_t		mIndex;
+			FrameInfo	mInfo;
+		};
+		static const size_t kHeaderSize = ( sizeof( Header ) + Allocator::kAlignment - 1 ) & ~( Allocator::kAlignment - 1 );
+
+		struct Slot
+		{
+			Slot() : mData( NULL ) {}
+
+			T			*mData;
+			AtomicInt	mRefCount;
+		};
+
+		static int32_t	slotIndex( T *buffer ) { return reinterpret_cast< Header * >( reinterpret_cast< uint8_t * >( buffer ) - kHeaderSize )->mIndex; }
+		size_t			getSlotBytes() const;
+		void			deallocate();
+		T*				acquireFree();
+		// unpublishes the active buffer and hands it to the producer if only the pool references it
+		T*				acquireActive();
+		void			release( int32_t index );
+
+		size_t			mAllocationSize;
+		uint8_t			*mMemory;
+		Slot			mSlots[ kMaxBuffers ];
+		int32_t			mNumBuffers;
+		OverflowPolicy	mOverflowPolicy;
+		AtomicInt		mActiveBuffer; // slot index, -1 if there is none
+
+		AtomicInt		mFramesPublished;
+		AtomicInt		mFramesDropped;
+
+		// only used by OVERFLOW_BLOCK
+		AtomicInt					mNumWaiting;
+		AtomicInt					mWaitCancelled;
+		std::mutex					mWaitMutex;
+		std::condition_variable		mWaitCond;
+
+	private:
+		BufferManager( const BufferManager & );
+		BufferManager &operator=( const BufferManager & );
 };
 
-template<typename T>
-BufferManager<T>::~BufferManager()
+template<typename T, typename Allocator>
+BufferManager<T, Allocator>::BufferManager()
+	: mAllocationSize( 0 ), mMemory( NULL ), mNumBuffers( 0 ), mOverflowPolicy( OVERFLOW_DROP_NEWEST ), mActiveBuffer( -1 )
+{
+}
+
+template<typename T, typename Allocator>
+BufferManager<T, Allocator>::~BufferManager()
+{
+	deallocate();
+}
+
+template<typename T, typename Allocator>
+size_t BufferManager<T, Allocator>::calcStride( size_t rowElements, bool padded )
+{
+	if ( !padded )
+		return rowElements;
+	size_t rowBytes = rowElements * sizeof( T );
+	rowBytes = ( rowBytes + Allocator::kAlignment - 1 ) & ~( Allocator::kAlignment - 1 );
+	return ( rowBytes + sizeof( T ) - 1 ) / sizeof( T );
+}
+
+template<typename T, typename Allocator>
+size_t BufferManager<T, Allocator>::getSlotBytes() const
 {
-	for ( typename std::map<T*,size_t>::iterator bufIt = mBuffers.begin(); bufIt != mBuffers.end(); ++bufIt ) {
-		delete [] bufIt->first;
+	size_t bytes = kHeaderSize + mAllocationSize * sizeof( T );
+	return ( bytes + Allocator::kAlignment - 1 ) & ~( Allocator::kAlignment - 1 );
+}
+
+template<typename T, typename Allocator>
+void BufferManager<T, Allocator>::setup( size_t allocationSize, int32_t numBuffers, OverflowPolicy policy, int flags )
+{
+	deallocate();
+
+	// at least one buffer for the active frame and one to write the next frame into
+	mNumBuffers = std::max( numBuffers, 2 );
+	if ( mNumBuffers > kMaxBuffers )
+		mNumBuffers = kMaxBuffers;
+	mAllocationSize = allocationSize;
+	mOverflowPolicy = policy;
+
+	// one block for the whole pool, so huge pages can back several frames
+	mMemory = static_cast< uint8_t * >( Allocator::allocate( mNumBuffers * getSlotBytes(), ( flags & BUFFER_HUGE_PAGES ) != 0 ) );
+	if ( mMemory == NULL )
+		throw std::bad_alloc();
+
+	for ( int32_t i = 0; i < mNumBuffers; i++ )
+	{
+		uint8_t *mem = mMemory + i * getSlotBytes();
+		reinterpret_cast< Header * >( mem )->mIndex = i;
+		reinterpret_cast< Header * >( mem )->mInfo = FrameInfo();
+		mSlots[ i ].mData = reinterpret_cast< T * >( mem + kHeaderSize );
+		if ( flags & BUFFER_ZERO_FILL )
+			std::fill( mSlots[ i ].mData, mSlots[ i ].mData + mAllocationSize, T() );
 	}
 }
 
-template<typename T>
-T* BufferManager<T>::getNewBuffer()
+template<typename T, typename Allocator>
+void BufferManager<T, Allocator>::deallocate()
+{
+	if ( mMemory )
+		Allocator::deallocate( mMemory );
+	mMemory = NULL;
+	for ( int32_t i = 0; i < mNumBuffers; i++ )
+	{
+		mSlots[ i ].mData = NULL;
+		mSlots[ i ].mRefCount.store( 0 );
+	}
+	mNumBuffers = 0;
+	mActiveBuffer.store( -1 );
+}
+
+template<typename T, typename Allocator>
+T* BufferManager<T, Allocator>::acquireFree()
+{
+	for ( int32_t i = 0; i < mNumBuffers; i++ )
+	{
+		// 0 means free buffer, consumers never increment a free buffer for long, see refActiveBuffer()
+		if ( mSlots[ i ].mRefCount.compareExchange( 0, 1 ) )
+			return mSlots[ i ].mData;
+	}
+	return NULL;
+}
+
+template<typename T, typename Allocator>
+T* BufferManager<T, Allocator>::acquireActive()
+{
+	int32_t index = mActiveBuffer.load();
+	if ( ( index < 0 ) || ( mSlots[ index ].mRefCount.load() != 1 ) )
+		return NULL;
+
+	// unpublish it, the reference of the active slot is handed over to the producer
+	if ( !mActiveBuffer.compareExchange( index, -1 ) )
+		return NULL;
+
+	// a consumer may have referenced it in the meantime, publish it again in this case
+	if ( mSlots[ index ].mRefCount.load() != 1 )
+	{
+		mActiveBuffer.store( index );
+		return NULL;
+	}
+	return mSlots[ index ].mData;
+}
+
+template<typename T, typename Allocator>
+T* BufferManager<T, Allocator>::getNewBuffer()
 {
-	std::lock_guard<std::recursive_mutex> lock( mBufferObj->mMutex );
+	T *buffer = acquireFree();
+	if ( buffer )
+		return buffer;
 
-	typename std::map<T*,size_t>::iterator bufIt;
-	for( bufIt = mBuffers.begin(); bufIt != mBuffers.end(); ++bufIt ) {
-		if( bufIt->second == 0 ) // 0 means free buffer
+	switch ( mOverflowPolicy )
+	{
+		case OVERFLOW_REPLACE_PUBLISHED:
+			buffer = acquireActive();
+			break;
+
+		case OVERFLOW_BLOCK:
+		{
+			std::unique_lock< std::mutex > lock( mWaitMutex );
+			mNumWaiting.increment();
+			// check again after announcing the wait, so a concurrent release cannot be missed
+			while ( ( ( buffer = acquireFree() ) == NULL ) && !mWaitCancelled.load() )
+				mWaitCond.wait_for( lock, std::chrono::milliseconds( 10 ) );
+			mNumWaiting.decrement();
+			break;
+		}
+
+		default:
 			break;
 	}
-	if( bufIt != mBuffers.end() ) {
-		bufIt->second = 1;
-		return bufIt->first;
+
+	if ( buffer == NULL )
+		mFramesDropped.increment();
+	return buffer;
+}
+
+template<typename T, typename Allocator>
+void BufferManager<T, Allocator>::setActiveBuffer( T *buffer )
+{
+	int32_t prev = mActiveBuffer.exchange( slotIndex( buffer ) );
+	if ( prev >= 0 )
+		release( prev );
+	mFramesPublished.increment();
+}
+
+template<typename T, typename Allocator>
+T* BufferManager<T, Allocator>::refActiveBuffer()
+{
+	for ( ;; )
+	{
+		int32_t index = mActiveBuffer.load();
+		if ( index < 0 )
+			return NULL;
+
+		// the buffer may be republished between reading the index and referencing it,
+		// only keep the reference if it is still the active one
+		mSlots[ index ].mRefCount.increment();
+		if ( mActiveBuffer.load() == index )
+			return mSlots[ index ].mData;
+		release( index );
 	}
-	else { // there were no available buffers - add a new one and return it
-		T *newBuffer = new T[ mAllocationSize ];
-		mBuffers[ newBuffer ] = 1;
-		return newBuffer;
+}
+
+template<typename T, typename Allocator>
+void BufferManager<T, Allocator>::derefBuffer( T *buffer )
+{
+	if ( buffer )
+		release( slotIndex( buffer ) );
+}
+
+template<typename T, typename Allocator>
+void BufferManager<T, Allocator>::release( int32_t index )
+{
+	if ( ( mSlots[ index ].mRefCount.decrement() == 0 ) && ( mNumWaiting.load() > 0 ) )
+	{
+		std::lock_guard< std::mutex > lock( mWaitMutex );
+		mWaitCond.notify_one();
 	}
 }
 
+template<typename T, typename Allocator>
+void BufferManager<T, Allocator>::cancelWait( bool cancel )
+{
+	mWaitCancelled.store( cancel ? 1 : 0 );
+	if ( cancel )
+	{
+		std::lock_guard< std::mutex > lock( mWaitMutex );
+		mWaitCond.notify_all();
+	}
+}
+
+template<typename T, typename Allocator>
+BufferStats BufferManager<T, Allocator>::getStats() const
+{
+	BufferStats stats;
+	stats.numBuffers = mNumBuffers;
+	for ( int32_t i = 0; i < mNumBuffers; i++ )
+	{
+		if ( mSlots[ i ].mRefCount.load() > 0 )
+			stats.numReferenced++;
+	}
+	stats.bytes = mNumBuffers * getSlotBytes();
+	stats.framesPublished = mFramesPublished.load();
+	stats.framesDropped = mFramesDropped.load();
+	return stats;
+}
+
+//! Keeps references to the last few frames published by a BufferManager, so frames of different streams can be matched by their timestamps.
+//! The referenced buffers are not available to the producer, the pool has to be allocated with additional buffers for them.
+template<typename T, typename Allocator = AlignedAllocator>
+class FrameRing
+{
+	public:
+		static const int32_t kMaxFrames = 8;
+
+		FrameRing() : mBuffers( NULL ), mSize( 0 ), mNumFrames( 0 ), mNext( 0 ) {}
+		~FrameRing() { clear(); }
+
+		//! Keeps the last \a size frames of \a buffers, up to kMaxFrames. A size of 0 disables the ring.
+		void		setup( BufferManager<T, Allocator> *buffers, int32_t size );
+		//! Adds a reference to the published \a buffer and releases the oldest frame if the ring is full. \a buffer has to be referenced by the caller.
+		void		push( T *buffer );
+		//! Returns the frame with the timestamp closest to \a timestamp within \a tolerance microseconds with an additional reference or NULL.
+		T*			refClosest( uint64_t timestamp, uint64_t tolerance );
+		//! Returns the \a i-th newest frame with an additional reference or NULL.
+		T*			ref( int32_t i );
+		int32_t		getNumFrames() const;
+		void		clear();
+
+	protected:
+		BufferManager<T, Allocator>	*mBuffers;
+		T							*mFrames[ kMaxFrames ];
+		int32_t						mSize;
+		int32_t						mNumFrames;
+		int32_t						mNext;
+		mutable std::mutex			mMutex;
+
+	private:
+		FrameRing( const FrameRing & );
+		FrameRing &operator=( const FrameRing & );
+};
+
+template<typename T, typename Allocator>
+void FrameRing<T, Allocator>::setup( BufferManager<T, Allocator> *buffers, int32_t size )
+{
+	clear();
+	std::lock_guard< std::mutex > lock( mMutex );
+	mBuffers = buffers;
+	mSize = std::max( 0, size );
+	if ( mSize > kMaxFrames )
+		mSize = kMaxFrames;
+}
+
+template<typename T, typename Allocator>
+void FrameRing<T, Allocator>::push( T *buffer )
+{
+	std::lock_guard< std::mutex > lock( mMutex );
+	if ( mSize == 0 )
+		return;
+
+	if ( mNumFrames == mSize )
+		mBuffers->derefBuffer( mFrames[ mNext ] );
+	else
+		mNumFrames++;
+
+	mBuffers->refBuffer( buffer );
+	mFrames[ mNext ] = buffer;
+	mNext = ( mNext + 1 ) % mSize;
+}
+
+template<typename T, typename Allocator>
+T* FrameRing<T, Allocator>::refClosest( uint64_t timestamp, uint64_t tolerance )
+{
+	std::lock_guard< std::mutex > lock( mMutex );
+	T *closest = NULL;
+	uint64_t closestDiff = 0;
+	for ( int32_t i = 0; i < mNumFrames; i++ )
+	{
+		uint64_t frameTimestamp = BufferManager<T, Allocator>::getFrameInfo( mFrames[ i ] ).timestamp;
+		uint64_t diff = frameTimestamp > timestamp ? frameTimestamp - timestamp : timestamp - frameTimestamp;
+		if ( ( diff <= tolerance ) && ( ( closest == NULL ) || ( diff < closestDiff ) ) )
+		{
+			closest = mFrames[ i ];
+			closestDiff = diff;
+		}
+	}
+
+	if ( closest != NULL )
+		mBuffers->refBuffer( closest );
+	return closest;
+}
+
+template<typename T, typename Allocator>
+T* FrameRing<T, Allocator>::ref( int32_t i )
+{
+	std::lock_guard< std::mutex > lock( mMutex );
+	if ( ( i < 0 ) || ( i >= mNumFrames ) )
+		return NULL;
+
+	T *buffer = mFrames[ ( mNext - 1 - i + mSize ) % mSize ];
+	mBuffers->refBuffer( buffer );
+	return buffer;
+}
+
+template<typename T, typename Allocator>
+int32_t FrameRing<T, Allocator>::getNumFrames() const
+{
+	std::lock_guard< std::mutex > lock( mMutex );
+	return mNumFrames;
+}
+
+template<typename T, typename Allocator>
+void FrameRing<T, Allocator>::clear()
+{
+	std::lock_guard< std::mutex > lock( mMutex );
+	for ( int32_t i = 0; i < mNumFrames; i++ )
+		mBuffers->derefBuffer( mFrames[ i ] );
+	mNumFrames = 0;
+	mNext = 0;
+}
+
+//! Hands out pins to memory owned by somebody else, a frame of the OpenNI driver for example.
+//! The owner calls revoke() before the memory is reused, which rejects new pins and waits until every pin is released.
+//! Pins are for short reads, readers that may hold the memory for long borrow it with lend() instead and are not waited for.
 template<typename T>
-void BufferManager<T>::setActiveBuffer( T *buffer )
+class PinnedBuffer
 {
-	std::lock_guard<std::recursive_mutex> lock( mBufferObj->mMutex );
-	// assign new active buffer
-	mActiveBuffer = buffer;
+	public:
+		PinnedBuffer() : mData( NULL ), mValid( 0 ), mPins( 0 ) {}
+
+		//! Makes \a data available for pinning.
+		void		publish( const T *data );
+		//! Rejects new pins and waits until the existing ones are released. Returns false if the wait was cancelled.
+		bool		revoke();
+
+		//! Returns the published data with a pin or NULL if it is revoked.
+		const T*	pin();
+		void		unpin();
+
+		//! Returns the published data without a pin or NULL if it is revoked, for readers that may hold it for long. revoke() does not
+		//! wait for them, the data is only valid as long as isCurrent() returns true for the \a generation stored here.
+		const T*	lend( int32_t *generation );
+		bool		isCurrent( int32_t generation ) const { return mGeneration.load() == generation; }
+
+		//! Wakes up and fails a revoke() waiting for pins until \a cancel is reset to false.
+		void		cancelWait( bool cancel = true );
+
+	protected:
+		const T		*mData;
+		AtomicInt	mValid;
+		AtomicInt	mPins;
+		AtomicInt	mGeneration;
+
+		AtomicInt					mNumWaiting;
+		AtomicInt					mWaitCancelled;
+		std::mutex					mWaitMutex;
+		std::condition_variable		mWaitCond;
+
+	private:
+		PinnedBuffer( const PinnedBuffer & );
+		PinnedBuffer &operator=( const PinnedBuffer & );
+};
+
+template<typename T>
+void PinnedBuffer<T>::publish( const T *data )
+{
+	mData = data;
+	mValid.store( 1 );
 }
 
 template<typename T>
-T* BufferManager<T>::refActiveBuffer()
+bool PinnedBuffer<T>::revoke()
 {
-	std::lock_guard<std::recursive_mutex> lock( mBufferObj->mMutex );
-	mBuffers[ mActiveBuffer ]++;
-	return mActiveBuffer;
+	// pin() increments before checking mValid, so after this store every pin is either rejected or visible in mPins
+	mValid.store( 0 );
+	mGeneration.increment();
+	if ( mPins.load() == 0 )
+		return true;
+
+	std::unique_lock< std::mutex > lock( mWaitMutex );
+	mNumWaiting.increment();
+	while ( ( mPins.load() > 0 ) && !mWaitCancelled.load() )
+		mWaitCond.wait_for( lock, std::chrono::milliseconds( 1 ) );
+	mNumWaiting.decrement();
+	return mPins.load() == 0;
 }
 
 template<typename T>
-void BufferManager<T>::derefActiveBuffer()
+const T* PinnedBuffer<T>::pin()
 {
-	std::lock_guard<std::recursive_mutex> lock( mBufferObj->mMutex );
-	if ( mActiveBuffer )	// decrement use count on current active buffer
-		mBuffers[ mActiveBuffer ]--;
+	mPins.increment();
+	if ( mValid.load() )
+		return mData;
+	unpin();
+	return NULL;
 }
 
 template<typename T>
-void BufferManager<T>::derefBuffer( T *buffer )
+void PinnedBuffer<T>::unpin()
 {
-	std::lock_guard<std::recursive_mutex> lock( mBufferObj->mMutex );
-	mBuffers[ buffer ]--;
+	if ( ( mPins.decrement() == 0 ) && ( mNumWaiting.load() > 0 ) )
+	{
+		std::lock_guard< std::mutex > lock( mWaitMutex );
+		mWaitCond.notify_one();
+	}
+}
+
+template<typename T>
+const T* PinnedBuffer<T>::lend( int32_t *generation )
+{
+	// a revoke() in between is seen either in mValid or later in the generation
+	*generation = mGeneration.load();
+	if ( !mValid.load() )
+		return NULL;
+	return mData;
+}
+
+template<typename T>
+void PinnedBuffer<T>::cancelWait( bool cancel )
+{
+	mWaitCancelled.store( cancel ? 1 : 0 );
+	if ( cancel )
+	{
+		std::lock_guard< std::mutex > lock( mWaitMutex );
+		mWaitCond.notify_all();
+	}
 }
 
 // Used as the deleter for the shared_ptr returned by getImageData()
@@ -144,5 +672,147 @@ class DataDeleter
 		BufferManager<T> *mBufferMgr;
 };
 
+//! Pixel format of a Frame
+enum FrameFormat
+{
+	FORMAT_DEPTH_SCALED,		//!< 16-bit depth scaled from 0 to the device max depth onto 0 to 65535
+	FORMAT_DEPTH_MILLIMETERS,	//!< 16-bit depth in millimetres
+	FORMAT_RGB,					//!< 8-bit RGB
+	FORMAT_IR,					//!< 8-bit IR
+	FORMAT_IR16,				//!< 16-bit IR
+	FORMAT_USER_LABELS,			//!< 8-bit user labels, the low byte of the user ids, 0 is the background
+	FORMAT_DEPTH_WINDOWED,		//!< 8-bit depth, the depth range mapped from 255 at the near end to 0 at the far end, 0 outside
+	FORMAT_DEPTH_MASK			//!< 8-bit mask, 255 inside the depth range, 0 outside
+};
+
+//! Maximum number of downsampled levels stored with a frame.
+const int32_t kMaxPyramidLevels = 3;
+
+//! Layout of the downsampled levels stored after the full resolution image in the same buffer. Level l has
+//! half the width and height of level l - 1, the full resolution image is level 0.
+struct PyramidLayout
+{
+	PyramidLayout() : numLevels( 0 ) {}
+
+	int32_t		numLevels;							//!< number of downsampled levels, not counting level 0
+	size_t		offsets[ kMaxPyramidLevels ];		//!< elements from the start of the buffer to level i + 1
+	size_t		strides[ kMaxPyramidLevels ];		//!< elements between the rows of level i + 1
+};
+
+//! Handle of a published frame with its layout and FrameInfo. Holds a reference to the pooled buffer, which is returned to the pool when the last handle is released.
+template<typename T>
+class Frame
+{
+	public:
+		Frame() : mWidth( 0 ), mHeight( 0 ), mChannels( 0 ), mStride( 0 ), mFormat( FORMAT_RGB ), mX( 0 ), mY( 0 ), mFullWidth( 0 ), mFullHeight( 0 ) {}
+		Frame( std::shared_ptr<T> data, const FrameInfo &info, int width, int height, int channels, size_t stride, FrameFormat format )
+			: mData( data ), mInfo( info ), mWidth( width ), mHeight( height ), mChannels( channels ), mStride( stride ), mFormat( format ),
+			  mX( 0 ), mY( 0 ), mFullWidth( width ), mFullHeight( height )
+		{}
+
+		Frame( const Frame &other ) = default;
+		Frame( Frame &&other ) noexcept = default;
+		Frame &operator=( const Frame &other ) = default;
+		Frame &operator=( Frame &&other ) noexcept = default;
+
+		const T *getData() const { return mData.get(); }
+		//! Returns the first element of row \a y.
+		const T *getRow( int y ) const { return mData.get() + y * mStride; }
+		//! Returns the reference to the pooled buffer.
+		const std::shared_ptr<T> &getDataRef() const { return mData; }
+
+		const FrameInfo &getInfo() const { return mInfo; }
+		int32_t getFrameId() const { return mInfo.frameId; }
+		//! Returns the timestamp reported by the generator in microseconds.
+		uint64_t getTimestamp() const { return mInfo.timestamp; }
+
+		int getWidth() const { return mWidth; }
+		int getHeight() const { return mHeight; }
+		int getChannels() const { return mChannels; }
+		//! Returns the number of elements between the start of two rows.
+		size_t getStride() const { return mStride; }
+		FrameFormat getFormat() const { return mFormat; }
+		bool isInfrared() const { return ( mFormat == FORMAT_IR ) || ( mFormat == FORMAT_IR16 ); }
+
+		//! Returns the column of the sensor frame the first column of the frame was captured at, nonzero for regions of interest.
+		int getX() const { return mX; }
+		//! Returns the row of the sensor frame the first row of the frame was captured at, nonzero for regions of interest.
+		int getY() const { return mY; }
+		//! Returns the width of the sensor frame, which is larger than the frame for regions of interest.
+		int getFullWidth() const { return mFullWidth; }
+		//! Returns the height of the sensor frame, which is larger than the frame for regions of interest.
+		int getFullHeight() const { return mFullHeight; }
+		//! Sets the position of the frame within a sensor frame of \a fullWidth x \a fullHeight.
+		void setRegion( int x, int y, int fullWidth, int fullHeight )
+		{
+			mX = x;
+			mY = y;
+			mFullWidth = fullWidth;
+			mFullHeight = fullHeight;
+		}
+
+		//! Returns the number of downsampled levels stored with the frame.
+		int32_t getNumLevels() const { return mPyramid.numLevels; }
+		//! Returns level \a level of the pyramid as a Frame sharing the reference to the pooled buffer, level 0 is the frame itself.
+		//! Returns an empty Frame if the level is not available.
+		Frame getLevel( int32_t level ) const
+		{
+			if ( level == 0 )
+				return *this;
+			if ( ( level < 0 ) || ( level > mPyramid.numLevels ) || ( mData.get() == NULL ) )
+				return Frame();
+			Frame frame( std::shared_ptr<T>( mData, mData.get() + mPyramid.offsets[ level - 1 ] ), mInfo,
+						 mWidth >> level, mHeight >> level, mChannels, mPyramid.strides[ level - 1 ], mFormat );
+			frame.setRegion( mX >> level, mY >> level, mFullWidth >> level, mFullHeight >> level );
+			return frame;
+		}
+		void setPyramid( const PyramidLayout &pyramid ) { mPyramid = pyramid; }
+
+		//@{
+		//! Emulates shared_ptr-like behavior
+		typedef std::shared_ptr<T> Frame::*unspecified_bool_type;
+		operator unspecified_bool_type() const { return ( mData.get() == NULL ) ? 0 : &Frame::mData; }
+		void reset() { mData.reset(); }
+		//@}
+
+	protected:
+		std::shared_ptr<T>	mData;
+		FrameInfo			mInfo;
+		int					mWidth;
+		int					mHeight;
+		int					mChannels;
+		size_t				mStride;
+		FrameFormat			mFormat;
+		PyramidLayout		mPyramid;
+		int					mX, mY;
+		int					mFullWidth, mFullHeight;
+};
+
+//! Wraps \a buffer referenced from \a buffers into a Frame, the reference is handed over to the Frame. Returns an empty Frame if \a buffer is NULL.
+template<typename T>
+Frame<T> makeFrame( BufferManager<T> *buffers, T *buffer, std::shared_ptr<BufferObj> ownerObj, int width, int height, int channels, size_t stride, FrameFormat format )
+{
+	if ( buffer == NULL )
+		return Frame<T>();
+	return Frame<T>( std::shared_ptr<T>( buffer, DataDeleter<T>( buffers, ownerObj ) ), BufferManager<T>::getFrameInfo( buffer ),
+					 width, height, channels, stride, format );
+}
+
+// Used as the deleter for the shared_ptr returned by getRawDepthData(), it records the generation
+// of the lent data for the validity check
+template<typename T>
+class LendDeleter
+{
+	public:
+		LendDeleter( int32_t generation, std::shared_ptr<BufferObj> ownerObj )
+			: mOwnerObj( ownerObj ), mGeneration( generation )
+		{}
+
+		void operator()( const T *data ) {}
+
+		std::shared_ptr<BufferObj>	mOwnerObj; // to prevent deletion of our parent Obj
+		int32_t mGeneration;
+};
+
 } } // namespace mndl::ni
 
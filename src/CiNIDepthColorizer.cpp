@@ -0,0 +1,130 @@
+/*
+ Copyright (c) 2012, Gabor Papp, All rights reserved.
+
+ This code is intended for use with the Cinder C++ library:
+ http://libcinder.org
+
+ Partially based on the Cinder-Kinect block:
+ https://github.com/cinder/Cinder-Kinect
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <algorithm>
+
+#include "CiNIDepthColorizer.h"
+
+using namespace ci;
+using namespace std;
+
+namespace mndl { namespace ni {
+
+static uint32_t packColor( const Color8u &color )
+{
+	return color.r | ( color.g << 8 ) | ( color.b << 16 );
+}
+
+DepthColorizer::DepthColorizer( const Options &options )
+	: mOptions( options )
+{
+	mOptions.setNearClip( std::min( std::max( mOptions.getNearClip(), 1 ), 0xffff ) );
+	mOptions.setFarClip( std::min( std::max( mOptions.getFarClip(), mOptions.getNearClip() ), 0xffff ) );
+
+	// the palette is interpolated evenly, a single color is used for the whole range
+	const vector<Color8u> &colors = mOptions.getPalette();
+	for ( int i = 0; i < kPaletteSize; i++ )
+	{
+		if ( colors.empty() )
+		{
+			mPalette[ i ] = packColor( Color8u( 255 - i, 255 - i, 255 - i ) );
+			continue;
+		}
+
+		float t = i * float( colors.size() - 1 ) / ( kPaletteSize - 1 );
+		size_t c = std::min( size_t( t ), colors.size() - 1 );
+		size_t next = std::min( c + 1, colors.size() - 1 );
+		float f = t - c;
+		Color8u color( uint8_t( colors[ c ].r + ( colors[ next ].r - colors[ c ].r ) * f + .5f ),
+					   uint8_t( colors[ c ].g + ( colors[ next ].g - colors[ c ].g ) * f + .5f ),
+					   uint8_t( colors[ c ].b + ( colors[ next ].b - colors[ c ].b ) * f + .5f ) );
+		mPalette[ i ] = packColor( color );
+	}
+}
+
+void DepthColorizer::setupTable()
+{
+	int nearClip = mOptions.getNearClip();
+	int farClip = mOptions.getFarClip();
+
+	mTable.assign( 0x10000, packColor( mOptions.getInvalidColor() ) );
+	if ( mOptions.getMode() == COLORIZE_PALETTE )
+	{
+		int range = std::max( farClip - nearClip, 1 );
+		for ( int d = nearClip; d <= farClip; d++ )
+			mTable[ d ] = mPalette[ ( d - nearClip ) * ( kPaletteSize - 1 ) / range ];
+	}
+	else
+	{
+		mHistogram.resize( farClip - nearClip + 1 );
+	}
+}
+
+// the pixels up to and including a depth divided by all pixels in range select the palette entry, as in NiViewer
+void DepthColorizer::updateHistogramTable( const uint16_t *depth, size_t count )
+{
+	int nearClip = mOptions.getNearClip();
+	int farClip = mOptions.getFarClip();
+	uint32_t *histogram = &mHistogram[ 0 ];
+
+	std::fill( mHistogram.begin(), mHistogram.end(), 0 );
+	for ( size_t i = 0; i < count; i++ )
+	{
+		int d = depth[ i ];
+		if ( ( d >= nearClip ) && ( d <= farClip ) )
+			histogram[ d - nearClip ]++;
+	}
+
+	uint32_t numPoints = 0;
+	for ( size_t i = 0; i < mHistogram.size(); i++ )
+	{
+		numPoints += histogram[ i ];
+		histogram[ i ] = numPoints;
+	}
+	if ( numPoints == 0 )
+		return;
+
+	for ( int d = nearClip; d <= farClip; d++ )
+		mTable[ d ] = mPalette[ uint64_t( histogram[ d - nearClip ] ) * ( kPaletteSize - 1 ) / numPoints ];
+}
+
+void DepthColorizer::apply( const uint16_t *depth, int width, int height, uint8_t *dst, size_t dstStride )
+{
+	if ( mTable.empty() )
+		setupTable();
+
+	if ( mOptions.getMode() == COLORIZE_HISTOGRAM )
+		updateHistogramTable( depth, size_t( width ) * height );
+
+	for ( int y = 0; y < height; y++ )
+		colorizeDepth( depth + y * width, &mTable[ 0 ], dst + y * dstStride, width );
+}
+
+} } // namespace mndl::ni
@@ -0,0 +1,113 @@
+/*
+ Copyright (c) 2012, Gabor Papp, All rights reserved.
+
+ This code is intended for use with the Cinder C++ library:
+ http://libcinder.org
+
+ Partially based on the Cinder-Kinect block:
+ https://github.com/cinder/Cinder-Kinect
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <vector>
+
+#include "cinder/Cinder.h"
+#include "cinder/Color.h"
+
+#include "CiNIKernels.h"
+
+namespace mndl { namespace ni {
+
+//! Turns millimetre depth maps into RGB visualizations through a 65536 entry lookup table, one entry per depth value.
+class DepthColorizer
+{
+	public:
+		enum Mode
+		{
+			COLORIZE_HISTOGRAM,	//!< equalizes the depth with its cumulative histogram, as NiViewer does, the table is rebuilt every frame
+			COLORIZE_PALETTE	//!< maps the clipping range linearly, the table is built once
+		};
+
+		class Options
+		{
+			public:
+				Options() : mMode( COLORIZE_HISTOGRAM ), mNearClip( 1 ), mFarClip( 10000 ), mInvalidColor( 0, 0, 0 )
+				{
+					mPalette.push_back( ci::Color8u( 255, 255, 0 ) );
+					mPalette.push_back( ci::Color8u( 0, 0, 0 ) );
+				}
+
+				Options &mode( Mode mode ) { mMode = mode; return *this; }
+				Mode getMode() const { return mMode; }
+				void setMode( Mode mode ) { mMode = mode; }
+
+				//! Sets the nearest depth in millimetres that is colorized, nearer pixels get the invalid color.
+				Options &nearClip( int nearClip ) { mNearClip = nearClip; return *this; }
+				int getNearClip() const { return mNearClip; }
+				void setNearClip( int nearClip ) { mNearClip = nearClip; }
+
+				//! Sets the farthest depth in millimetres that is colorized, farther pixels get the invalid color.
+				Options &farClip( int farClip ) { mFarClip = farClip; return *this; }
+				int getFarClip() const { return mFarClip; }
+				void setFarClip( int farClip ) { mFarClip = farClip; }
+
+				//! Sets the colors from near to far, they are interpolated evenly. Yellow to black by default, white to black if empty.
+				Options &palette( const std::vector<ci::Color8u> &colors ) { mPalette = colors; return *this; }
+				const std::vector<ci::Color8u> &getPalette() const { return mPalette; }
+				void setPalette( const std::vector<ci::Color8u> &colors ) { mPalette = colors; }
+
+				//! Sets the color of the pixels without depth or outside of the clipping range.
+				Options &invalidColor( const ci::Color8u &color ) { mInvalidColor = color; return *this; }
+				const ci::Color8u &getInvalidColor() const { return mInvalidColor; }
+				void setInvalidColor( const ci::Color8u &color ) { mInvalidColor = color; }
+
+			private:
+				Mode mMode;
+				int mNearClip, mFarClip;
+				std::vector<ci::Color8u> mPalette;
+				ci::Color8u mInvalidColor;
+		};
+
+		//! Number of colors the palette is interpolated to.
+		static const int kPaletteSize = 256;
+
+		DepthColorizer( const Options &options = Options() );
+
+		//! Colorizes \a depth, a packed millimetre depth map of \a width x \a height, to the RGB image \a dst with \a dstStride bytes between rows.
+		//! The table lookup is only vectorized in the AVX2 build, which has gathers, the SSE2 and NEON builds look up every pixel with scalar code.
+		void	apply( const uint16_t *depth, int width, int height, uint8_t *dst, size_t dstStride );
+
+		const Options	&getOptions() const { return mOptions; }
+
+	private:
+		void	setupTable();
+		void	updateHistogramTable( const uint16_t *depth, size_t count );
+
+		Options mOptions;
+		uint32_t mPalette[ kPaletteSize ];
+		std::vector<uint32_t> mTable;		//!< color per depth value, see colorizeDepth()
+		std::vector<uint32_t> mHistogram;	//!< cumulative histogram of the clipping range
+};
+
+} } // namespace mndl::ni
@@ -0,0 +1,234 @@
+/*
+ Copyright (c) 2012, Gabor Papp, All rights reserved.
+
+ This code is intended for use with the Cinder C++ library:
+ http://libcinder.org
+
+ Partially based on the Cinder-Kinect block:
+ https://github.com/cinder/Cinder-Kinect
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <string.h>
+
+#include "CiNIDepthFilter.h"
+
+using namespace std;
+
+namespace mndl { namespace ni {
+
+TemporalDepthFilter::TemporalDepthFilter( const Options &options )
+	: mOptions( options ), mWidth( 0 ), mHeight( 0 ), mHistoryIndex( 0 ), mHistoryCount( 0 )
+{
+	mOptions.setNumFrames( std::min( std::max( mOptions.getNumFrames(), 1 ), (int)kMaxMedianFrames ) );
+	mOptions.setAlpha( std::min( std::max( mOptions.getAlpha(), 0.f ), 1.f ) );
+	mOptions.setResetThreshold( std::min( std::max( mOptions.getResetThreshold(), 0 ), 0xffff ) );
+	mOptions.setHoleFrames( std::min( std::max( mOptions.getHoleFrames(), 0 ), 0xffff ) );
+}
+
+void TemporalDepthFilter::reset()
+{
+	mHistoryIndex = 0;
+	mHistoryCount = 0;
+	std::fill( mAverage.begin(), mAverage.end(), 0 );
+	std::fill( mLast.begin(), mLast.end(), 0 );
+	std::fill( mAge.begin(), mAge.end(), 0 );
+}
+
+const uint16_t *TemporalDepthFilter::apply( const uint16_t *depth, int width, int height )
+{
+	size_t count = size_t( width ) * height;
+	if ( ( width != mWidth ) || ( height != mHeight ) )
+	{
+		mWidth = width;
+		mHeight = height;
+		mHistory.assign( mOptions.getMode() == FILTER_MEDIAN ? mOptions.getNumFrames() : 0, vector<uint16_t>( count ) );
+		mAverage.assign( mOptions.getMode() == FILTER_EMA ? count : 0, 0 );
+		mLast.assign( count, 0 );
+		mAge.assign( count, 0 );
+		mFiltered.resize( count );
+		mOutput.resize( count );
+		reset();
+	}
+	if ( count == 0 )
+		return NULL;
+
+	if ( mOptions.getMode() == FILTER_MEDIAN )
+	{
+		// the new frame replaces the oldest one. The history is a copy rather than a view of the depth frame ring of OpenNI:
+		// the ring holds the converted output frames, scaled and strided, and with lazy conversion only the frames converted on demand
+		int numFrames = (int)mHistory.size();
+		std::copy( depth, depth + count, mHistory[ mHistoryIndex ].begin() );
+		mHistoryIndex = ( mHistoryIndex + 1 ) % numFrames;
+		mHistoryCount = std::min( mHistoryCount + 1, numFrames );
+
+		const uint16_t *frames[ kMaxMedianFrames ];
+		for ( int i = 0; i < mHistoryCount; i++ )
+			frames[ i ] = &mHistory[ i ][ 0 ];
+		medianDepth( frames, mHistoryCount, &mFiltered[ 0 ], count );
+	}
+	else
+	{
+		int alpha = int( mOptions.getAlpha() * 256.f + .5f );
+		emaDepth( depth, &mAverage[ 0 ], &mFiltered[ 0 ], count, alpha, (uint16_t)mOptions.getResetThreshold() );
+	}
+
+	if ( mOptions.getHoleFrames() == 0 )
+		return &mFiltered[ 0 ];
+
+	persistDepthHoles( &mFiltered[ 0 ], &mLast[ 0 ], &mAge[ 0 ], &mOutput[ 0 ], count, (uint16_t)mOptions.getHoleFrames() );
+	return &mOutput[ 0 ];
+}
+
+SpatialDepthFilter::SpatialDepthFilter( const Options &options )
+	: mOptions( options )
+{
+	mOptions.setRadius( std::min( std::max( mOptions.getRadius(), 1 ), kMaxRadius ) );
+	mOptions.setDepthTolerance( std::max( mOptions.getDepthTolerance(), 0 ) );
+	mOptions.setTileSize( std::max( mOptions.getTileSize(), 8 ) );
+
+	mWorkers = shared_ptr<WorkerPool>( new WorkerPool( mOptions.getNumThreads() ) );
+	mTask = shared_ptr<FillTask>( new FillTask() );
+
+	// gaussian falloff reaching about 10% at the edge of the neighbourhood
+	int radius = mOptions.getRadius();
+	int size = 2 * radius + 1;
+	float sigma2 = radius * radius / 2.3f;
+	mWeights.resize( size * size );
+	for ( int y = -radius; y <= radius; y++ )
+		for ( int x = -radius; x <= radius; x++ )
+			mWeights[ ( y + radius ) * size + x + radius ] = exp( -( x * x + y * y ) / ( 2.f * sigma2 ) );
+}
+
+uint16_t SpatialDepthFilter::fillPixel( const uint16_t *depth, int width, int height, int x, int y ) const
+{
+	int radius = mOptions.getRadius();
+	int size = 2 * radius + 1;
+	int x1 = std::max( x - radius, 0 );
+	int x2 = std::min( x + radius, width - 1 );
+	int y1 = std::max( y - radius, 0 );
+	int y2 = std::min( y + radius, height - 1 );
+
+	// the farthest neighbour selects the surface the hole is filled from
+	int farthest = 0;
+	for ( int ny = y1; ny <= y2; ny++ )
+	{
+		const uint16_t *row = depth + ny * width;
+		for ( int nx = x1; nx <= x2; nx++ )
+			farthest = std::max( farthest, (int)row[ nx ] );
+	}
+	if ( farthest == 0 )
+		return 0;
+
+	int nearest = farthest - mOptions.getDepthTolerance();
+	float sum = 0.f;
+	float weightSum = 0.f;
+	for ( int ny = y1; ny <= y2; ny++ )
+	{
+		const uint16_t *row = depth + ny * width;
+		const float *weights = &mWeights[ ( ny - y + radius ) * size + radius ];
+		for ( int nx = x1; nx <= x2; nx++ )
+		{
+			int d = row[ nx ];
+			if ( ( d != 0 ) && ( d >= nearest ) )
+			{
+				float w = weights[ nx - x ];
+				sum += w * d;
+				weightSum += w;
+			}
+		}
+	}
+	return (uint16_t)( sum / weightSum + .5f );
+}
+
+void SpatialDepthFilter::FillTask::run( int index )
+{
+	int tileSize = mFilter->mOptions.getTileSize();
+	int tx1 = ( index % mNumTilesX ) * tileSize;
+	int ty1 = ( index / mNumTilesX ) * tileSize;
+	int tx2 = std::min( tx1 + tileSize, mWidth );
+	int ty2 = std::min( ty1 + tileSize, mHeight );
+
+	uint32_t filled = 0;
+	for ( int y = ty1; y < ty2; y++ )
+	{
+		// holes only read the input, the tiles do not depend on each other
+		const uint16_t *src = mDepth + y * mWidth;
+		uint16_t *dst = &mFilter->mOutput[ y * mWidth ];
+		memcpy( dst + tx1, src + tx1, ( tx2 - tx1 ) * sizeof( uint16_t ) );
+		for ( int x = tx1; x < tx2; x++ )
+		{
+			if ( src[ x ] != 0 )
+				continue;
+			dst[ x ] = mFilter->fillPixel( mDepth, mWidth, mHeight, x, y );
+			if ( dst[ x ] != 0 )
+				filled++;
+		}
+	}
+	mFilledPixels[ index ] = filled;
+}
+
+const uint16_t *SpatialDepthFilter::apply( const uint16_t *depth, int width, int height )
+{
+	size_t count = size_t( width ) * height;
+	if ( count == 0 )
+		return NULL;
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+	mOutput.resize( count );
+
+	int tileSize = mOptions.getTileSize();
+	int numTilesX = ( width + tileSize - 1 ) / tileSize;
+	int numTiles = numTilesX * ( ( height + tileSize - 1 ) / tileSize );
+	mTask->mFilter = this;
+	mTask->mDepth = depth;
+	mTask->mWidth = width;
+	mTask->mHeight = height;
+	mTask->mNumTilesX = numTilesX;
+	mTask->mFilledPixels.resize( numTiles );
+	mWorkers->run( mTask.get(), numTiles );
+
+	uint32_t filled = 0;
+	for ( int i = 0; i < numTiles; i++ )
+		filled += mTask->mFilledPixels[ i ];
+
+	double elapsed = chrono::duration<double>( chrono::steady_clock::now() - start ).count();
+	lock_guard<mutex> lock( mStatsMutex );
+	mStats.numFrames++;
+	mStats.lastTime = elapsed;
+	mStats.maxTime = std::max( mStats.maxTime, elapsed );
+	mStats.totalTime += elapsed;
+	mStats.lastFilledPixels = filled;
+
+	return &mOutput[ 0 ];
+}
+
+FilterStats SpatialDepthFilter::getStats() const
+{
+	lock_guard<mutex> lock( mStatsMutex );
+	return mStats;
+}
+
+} } // namespace mndl::ni
@@ -0,0 +1,198 @@
+/*
+ Copyright (c) 2012, Gabor Papp, All rights reserved.
+
+ This code is intended for use with the Cinder C++ library:
+ http://libcinder.org
+
+ Partially based on the Cinder-Kinect block:
+ https://github.com/cinder/Cinder-Kinect
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <vector>
+
+#include "cinder/Cinder.h"
+
+#include "CiNIKernels.h"
+#include "CiNIWorkerPool.h"
+
+namespace mndl { namespace ni {
+
+//! Reduces the flicker and the holes of millimetre depth maps over consecutive frames.
+class TemporalDepthFilter
+{
+	public:
+		enum Mode
+		{
+			FILTER_MEDIAN,	//!< median of the valid depth values of the last frames
+			FILTER_EMA		//!< exponential moving average, restarted where the depth changes quickly
+		};
+
+		class Options
+		{
+			public:
+				Options() : mMode( FILTER_MEDIAN ), mNumFrames( 3 ), mAlpha( .5f ), mResetThreshold( 100 ), mHoleFrames( 2 ) {}
+
+				Options &mode( Mode mode ) { mMode = mode; return *this; }
+				Mode getMode() const { return mMode; }
+				void setMode( Mode mode ) { mMode = mode; }
+
+				//! Sets the number of frames of the median, up to kMaxMedianFrames.
+				Options &numFrames( int numFrames ) { mNumFrames = numFrames; return *this; }
+				int getNumFrames() const { return mNumFrames; }
+				void setNumFrames( int numFrames ) { mNumFrames = numFrames; }
+
+				//! Sets the weight of the new frame in the moving average, between 0 and 1.
+				Options &alpha( float alpha ) { mAlpha = alpha; return *this; }
+				float getAlpha() const { return mAlpha; }
+				void setAlpha( float alpha ) { mAlpha = alpha; }
+
+				//! Sets the depth change in millimetres that is treated as motion and restarts the moving average of a pixel.
+				Options &resetThreshold( int threshold ) { mResetThreshold = threshold; return *this; }
+				int getResetThreshold() const { return mResetThreshold; }
+				void setResetThreshold( int threshold ) { mResetThreshold = threshold; }
+
+				//! Sets the number of frames a pixel keeps its last depth after it becomes invalid, 0 disables hole persistence.
+				Options &holeFrames( int frames ) { mHoleFrames = frames; return *this; }
+				int getHoleFrames() const { return mHoleFrames; }
+				void setHoleFrames( int frames ) { mHoleFrames = frames; }
+
+			private:
+				Mode mMode;
+				int mNumFrames;
+				float mAlpha;
+				int mResetThreshold;
+				int mHoleFrames;
+		};
+
+		TemporalDepthFilter( const Options &options = Options() );
+
+		//! Filters \a depth, a packed millimetre depth map of \a width x \a height. Returns the packed result, which stays valid until the next call.
+		//! The history is cleared when the size changes.
+		const uint16_t	*apply( const uint16_t *depth, int width, int height );
+		//! Clears the history.
+		void			reset();
+
+		const Options	&getOptions() const { return mOptions; }
+
+	private:
+		Options mOptions;
+		int mWidth, mHeight;
+
+		//! the last frames for the median, mHistory[ mHistoryIndex ] is the oldest
+		std::vector< std::vector<uint16_t> > mHistory;
+		int mHistoryIndex, mHistoryCount;
+		std::vector<uint16_t> mAverage;		//!< state of the moving average
+		std::vector<uint16_t> mLast, mAge;	//!< state of the hole persistence
+		std::vector<uint16_t> mFiltered, mOutput;
+};
+
+//! Time spent in a filter.
+struct FilterStats
+{
+	FilterStats() : numFrames( 0 ), lastTime( 0 ), maxTime( 0 ), totalTime( 0 ), lastFilledPixels( 0 ) {}
+
+	uint32_t numFrames;			//!< number of frames filtered
+	double lastTime;			//!< seconds spent on the last frame
+	double maxTime;				//!< longest time spent on a frame in seconds
+	double totalTime;			//!< seconds spent in total
+	uint32_t lastFilledPixels;	//!< number of holes filled in the last frame
+};
+
+//! Fills the holes of single millimetre depth maps without blurring depth edges. A hole is filled with the weighted average of the valid
+//! pixels in its neighbourhood that lie on the farthest surface, within a tolerance of the farthest depth. The holes of structured light
+//! sensors are mostly in the shadow of foreground objects, so they belong to the background, and foreground pixels are left out.
+//! The frame is split into tiles processed in parallel.
+class SpatialDepthFilter
+{
+	public:
+		class Options
+		{
+			public:
+				Options() : mRadius( 2 ), mDepthTolerance( 50 ), mTileSize( 64 ), mNumThreads( 0 ) {}
+
+				//! Sets the radius of the neighbourhood in pixels, up to kMaxRadius.
+				Options &radius( int radius ) { mRadius = radius; return *this; }
+				int getRadius() const { return mRadius; }
+				void setRadius( int radius ) { mRadius = radius; }
+
+				//! Sets the depth range in millimetres behind the farthest neighbour the averaged neighbours have to be in.
+				Options &depthTolerance( int tolerance ) { mDepthTolerance = tolerance; return *this; }
+				int getDepthTolerance() const { return mDepthTolerance; }
+				void setDepthTolerance( int tolerance ) { mDepthTolerance = tolerance; }
+
+				//! Sets the width and height of the tiles in pixels.
+				Options &tileSize( int size ) { mTileSize = size; return *this; }
+				int getTileSize() const { return mTileSize; }
+				void setTileSize( int size ) { mTileSize = size; }
+
+				//! Sets the number of threads the tiles are processed on, 0 uses the number of hardware threads.
+				Options &numThreads( int numThreads ) { mNumThreads = numThreads; return *this; }
+				int getNumThreads() const { return mNumThreads; }
+				void setNumThreads( int numThreads ) { mNumThreads = numThreads; }
+
+			private:
+				int mRadius;
+				int mDepthTolerance;
+				int mTileSize;
+				int mNumThreads;
+		};
+
+		static const int kMaxRadius = 7;
+
+		SpatialDepthFilter( const Options &options = Options() );
+
+		//! Fills the holes of \a depth, a packed millimetre depth map of \a width x \a height. Returns the packed result, which stays valid until the next call.
+		const uint16_t	*apply( const uint16_t *depth, int width, int height );
+
+		const Options	&getOptions() const { return mOptions; }
+		//! Returns the timing of the fill, it can be called while apply() is running on another thread.
+		FilterStats		getStats() const;
+
+	private:
+		class FillTask : public WorkerPool::Task
+		{
+			public:
+				FillTask() : mFilter( NULL ), mDepth( NULL ), mWidth( 0 ), mHeight( 0 ), mNumTilesX( 0 ) {}
+				void run( int index );
+
+				SpatialDepthFilter *mFilter;
+				const uint16_t *mDepth;
+				int mWidth, mHeight;
+				int mNumTilesX;
+				std::vector<uint32_t> mFilledPixels;	//!< per tile
+		};
+
+		uint16_t	fillPixel( const uint16_t *depth, int width, int height, int x, int y ) const;
+
+		Options mOptions;
+		std::shared_ptr<WorkerPool> mWorkers;
+		std::shared_ptr<FillTask> mTask;
+		std::vector<float> mWeights;	//!< spatial weights of the neighbourhood
+		std::vector<uint16_t> mOutput;
+		mutable std::mutex mStatsMutex;
+		FilterStats mStats;
+};
+
+} } // namespace mndl::ni
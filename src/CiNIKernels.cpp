@@ -0,0 +1,1229 @@
+/*
+ Copyright (c) 2012, Gabor Papp, All rights reserved.
+
+ This code is intended for use with the Cinder C++ library:
+ http://libcinder.org
+
+ Partially based on the Cinder-Kinect block:
+ https://github.com/cinder/Cinder-Kinect
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+
+#include "CiNIKernels.h"
+
+#if defined( __AVX2__ )
+#define CINI_AVX2 1
+#include <immintrin.h>
+#endif
+
+#if defined( __SSE2__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && ( _M_IX86_FP >= 2 ) )
+#define CINI_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#if defined( __ARM_NEON__ ) || defined( __ARM_NEON )
+#define CINI_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace mndl { namespace ni {
+
+const char *getKernelInstructionSet()
+{
+#if defined( CINI_AVX2 )
+	return "AVX2";
+#elif defined( CINI_SSE2 )
+	return "SSE2";
+#elif defined( CINI_NEON )
+	return "NEON";
+#else
+	return "scalar";
+#endif
+}
+
+void scaleDepthScalar( const uint16_t *src, uint16_t *dst, size_t count, uint32_t scale )
+{
+	for ( size_t i = 0; i < count; i++ )
+	{
+		uint32_t v = src[ i ];
+		dst[ i ] = ( scale * v ) >> 16;
+	}
+}
+
+// ( scale * v ) >> 16 truncated to 16 bits is ( scaleHi * v + ( ( scaleLo * v ) >> 16 ) ) mod 2^16,
+// which only needs 16-bit multiplies
+void scaleDepth( const uint16_t *src, uint16_t *dst, size_t count, uint32_t scale )
+{
+	size_t i = 0;
+
+#if defined( CINI_AVX2 )
+	__m256i hi = _mm256_set1_epi16( (short)( scale >> 16 ) );
+	__m256i lo = _mm256_set1_epi16( (short)( scale & 0xffff ) );
+	for ( ; i + 16 <= count; i += 16 )
+	{
+		__m256i v = _mm256_loadu_si256( reinterpret_cast< const __m256i * >( src + i ) );
+		__m256i r = _mm256_add_epi16( _mm256_mullo_epi16( v, hi ), _mm256_mulhi_epu16( v, lo ) );
+		_mm256_storeu_si256( reinterpret_cast< __m256i * >( dst + i ), r );
+	}
+#elif defined( CINI_SSE2 )
+	__m128i hi = _mm_set1_epi16( (short)( scale >> 16 ) );
+	__m128i lo = _mm_set1_epi16( (short)( scale & 0xffff ) );
+	for ( ; i + 8 <= count; i += 8 )
+	{
+		__m128i v = _mm_loadu_si128( reinterpret_cast< const __m128i * >( src + i ) );
+		__m128i r = _mm_add_epi16( _mm_mullo_epi16( v, hi ), _mm_mulhi_epu16( v, lo ) );
+		_mm_storeu_si128( reinterpret_cast< __m128i * >( dst + i ), r );
+	}
+#elif defined( CINI_NEON )
+	uint16x8_t hi = vdupq_n_u16( scale >> 16 );
+	uint16x4_t lo = vdup_n_u16( scale & 0xffff );
+	for ( ; i + 8 <= count; i += 8 )
+	{
+		uint16x8_t v = vld1q_u16( src + i );
+		uint16x4_t mulhiLow = vshrn_n_u32( vmull_u16( vget_low_u16( v ), lo ), 16 );
+		uint16x4_t mulhiHigh = vshrn_n_u32( vmull_u16( vget_high_u16( v ), lo ), 16 );
+		uint16x8_t r = vaddq_u16( vmulq_u16( v, hi ), vcombine_u16( mulhiLow, mulhiHigh ) );
+		vst1q_u16( dst + i, r );
+	}
+#endif
+
+#if ! defined( NDEBUG )
+	// debug builds check the vector path against the scalar arithmetic
+	if ( src != dst )
+	{
+		for ( size_t j = 0; j < i; j++ )
+			assert( dst[ j ] == uint16_t( ( scale * src[ j ] ) >> 16 ) );
+	}
+#endif
+
+	scaleDepthScalar( src + i, dst + i, count - i, scale );
+}
+
+void convertDepthMultiScalar( const uint16_t *src, uint16_t *dst16, uint32_t scale, uint8_t *dst8, uint8_t *mask, uint16_t nearClip, uint16_t farClip, uint32_t windowScale, size_t count )
+{
+	// 0 is a hole, never in range
+	nearClip = std::max( nearClip, (uint16_t)1 );
+	for ( size_t i = 0; i < count; i++ )
+	{
+		uint32_t v = src[ i ];
+		if ( dst16 )
+			dst16[ i ] = ( scale * v ) >> 16;
+
+		bool inRange = ( v >= nearClip ) && ( v <= farClip );
+		if ( dst8 )
+			dst8[ i ] = inRange ? 255 - ( ( ( v - nearClip ) * windowScale ) >> 16 ) : 0;
+		if ( mask )
+			mask[ i ] = inRange ? 255 : 0;
+	}
+}
+
+// the scaled outputs use the 16-bit multiply split of scaleDepth()
+void convertDepthMulti( const uint16_t *src, uint16_t *dst16, uint32_t scale, uint8_t *dst8, uint8_t *mask, uint16_t nearClip, uint16_t farClip, uint32_t windowScale, size_t count )
+{
+	size_t i = 0;
+	nearClip = std::max( nearClip, (uint16_t)1 );
+
+#if defined( CINI_SSE2 )
+	__m128i hi = _mm_set1_epi16( (short)( scale >> 16 ) );
+	__m128i lo = _mm_set1_epi16( (short)( scale & 0xffff ) );
+	__m128i windowHi = _mm_set1_epi16( (short)( windowScale >> 16 ) );
+	__m128i windowLo = _mm_set1_epi16( (short)( windowScale & 0xffff ) );
+	__m128i bias = _mm_set1_epi16( (short)0x8000 );
+	__m128i nearBiased = _mm_set1_epi16( (short)( nearClip ^ 0x8000 ) );
+	__m128i farBiased = _mm_set1_epi16( (short)( farClip ^ 0x8000 ) );
+	__m128i nearV = _mm_set1_epi16( (short)nearClip );
+	__m128i white = _mm_set1_epi16( 255 );
+	for ( ; i + 8 <= count; i += 8 )
+	{
+		__m128i v = _mm_loadu_si128( reinterpret_cast< const __m128i * >( src + i ) );
+		if ( dst16 )
+		{
+			__m128i r = _mm_add_epi16( _mm_mullo_epi16( v, hi ), _mm_mulhi_epu16( v, lo ) );
+			_mm_storeu_si128( reinterpret_cast< __m128i * >( dst16 + i ), r );
+		}
+		if ( ( dst8 == NULL ) && ( mask == NULL ) )
+			continue;
+
+		// unsigned range test on biased signed words
+		__m128i vBiased = _mm_xor_si128( v, bias );
+		__m128i outside = _mm_or_si128( _mm_cmplt_epi16( vBiased, nearBiased ), _mm_cmpgt_epi16( vBiased, farBiased ) );
+		if ( dst8 )
+		{
+			__m128i d = _mm_sub_epi16( v, nearV );
+			__m128i t = _mm_add_epi16( _mm_mullo_epi16( d, windowHi ), _mm_mulhi_epu16( d, windowLo ) );
+			__m128i w = _mm_andnot_si128( outside, _mm_sub_epi16( white, t ) );
+			_mm_storel_epi64( reinterpret_cast< __m128i * >( dst8 + i ), _mm_packus_epi16( w, w ) );
+		}
+		if ( mask )
+		{
+			__m128i m = _mm_andnot_si128( outside, white );
+			_mm_storel_epi64( reinterpret_cast< __m128i * >( mask + i ), _mm_packus_epi16( m, m ) );
+		}
+	}
+#elif defined( CINI_NEON )
+	uint16x8_t hi = vdupq_n_u16( scale >> 16 );
+	uint16x4_t lo = vdup_n_u16( scale & 0xffff );
+	uint16x8_t windowHi = vdupq_n_u16( windowScale >> 16 );
+	uint16x4_t windowLo = vdup_n_u16( windowScale & 0xffff );
+	uint16x8_t nearV = vdupq_n_u16( nearClip );
+	uint16x8_t farV = vdupq_n_u16( farClip );
+	uint16x8_t white = vdupq_n_u16( 255 );
+	for ( ; i + 8 <= count; i += 8 )
+	{
+		uint16x8_t v = vld1q_u16( src + i );
+		if ( dst16 )
+		{
+			uint16x4_t mulhiLow = vshrn_n_u32( vmull_u16( vget_low_u16( v ), lo ), 16 );
+			uint16x4_t mulhiHigh = vshrn_n_u32( vmull_u16( vget_high_u16( v ), lo ), 16 );
+			vst1q_u16( dst16 + i, vaddq_u16( vmulq_u16( v, hi ), vcombine_u16( mulhiLow, mulhiHigh ) ) );
+		}
+		if ( ( dst8 == NULL ) && ( mask == NULL ) )
+			continue;
+
+		uint16x8_t inside = vandq_u16( vcgeq_u16( v, nearV ), vcleq_u16( v, farV ) );
+		if ( dst8 )
+		{
+			uint16x8_t d = vsubq_u16( v, nearV );
+			uint16x4_t mulhiLow = vshrn_n_u32( vmull_u16( vget_low_u16( d ), windowLo ), 16 );
+			uint16x4_t mulhiHigh = vshrn_n_u32( vmull_u16( vget_high_u16( d ), windowLo ), 16 );
+			uint16x8_t t = vaddq_u16( vmulq_u16( d, windowHi ), vcombine_u16( mulhiLow, mulhiHigh ) );
+			vst1_u8( dst8 + i, vmovn_u16( vandq_u16( inside, vsubq_u16( white, t ) ) ) );
+		}
+		if ( mask )
+			vst1_u8( mask + i, vmovn_u16( vandq_u16( inside, white ) ) );
+	}
+#endif
+
+	convertDepthMultiScalar( src + i, dst16 ? dst16 + i : NULL, scale, dst8 ? dst8 + i : NULL, mask ? mask + i : NULL, nearClip, farClip, windowScale, count - i );
+}
+
+void convertIRScalar( const uint16_t *src, uint8_t *dst, size_t count )
+{
+	for ( size_t i = 0; i < count; i++ )
+		dst[ i ] = src[ i ] / 4;
+}
+
+void convertIR( const uint16_t *src, uint8_t *dst, size_t count )
+{
+	size_t i = 0;
+
+#if defined( CINI_AVX2 )
+	__m256i lowByte = _mm256_set1_epi16( 0xff );
+	for ( ; i + 32 <= count; i += 32 )
+	{
+		__m256i v0 = _mm256_loadu_si256( reinterpret_cast< const __m256i * >( src + i ) );
+		__m256i v1 = _mm256_loadu_si256( reinterpret_cast< const __m256i * >( src + i + 16 ) );
+		// mask before packing, so the saturation of packus matches the scalar truncation
+		v0 = _mm256_and_si256( _mm256_srli_epi16( v0, 2 ), lowByte );
+		v1 = _mm256_and_si256( _mm256_srli_epi16( v1, 2 ), lowByte );
+		// packus works within 128-bit lanes, restore the order of the 64-bit quarters
+		__m256i r = _mm256_permute4x64_epi64( _mm256_packus_epi16( v0, v1 ), _MM_SHUFFLE( 3, 1, 2, 0 ) );
+		_mm256_storeu_si256( reinterpret_cast< __m256i * >( dst + i ), r );
+	}
+#elif defined( CINI_SSE2 )
+	__m128i lowByte = _mm_set1_epi16( 0xff );
+	for ( ; i + 16 <= count; i += 16 )
+	{
+		__m128i v0 = _mm_loadu_si128( reinterpret_cast< const __m128i * >( src + i ) );
+		__m128i v1 = _mm_loadu_si128( reinterpret_cast< const __m128i * >( src + i + 8 ) );
+		// mask before packing, so the saturation of packus matches the scalar truncation
+		v0 = _mm_and_si128( _mm_srli_epi16( v0, 2 ), lowByte );
+		v1 = _mm_and_si128( _mm_srli_epi16( v1, 2 ), lowByte );
+		_mm_storeu_si128( reinterpret_cast< __m128i * >( dst + i ), _mm_packus_epi16( v0, v1 ) );
+	}
+#elif defined( CINI_NEON )
+	for ( ; i + 16 <= count; i += 16 )
+	{
+		uint8x8_t r0 = vmovn_u16( vshrq_n_u16( vld1q_u16( src + i ), 2 ) );
+		uint8x8_t r1 = vmovn_u16( vshrq_n_u16( vld1q_u16( src + i + 8 ), 2 ) );
+		vst1q_u8( dst + i, vcombine_u8( r0, r1 ) );
+	}
+#endif
+
+	convertIRScalar( src + i, dst + i, count - i );
+}
+
+static void splitUserLabelsTail( const uint16_t *labels, uint8_t *labelMap, uint8_t * const *bitMasks, size_t byteOffset, const uint16_t *userIds, size_t numUsers, size_t count )
+{
+	for ( size_t b = 0; b < count; b += 8 )
+	{
+		size_t n = std::min< size_t >( 8, count - b );
+		size_t byteIndex = byteOffset + b / 8;
+
+		uint8_t all = 0;
+		for ( size_t k = 0; k < n; k++ )
+		{
+			labelMap[ b + k ] = labels[ b + k ] & 255;
+			if ( labels[ b + k ] != 0 )
+				all |= 1 << k;
+		}
+		bitMasks[ 0 ][ byteIndex ] = all;
+
+		for ( size_t u = 0; u < numUsers; u++ )
+		{
+			uint8_t bits = 0;
+			for ( size_t k = 0; k < n; k++ )
+			{
+				if ( labels[ b + k ] == userIds[ u ] )
+					bits |= 1 << k;
+			}
+			bitMasks[ u + 1 ][ byteIndex ] = bits;
+		}
+	}
+}
+
+void splitUserLabelsScalar( const uint16_t *labels, uint8_t *labelMap, uint8_t * const *bitMasks, const uint16_t *userIds, size_t numUsers, size_t count )
+{
+	splitUserLabelsTail( labels, labelMap, bitMasks, 0, userIds, numUsers, count );
+}
+
+void splitUserLabels( const uint16_t *labels, uint8_t *labelMap, uint8_t * const *bitMasks, const uint16_t *userIds, size_t numUsers, size_t count )
+{
+	size_t i = 0;
+
+#if defined( CINI_SSE2 )
+	__m128i lowByte = _mm_set1_epi16( 0xff );
+	__m128i zero = _mm_setzero_si128();
+	__m128i ids[ kMaxUserMasks ];
+	for ( size_t u = 0; u < numUsers; u++ )
+		ids[ u ] = _mm_set1_epi16( (short)userIds[ u ] );
+
+	for ( ; i + 16 <= count; i += 16 )
+	{
+		__m128i v0 = _mm_loadu_si128( reinterpret_cast< const __m128i * >( labels + i ) );
+		__m128i v1 = _mm_loadu_si128( reinterpret_cast< const __m128i * >( labels + i + 8 ) );
+		_mm_storeu_si128( reinterpret_cast< __m128i * >( labelMap + i ),
+				_mm_packus_epi16( _mm_and_si128( v0, lowByte ), _mm_and_si128( v1, lowByte ) ) );
+
+		// labels are compared with 16 bits, packing the 0 / 0xffff results gives one byte per pixel for movemask
+		int bits = ~_mm_movemask_epi8( _mm_packs_epi16( _mm_cmpeq_epi16( v0, zero ), _mm_cmpeq_epi16( v1, zero ) ) );
+		bitMasks[ 0 ][ i / 8 ] = bits & 255;
+		bitMasks[ 0 ][ i / 8 + 1 ] = ( bits >> 8 ) & 255;
+
+		for ( size_t u = 0; u < numUsers; u++ )
+		{
+			bits = _mm_movemask_epi8( _mm_packs_epi16( _mm_cmpeq_epi16( v0, ids[ u ] ), _mm_cmpeq_epi16( v1, ids[ u ] ) ) );
+			bitMasks[ u + 1 ][ i / 8 ] = bits & 255;
+			bitMasks[ u + 1 ][ i / 8 + 1 ] = bits >> 8;
+		}
+	}
+#elif defined( CINI_NEON )
+	static const uint8_t kBitWeights[ 16 ] = { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+	uint8x16_t weights = vld1q_u8( kBitWeights );
+	uint16x8_t zero = vdupq_n_u16( 0 );
+
+	for ( ; i + 16 <= count; i += 16 )
+	{
+		uint16x8_t v0 = vld1q_u16( labels + i );
+		uint16x8_t v1 = vld1q_u16( labels + i + 8 );
+		vst1q_u8( labelMap + i, vcombine_u8( vmovn_u16( v0 ), vmovn_u16( v1 ) ) );
+
+		for ( size_t u = 0; u <= numUsers; u++ )
+		{
+			uint8x16_t m;
+			if ( u == 0 )
+				m = vmvnq_u8( vcombine_u8( vmovn_u16( vceqq_u16( v0, zero ) ), vmovn_u16( vceqq_u16( v1, zero ) ) ) );
+			else
+			{
+				uint16x8_t id = vdupq_n_u16( userIds[ u - 1 ] );
+				m = vcombine_u8( vmovn_u16( vceqq_u16( v0, id ) ), vmovn_u16( vceqq_u16( v1, id ) ) );
+			}
+			// sum the bit weights of each half with pairwise adds, lane 0 and 1 hold the two mask bytes
+			uint8x16_t w = vandq_u8( m, weights );
+			uint8x8_t sum = vpadd_u8( vget_low_u8( w ), vget_high_u8( w ) );
+			sum = vpadd_u8( sum, sum );
+			sum = vpadd_u8( sum, sum );
+			bitMasks[ u ][ i / 8 ] = vget_lane_u8( sum, 0 );
+			bitMasks[ u ][ i / 8 + 1 ] = vget_lane_u8( sum, 1 );
+		}
+	}
+#endif
+
+	splitUserLabelsTail( labels + i, labelMap + i, bitMasks, i / 8, userIds, numUsers, count - i );
+}
+
+void maskUserLabelsScalar( const uint8_t *labelMap, uint8_t *dst, size_t count, uint8_t userId, bool fillWithUserId )
+{
+	for ( size_t i = 0; i < count; i++ )
+	{
+		uint8_t label = labelMap[ i ];
+		bool masked = ( userId == 0 ) ? ( label != 0 ) : ( label == userId );
+		dst[ i ] = masked ? ( fillWithUserId ? label : 255 ) : 0;
+	}
+}
+
+void maskUserLabels( const uint8_t *labelMap, uint8_t *dst, size_t count, uint8_t userId, bool fillWithUserId )
+{
+	size_t i = 0;
+
+#if defined( CINI_SSE2 )
+	__m128i zero = _mm_setzero_si128();
+	__m128i id = _mm_set1_epi8( (char)userId );
+	for ( ; i + 16 <= count; i += 16 )
+	{
+		__m128i v = _mm_loadu_si128( reinterpret_cast< const __m128i * >( labelMap + i ) );
+		__m128i m;
+		if ( userId == 0 )
+			m = _mm_xor_si128( _mm_cmpeq_epi8( v, zero ), _mm_set1_epi8( -1 ) );
+		else
+			m = _mm_cmpeq_epi8( v, id );
+		if ( fillWithUserId )
+			m = _mm_and_si128( m, v );
+		_mm_storeu_si128( reinterpret_cast< __m128i * >( dst + i ), m );
+	}
+#elif defined( CINI_NEON )
+	uint8x16_t id = vdupq_n_u8( userId );
+	for ( ; i + 16 <= count; i += 16 )
+	{
+		uint8x16_t v = vld1q_u8( labelMap + i );
+		uint8x16_t m = ( userId == 0 ) ? vtstq_u8( v, v ) : vceqq_u8( v, id );
+		if ( fillWithUserId )
+			m = vandq_u8( m, v );
+		vst1q_u8( dst + i, m );
+	}
+#endif
+
+	maskUserLabelsScalar( labelMap + i, dst + i, count - i, userId, fillWithUserId );
+}
+
+static inline uint32_t popCount8( uint32_t v )
+{
+	v = v - ( ( v >> 1 ) & 0x55 );
+	v = ( v & 0x33 ) + ( ( v >> 2 ) & 0x33 );
+	return ( v + ( v >> 4 ) ) & 0x0f;
+}
+
+// adds the bits of the mask byte \a v of the pixels from \a x on to the pixel count, position sum and range, the depth is left to the caller
+static inline uint32_t accumulateMaskByte( uint32_t v, int32_t x, uint64_t *sumX, int32_t *minX, int32_t *maxX )
+{
+	// inside a user every pixel is set
+	if ( v == 0xff )
+	{
+		*sumX += uint64_t( x ) * 8 + 28;
+		*minX = std::min( *minX, x );
+		*maxX = std::max( *maxX, x + 7 );
+		return 8;
+	}
+
+	// the positions within the byte add up bit by bit, each bit of a position is set for half of the pixels
+	uint32_t n = popCount8( v );
+	*sumX += uint64_t( n ) * x + popCount8( v & 0xaa ) + 2 * popCount8( v & 0xcc ) + 4 * popCount8( v & 0xf0 );
+	if ( x < *minX )
+	{
+		int k = 0;
+		while ( ( ( v >> k ) & 1 ) == 0 )
+			k++;
+		*minX = std::min( *minX, x + k );
+	}
+	if ( x + 7 > *maxX )
+	{
+		int k = 7;
+		while ( ( ( v >> k ) & 1 ) == 0 )
+			k--;
+		*maxX = std::max( *maxX, x + k );
+	}
+	return n;
+}
+
+static inline bool isZero64( const uint8_t *bytes )
+{
+	uint64_t v;
+	memcpy( &v, bytes, sizeof( v ) );
+	return v == 0;
+}
+
+static uint32_t accumulateMaskRowTail( const uint8_t *bits, const uint16_t *depth, size_t firstByte, size_t count, uint64_t *sumX, int32_t *minX, int32_t *maxX, uint16_t *minDepth, uint16_t *maxDepth )
+{
+	uint32_t n = 0;
+	for ( size_t b = firstByte; b * 8 < count; b++ )
+	{
+		uint32_t v = bits[ b ];
+		if ( v == 0 )
+			continue;
+		n += accumulateMaskByte( v, int32_t( b * 8 ), sumX, minX, maxX );
+		for ( int k = 0; v != 0; k++, v >>= 1 )
+		{
+			uint16_t z = depth[ b * 8 + k ];
+			if ( ( ( v & 1 ) == 0 ) || ( z == 0 ) )
+				continue;
+			*minDepth = std::min( *minDepth, z );
+			*maxDepth = std::max( *maxDepth, z );
+		}
+	}
+	return n;
+}
+
+uint32_t accumulateMaskRowScalar( const uint8_t *bits, const uint16_t *depth, size_t count, uint64_t *sumX, int32_t *minX, int32_t *maxX, uint16_t *minDepth, uint16_t *maxDepth )
+{
+	return accumulateMaskRowTail( bits, depth, 0, count, sumX, minX, maxX, minDepth, maxDepth );
+}
+
+// the mask byte of 8 pixels is broadcast to 8 lanes and tested against the bit of each lane, the masked depth is folded into
+// lane-wise minimums and maximums, which are reduced once per row
+uint32_t accumulateMaskRow( const uint8_t *bits, const uint16_t *depth, size_t count, uint64_t *sumX, int32_t *minX, int32_t *maxX, uint16_t *minDepth, uint16_t *maxDepth )
+{
+	size_t b = 0;
+	uint32_t n = 0;
+
+#if defined( CINI_SSE2 )
+	// SSE2 only has signed word minimums and maximums, the bias maps the unsigned order to the signed one
+	__m128i select = _mm_setr_epi16( 1, 2, 4, 8, 16, 32, 64, 128 );
+	__m128i zero = _mm_setzero_si128();
+	__m128i bias = _mm_set1_epi16( (short)0x8000 );
+	__m128i high = _mm_set1_epi16( 0x7fff );
+	__m128i vMin = high;
+	__m128i vMax = bias;
+	for ( ; b * 8 + 8 <= count; b++ )
+	{
+		// users cover a small part of a row, empty runs are skipped eight mask bytes at a time
+		if ( ( b * 8 + 64 <= count ) && isZero64( bits + b ) )
+		{
+			b += 7;
+			continue;
+		}
+		uint32_t v = bits[ b ];
+		if ( v == 0 )
+			continue;
+		n += accumulateMaskByte( v, int32_t( b * 8 ), sumX, minX, maxX );
+
+		__m128i d = _mm_loadu_si128( reinterpret_cast< const __m128i * >( depth + b * 8 ) );
+		__m128i m = _mm_cmpeq_epi16( _mm_and_si128( _mm_set1_epi16( (short)v ), select ), select );
+		m = _mm_andnot_si128( _mm_cmpeq_epi16( d, zero ), m );
+		d = _mm_xor_si128( d, bias );
+		vMin = _mm_min_epi16( vMin, _mm_or_si128( _mm_and_si128( m, d ), _mm_andnot_si128( m, high ) ) );
+		vMax = _mm_max_epi16( vMax, _mm_or_si128( _mm_and_si128( m, d ), _mm_andnot_si128( m, bias ) ) );
+	}
+	if ( n > 0 )
+	{
+		uint16_t mins[ 8 ], maxs[ 8 ];
+		_mm_storeu_si128( reinterpret_cast< __m128i * >( mins ), _mm_xor_si128( vMin, bias ) );
+		_mm_storeu_si128( reinterpret_cast< __m128i * >( maxs ), _mm_xor_si128( vMax, bias ) );
+		for ( int i = 0; i < 8; i++ )
+		{
+			*minDepth = std::min( *minDepth, mins[ i ] );
+			*maxDepth = std::max( *maxDepth, maxs[ i ] );
+		}
+	}
+#elif defined( CINI_NEON )
+	static const uint16_t kSelect[ 8 ] = { 1, 2, 4, 8, 16, 32, 64, 128 };
+	uint16x8_t select = vld1q_u16( kSelect );
+	uint16x8_t vMin = vdupq_n_u16( 0xffff );
+	uint16x8_t vMax = vdupq_n_u16( 0 );
+	for ( ; b * 8 + 8 <= count; b++ )
+	{
+		if ( ( b * 8 + 64 <= count ) && isZero64( bits + b ) )
+		{
+			b += 7;
+			continue;
+		}
+		uint32_t v = bits[ b ];
+		if ( v == 0 )
+			continue;
+		n += accumulateMaskByte( v, int32_t( b * 8 ), sumX, minX, maxX );
+
+		uint16x8_t d = vld1q_u16( depth + b * 8 );
+		uint16x8_t m = vandq_u16( vtstq_u16( vdupq_n_u16( (uint16_t)v ), select ), vtstq_u16( d, d ) );
+		vMin = vminq_u16( vMin, vbslq_u16( m, d, vdupq_n_u16( 0xffff ) ) );
+		vMax = vmaxq_u16( vMax, vandq_u16( m, d ) );
+	}
+	if ( n > 0 )
+	{
+		uint16_t mins[ 8 ], maxs[ 8 ];
+		vst1q_u16( mins, vMin );
+		vst1q_u16( maxs, vMax );
+		for ( int i = 0; i < 8; i++ )
+		{
+			*minDepth = std::min( *minDepth, mins[ i ] );
+			*maxDepth = std::max( *maxDepth, maxs[ i ] );
+		}
+	}
+#endif
+
+	return n + accumulateMaskRowTail( bits, depth, b, count, sumX, minX, maxX, minDepth, maxDepth );
+}
+
+void expandBitMaskScalar( const uint8_t *bits, uint8_t *dst, size_t count, uint8_t value )
+{
+	for ( size_t i = 0; i < count; i++ )
+		dst[ i ] = ( ( bits[ i >> 3 ] >> ( i & 7 ) ) & 1 ) ? value : 0;
+}
+
+void expandBitMask( const uint8_t *bits, uint8_t *dst, size_t count, uint8_t value )
+{
+	size_t i = 0;
+
+	// two mask bytes are broadcast to the low and high half of a vector and tested against the bit of each lane
+#if defined( CINI_SSE2 )
+	__m128i select = _mm_setr_epi8( 1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128 );
+	__m128i fill = _mm_set1_epi8( (char)value );
+	for ( ; i + 16 <= count; i += 16 )
+	{
+		__m128i v = _mm_unpacklo_epi64( _mm_set1_epi8( (char)bits[ i >> 3 ] ), _mm_set1_epi8( (char)bits[ ( i >> 3 ) + 1 ] ) );
+		__m128i m = _mm_cmpeq_epi8( _mm_and_si128( v, select ), select );
+		_mm_storeu_si128( reinterpret_cast< __m128i * >( dst + i ), _mm_and_si128( m, fill ) );
+	}
+#elif defined( CINI_NEON )
+	static const uint8_t kSelect[ 16 ] = { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+	uint8x16_t select = vld1q_u8( kSelect );
+	uint8x16_t fill = vdupq_n_u8( value );
+	for ( ; i + 16 <= count; i += 16 )
+	{
+		uint8x16_t v = vcombine_u8( vdup_n_u8( bits[ i >> 3 ] ), vdup_n_u8( bits[ ( i >> 3 ) + 1 ] ) );
+		vst1q_u8( dst + i, vandq_u8( vtstq_u8( v, select ), fill ) );
+	}
+#endif
+
+	expandBitMaskScalar( bits + ( i >> 3 ), dst + i, count - i, value );
+}
+
+size_t projectDepthScalar( const uint16_t *depth, size_t step, const float *rayX, float rayY, float zScale, float *x, float *y, float *z, size_t count, bool compact )
+{
+	size_t n = 0;
+	for ( size_t i = 0; i < count; i++ )
+	{
+		uint16_t d = depth[ i * step ];
+		if ( compact && ( d == 0 ) )
+			continue;
+		float pz = d * zScale;
+		x[ n ] = rayX[ i ] * pz;
+		y[ n ] = rayY * pz;
+		z[ n ] = pz;
+		n++;
+	}
+	return n;
+}
+
+size_t projectDepthInterleavedScalar( const uint16_t *depth, size_t step, const float *rayX, float rayY, float zScale, float *xyz, size_t count, bool compact )
+{
+	size_t n = 0;
+	for ( size_t i = 0; i < count; i++ )
+	{
+		uint16_t d = depth[ i * step ];
+		if ( compact && ( d == 0 ) )
+			continue;
+		float pz = d * zScale;
+		xyz[ n * 3 ] = rayX[ i ] * pz;
+		xyz[ n * 3 + 1 ] = rayY * pz;
+		xyz[ n * 3 + 2 ] = pz;
+		n++;
+	}
+	return n;
+}
+
+// the float math is 128 bits wide on every instruction set, the AVX2 build uses the SSE2 path
+size_t projectDepth( const uint16_t *depth, size_t step, const float *rayX, float rayY, float zScale, float *x, float *y, float *z, size_t count, bool compact )
+{
+	size_t i = 0;
+	size_t n = 0;
+
+	if ( step == 1 )
+	{
+#if defined( CINI_SSE2 )
+		__m128i zero = _mm_setzero_si128();
+		__m128 vRayY = _mm_set1_ps( rayY );
+		__m128 vScale = _mm_set1_ps( zScale );
+		for ( ; i + 4 <= count; i += 4 )
+		{
+			__m128i d = _mm_unpacklo_epi16( _mm_loadl_epi64( reinterpret_cast< const __m128i * >( depth + i ) ), zero );
+			int zeroMask = compact ? _mm_movemask_epi8( _mm_cmpeq_epi32( d, zero ) ) : 0;
+			if ( zeroMask == 0xffff )
+				continue;
+			if ( zeroMask != 0 )
+			{
+				n += projectDepthScalar( depth + i, 1, rayX + i, rayY, zScale, x + n, y + n, z + n, 4, true );
+				continue;
+			}
+			__m128 pz = _mm_mul_ps( _mm_cvtepi32_ps( d ), vScale );
+			_mm_storeu_ps( x + n, _mm_mul_ps( _mm_loadu_ps( rayX + i ), pz ) );
+			_mm_storeu_ps( y + n, _mm_mul_ps( vRayY, pz ) );
+			_mm_storeu_ps( z + n, pz );
+			n += 4;
+		}
+#elif defined( CINI_NEON )
+		float32x4_t vScale = vdupq_n_f32( zScale );
+		for ( ; i + 4 <= count; i += 4 )
+		{
+			uint32x4_t d = vmovl_u16( vld1_u16( depth + i ) );
+			if ( compact )
+			{
+				uint32x4_t zeroMask = vceqq_u32( d, vdupq_n_u32( 0 ) );
+				uint32x2_t anyZero = vorr_u32( vget_low_u32( zeroMask ), vget_high_u32( zeroMask ) );
+				if ( vget_lane_u32( vpmax_u32( anyZero, anyZero ), 0 ) != 0 )
+				{
+					n += projectDepthScalar( depth + i, 1, rayX + i, rayY, zScale, x + n, y + n, z + n, 4, true );
+					continue;
+				}
+			}
+			float32x4_t pz = vmulq_f32( vcvtq_f32_u32( d ), vScale );
+			vst1q_f32( x + n, vmulq_f32( vld1q_f32( rayX + i ), pz ) );
+			vst1q_f32( y + n, vmulq_n_f32( pz, rayY ) );
+			vst1q_f32( z + n, pz );
+			n += 4;
+		}
+#endif
+	}
+
+	return n + projectDepthScalar( depth + i * step, step, rayX + i, rayY, zScale, x + n, y + n, z + n, count - i, compact );
+}
+
+size_t projectDepthInterleaved( const uint16_t *depth, size_t step, const float *rayX, float rayY, float zScale, float *xyz, size_t count, bool compact )
+{
+	size_t i = 0;
+	size_t n = 0;
+
+	if ( step == 1 )
+	{
+#if defined( CINI_SSE2 )
+		__m128i zero = _mm_setzero_si128();
+		__m128 vRayY = _mm_set1_ps( rayY );
+		__m128 vScale = _mm_set1_ps( zScale );
+		for ( ; i + 4 <= count; i += 4 )
+		{
+			__m128i d = _mm_unpacklo_epi16( _mm_loadl_epi64( reinterpret_cast< const __m128i * >( depth + i ) ), zero );
+			int zeroMask = compact ? _mm_movemask_epi8( _mm_cmpeq_epi32( d, zero ) ) : 0;
+			if ( zeroMask == 0xffff )
+				continue;
+			if ( zeroMask != 0 )
+			{
+				n += projectDepthInterleavedScalar( depth + i, 1, rayX + i, rayY, zScale, xyz + n * 3, 4, true );
+				continue;
+			}
+			__m128 pz = _mm_mul_ps( _mm_cvtepi32_ps( d ), vScale );
+			__m128 px = _mm_mul_ps( _mm_loadu_ps( rayX + i ), pz );
+			__m128 py = _mm_mul_ps( vRayY, pz );
+			// transpose x0..3, y0..3, z0..3 to x0 y0 z0 x1 | y1 z1 x2 y2 | z2 x3 y3 z3
+			__m128 xyLo = _mm_unpacklo_ps( px, py );
+			__m128 xyHi = _mm_unpackhi_ps( px, py );
+			__m128 zx = _mm_shuffle_ps( pz, xyLo, _MM_SHUFFLE( 2, 2, 0, 0 ) );
+			__m128 yz = _mm_shuffle_ps( xyLo, pz, _MM_SHUFFLE( 1, 1, 3, 3 ) );
+			__m128 zxy = _mm_shuffle_ps( pz, xyHi, _MM_SHUFFLE( 3, 2, 3, 2 ) );
+			float *dst = xyz + n * 3;
+			_mm_storeu_ps( dst, _mm_shuffle_ps( xyLo, zx, _MM_SHUFFLE( 2, 0, 1, 0 ) ) );
+			_mm_storeu_ps( dst + 4, _mm_shuffle_ps( yz, xyHi, _MM_SHUFFLE( 1, 0, 2, 0 ) ) );
+			_mm_storeu_ps( dst + 8, _mm_shuffle_ps( zxy, zxy, _MM_SHUFFLE( 1, 3, 2, 0 ) ) );
+			n += 4;
+		}
+#elif defined( CINI_NEON )
+		float32x4_t vScale = vdupq_n_f32( zScale );
+		for ( ; i + 4 <= count; i += 4 )
+		{
+			uint32x4_t d = vmovl_u16( vld1_u16( depth + i ) );
+			if ( compact )
+			{
+				uint32x4_t zeroMask = vceqq_u32( d, vdupq_n_u32( 0 ) );
+				uint32x2_t anyZero = vorr_u32( vget_low_u32( zeroMask ), vget_high_u32( zeroMask ) );
+				if ( vget_lane_u32( vpmax_u32( anyZero, anyZero ), 0 ) != 0 )
+				{
+					n += projectDepthInterleavedScalar( depth + i, 1, rayX + i, rayY, zScale, xyz + n * 3, 4, true );
+					continue;
+				}
+			}
+			float32x4x3_t p;
+			p.val[ 2 ] = vmulq_f32( vcvtq_f32_u32( d ), vScale );
+			p.val[ 0 ] = vmulq_f32( vld1q_f32( rayX + i ), p.val[ 2 ] );
+			p.val[ 1 ] = vmulq_n_f32( p.val[ 2 ], rayY );
+			vst3q_f32( xyz + n * 3, p );
+			n += 4;
+		}
+#endif
+	}
+
+	return n + projectDepthInterleavedScalar( depth + i * step, step, rayX + i, rayY, zScale, xyz + n * 3, count - i, compact );
+}
+
+void reprojectDepthScalar( const uint16_t *depth, const float *colX, const float *colY, const float *colZ, const float *row, const float *offset, int width, int height, int32_t *index, int32_t *targetDepth, size_t count )
+{
+	float maxX = width - .5f;
+	float maxY = height - .5f;
+	for ( size_t i = 0; i < count; i++ )
+	{
+		float z = depth[ i ];
+		float w = z * ( colZ[ i ] + row[ 2 ] ) + offset[ 2 ];
+		float x = ( z * ( colX[ i ] + row[ 0 ] ) + offset[ 0 ] ) / w;
+		float y = ( z * ( colY[ i ] + row[ 1 ] ) + offset[ 1 ] ) / w;
+		if ( ( z > 0.f ) && ( w > 0.f ) && ( x >= -.5f ) && ( x < maxX ) && ( y >= -.5f ) && ( y < maxY ) )
+		{
+			index[ i ] = int32_t( y + .5f ) * width + int32_t( x + .5f );
+			targetDepth[ i ] = int32_t( std::min( w + .5f, 65535.f ) );
+		}
+		else
+		{
+			index[ i ] = -1;
+			targetDepth[ i ] = 0;
+		}
+	}
+}
+
+void reprojectDepth( const uint16_t *depth, const float *colX, const float *colY, const float *colZ, const float *row, const float *offset, int width, int height, int32_t *index, int32_t *targetDepth, size_t count )
+{
+	size_t i = 0;
+
+#if defined( CINI_SSE2 )
+	__m128i zero = _mm_setzero_si128();
+	__m128 zeroF = _mm_setzero_ps();
+	__m128 half = _mm_set1_ps( .5f );
+	__m128 minXY = _mm_set1_ps( -.5f );
+	__m128 maxX = _mm_set1_ps( width - .5f );
+	__m128 maxY = _mm_set1_ps( height - .5f );
+	__m128 maxDepth = _mm_set1_ps( 65535.f );
+	__m128 rowX = _mm_set1_ps( row[ 0 ] ), rowY = _mm_set1_ps( row[ 1 ] ), rowZ = _mm_set1_ps( row[ 2 ] );
+	__m128 offX = _mm_set1_ps( offset[ 0 ] ), offY = _mm_set1_ps( offset[ 1 ] ), offZ = _mm_set1_ps( offset[ 2 ] );
+	// widths fit into 16 bits, madd multiplies the low halves of the 32-bit lanes
+	__m128i vWidth = _mm_set1_epi32( width );
+	for ( ; i + 4 <= count; i += 4 )
+	{
+		__m128 z = _mm_cvtepi32_ps( _mm_unpacklo_epi16( _mm_loadl_epi64( reinterpret_cast< const __m128i * >( depth + i ) ), zero ) );
+		__m128 w = _mm_add_ps( _mm_mul_ps( z, _mm_add_ps( _mm_loadu_ps( colZ + i ), rowZ ) ), offZ );
+		__m128 x = _mm_div_ps( _mm_add_ps( _mm_mul_ps( z, _mm_add_ps( _mm_loadu_ps( colX + i ), rowX ) ), offX ), w );
+		__m128 y = _mm_div_ps( _mm_add_ps( _mm_mul_ps( z, _mm_add_ps( _mm_loadu_ps( colY + i ), rowY ) ), offY ), w );
+
+		__m128 valid = _mm_and_ps( _mm_cmpgt_ps( z, zeroF ), _mm_cmpgt_ps( w, zeroF ) );
+		valid = _mm_and_ps( valid, _mm_and_ps( _mm_cmpge_ps( x, minXY ), _mm_cmplt_ps( x, maxX ) ) );
+		valid = _mm_and_ps( valid, _mm_and_ps( _mm_cmpge_ps( y, minXY ), _mm_cmplt_ps( y, maxY ) ) );
+		__m128i mask = _mm_castps_si128( valid );
+
+		__m128i xi = _mm_cvttps_epi32( _mm_add_ps( x, half ) );
+		__m128i yi = _mm_cvttps_epi32( _mm_add_ps( y, half ) );
+		__m128i idx = _mm_add_epi32( _mm_madd_epi16( yi, vWidth ), xi );
+		// invalid lanes become -1
+		idx = _mm_or_si128( _mm_and_si128( mask, idx ), _mm_xor_si128( mask, _mm_set1_epi32( -1 ) ) );
+		_mm_storeu_si128( reinterpret_cast< __m128i * >( index + i ), idx );
+
+		__m128i d = _mm_cvttps_epi32( _mm_min_ps( _mm_add_ps( w, half ), maxDepth ) );
+		_mm_storeu_si128( reinterpret_cast< __m128i * >( targetDepth + i ), _mm_and_si128( mask, d ) );
+	}
+#elif defined( CINI_NEON ) && defined( __aarch64__ )
+	float32x4_t zeroF = vdupq_n_f32( 0.f );
+	float32x4_t half = vdupq_n_f32( .5f );
+	float32x4_t minXY = vdupq_n_f32( -.5f );
+	float32x4_t maxX = vdupq_n_f32( width - .5f );
+	float32x4_t maxY = vdupq_n_f32( height - .5f );
+	float32x4_t maxDepth = vdupq_n_f32( 65535.f );
+	float32x4_t rowX = vdupq_n_f32( row[ 0 ] ), rowY = vdupq_n_f32( row[ 1 ] ), rowZ = vdupq_n_f32( row[ 2 ] );
+	float32x4_t offX = vdupq_n_f32( offset[ 0 ] ), offY = vdupq_n_f32( offset[ 1 ] ), offZ = vdupq_n_f32( offset[ 2 ] );
+	for ( ; i + 4 <= count; i += 4 )
+	{
+		float32x4_t z = vcvtq_f32_u32( vmovl_u16( vld1_u16( depth + i ) ) );
+		float32x4_t w = vaddq_f32( vmulq_f32( z, vaddq_f32( vld1q_f32( colZ + i ), rowZ ) ), offZ );
+		float32x4_t x = vdivq_f32( vaddq_f32( vmulq_f32( z, vaddq_f32( vld1q_f32( colX + i ), rowX ) ), offX ), w );
+		float32x4_t y = vdivq_f32( vaddq_f32( vmulq_f32( z, vaddq_f32( vld1q_f32( colY + i ), rowY ) ), offY ), w );
+
+		uint32x4_t valid = vandq_u32( vcgtq_f32( z, zeroF ), vcgtq_f32( w, zeroF ) );
+		valid = vandq_u32( valid, vandq_u32( vcgeq_f32( x, minXY ), vcltq_f32( x, maxX ) ) );
+		valid = vandq_u32( valid, vandq_u32( vcgeq_f32( y, minXY ), vcltq_f32( y, maxY ) ) );
+
+		int32x4_t xi = vcvtq_s32_f32( vaddq_f32( x, half ) );
+		int32x4_t yi = vcvtq_s32_f32( vaddq_f32( y, half ) );
+		int32x4_t idx = vmlaq_n_s32( xi, yi, width );
+		vst1q_s32( index + i, vbslq_s32( valid, idx, vdupq_n_s32( -1 ) ) );
+
+		int32x4_t d = vcvtq_s32_f32( vminq_f32( vaddq_f32( w, half ), maxDepth ) );
+		vst1q_s32( targetDepth + i, vbslq_s32( valid, d, vdupq_n_s32( 0 ) ) );
+	}
+#endif
+
+	reprojectDepthScalar( depth + i, colX + i, colY + i, colZ + i, row, offset, width, height, index + i, targetDepth + i, count - i );
+}
+
+void medianDepthScalar( const uint16_t * const *frames, size_t numFrames, uint16_t *dst, size_t count )
+{
+	for ( size_t i = 0; i < count; i++ )
+	{
+		uint16_t values[ kMaxMedianFrames ];
+		size_t n = 0;
+		for ( size_t f = 0; f < numFrames; f++ )
+		{
+			uint16_t v = frames[ f ][ i ];
+			if ( v == 0 )
+				continue;
+			size_t j = n++;
+			for ( ; ( j > 0 ) && ( values[ j - 1 ] > v ); j-- )
+				values[ j ] = values[ j - 1 ];
+			values[ j ] = v;
+		}
+		dst[ i ] = ( n > 0 ) ? values[ ( n - 1 ) / 2 ] : 0;
+	}
+}
+
+// the values are sorted with an odd-even transposition network, zeros end up first, so the median of the k nonzero values
+// is at numFrames - k + ( k - 1 ) / 2
+void medianDepth( const uint16_t * const *frames, size_t numFrames, uint16_t *dst, size_t count )
+{
+	size_t i = 0;
+
+#if defined( CINI_SSE2 )
+	// SSE2 only compares signed words, the bias maps the unsigned order to the signed one
+	__m128i bias = _mm_set1_epi16( (short)0x8000 );
+	__m128i zero = _mm_setzero_si128();
+	// every lane the network reads is loaded per block, the registers are only cleared once so the compiler sees them initialized
+	__m128i v[ kMaxMedianFrames ];
+	for ( size_t f = 0; f < numFrames; f++ )
+		v[ f ] = zero;
+	for ( ; i + 8 <= count; i += 8 )
+	{
+		__m128i numZeros = zero;
+		for ( size_t f = 0; f < numFrames; f++ )
+		{
+			__m128i d = _mm_loadu_si128( reinterpret_cast< const __m128i * >( frames[ f ] + i ) );
+			numZeros = _mm_sub_epi16( numZeros, _mm_cmpeq_epi16( d, zero ) );
+			v[ f ] = _mm_xor_si128( d, bias );
+		}
+		for ( size_t pass = 0; pass < numFrames; pass++ )
+		{
+			for ( size_t f = pass & 1; f + 1 < numFrames; f += 2 )
+			{
+				__m128i lo = _mm_min_epi16( v[ f ], v[ f + 1 ] );
+				v[ f + 1 ] = _mm_max_epi16( v[ f ], v[ f + 1 ] );
+				v[ f ] = lo;
+			}
+		}
+		// all zero pixels select the first sorted value, which is zero then
+		__m128i r = v[ 0 ];
+		for ( size_t k = 1; k <= numFrames; k++ )
+		{
+			__m128i m = _mm_cmpeq_epi16( numZeros, _mm_set1_epi16( (short)( numFrames - k ) ) );
+			r = _mm_or_si128( _mm_and_si128( m, v[ numFrames - k + ( k - 1 ) / 2 ] ), _mm_andnot_si128( m, r ) );
+		}
+		_mm_storeu_si128( reinterpret_cast< __m128i * >( dst + i ), _mm_xor_si128( r, bias ) );
+	}
+#elif defined( CINI_NEON )
+	uint16x8_t v[ kMaxMedianFrames ];
+	for ( size_t f = 0; f < numFrames; f++ )
+		v[ f ] = vdupq_n_u16( 0 );
+	for ( ; i + 8 <= count; i += 8 )
+	{
+		uint16x8_t numZeros = vdupq_n_u16( 0 );
+		for ( size_t f = 0; f < numFrames; f++ )
+		{
+			v[ f ] = vld1q_u16( frames[ f ] + i );
+			numZeros = vsubq_u16( numZeros, vceqq_u16( v[ f ], vdupq_n_u16( 0 ) ) );
+		}
+		for ( size_t pass = 0; pass < numFrames; pass++ )
+		{
+			for ( size_t f = pass & 1; f + 1 < numFrames; f += 2 )
+			{
+				uint16x8_t lo = vminq_u16( v[ f ], v[ f + 1 ] );
+				v[ f + 1 ] = vmaxq_u16( v[ f ], v[ f + 1 ] );
+				v[ f ] = lo;
+			}
+		}
+		uint16x8_t r = v[ 0 ];
+		for ( size_t k = 1; k <= numFrames; k++ )
+		{
+			uint16x8_t m = vceqq_u16( numZeros, vdupq_n_u16( (uint16_t)( numFrames - k ) ) );
+			r = vbslq_u16( m, v[ numFrames - k + ( k - 1 ) / 2 ], r );
+		}
+		vst1q_u16( dst + i, r );
+	}
+#endif
+
+	const uint16_t *tails[ kMaxMedianFrames ];
+	for ( size_t f = 0; f < numFrames; f++ )
+		tails[ f ] = frames[ f ] + i;
+	medianDepthScalar( tails, numFrames, dst + i, count - i );
+}
+
+void emaDepthScalar( const uint16_t *src, uint16_t *state, uint16_t *dst, size_t count, int alpha, uint16_t resetThreshold )
+{
+	for ( size_t i = 0; i < count; i++ )
+	{
+		int v = src[ i ];
+		int s = state[ i ];
+		if ( v == 0 )
+			s = 0;
+		else
+		if ( ( s == 0 ) || ( std::abs( v - s ) > resetThreshold ) )
+			s = v;
+		else
+			s = ( v * alpha + s * ( 256 - alpha ) + 128 ) >> 8;
+		state[ i ] = dst[ i ] = (uint16_t)s;
+	}
+}
+
+void emaDepth( const uint16_t *src, uint16_t *state, uint16_t *dst, size_t count, int alpha, uint16_t resetThreshold )
+{
+	size_t i = 0;
+
+#if defined( CINI_SSE2 )
+	__m128i zero = _mm_setzero_si128();
+	__m128i weights = _mm_set1_epi32( ( ( 256 - alpha ) << 16 ) | alpha );
+	__m128i round = _mm_set1_epi32( 128 );
+	__m128i threshold = _mm_set1_epi16( (short)std::min( (int)resetThreshold, 0x7fff ) );
+	for ( ; i + 8 <= count; i += 8 )
+	{
+		__m128i v = _mm_loadu_si128( reinterpret_cast< const __m128i * >( src + i ) );
+		__m128i s = _mm_loadu_si128( reinterpret_cast< const __m128i * >( state + i ) );
+
+		// v * alpha + s * ( 256 - alpha ) of interleaved ( v, s ) pairs, the values are positive signed words
+		__m128i lo = _mm_madd_epi16( _mm_unpacklo_epi16( v, s ), weights );
+		__m128i hi = _mm_madd_epi16( _mm_unpackhi_epi16( v, s ), weights );
+		lo = _mm_srai_epi32( _mm_add_epi32( lo, round ), 8 );
+		hi = _mm_srai_epi32( _mm_add_epi32( hi, round ), 8 );
+		__m128i avg = _mm_packs_epi32( lo, hi );
+
+		// | v - s | with unsigned saturation, compared as signed words
+		__m128i diff = _mm_or_si128( _mm_subs_epu16( v, s ), _mm_subs_epu16( s, v ) );
+		__m128i reset = _mm_or_si128( _mm_cmpeq_epi16( s, zero ), _mm_cmpgt_epi16( diff, threshold ) );
+		__m128i r = _mm_or_si128( _mm_and_si128( reset, v ), _mm_andnot_si128( reset, avg ) );
+		r = _mm_andnot_si128( _mm_cmpeq_epi16( v, zero ), r );
+
+		_mm_storeu_si128( reinterpret_cast< __m128i * >( state + i ), r );
+		_mm_storeu_si128( reinterpret_cast< __m128i * >( dst + i ), r );
+	}
+#elif defined( CINI_NEON )
+	uint16x4_t a = vdup_n_u16( (uint16_t)alpha );
+	uint16x4_t b = vdup_n_u16( (uint16_t)( 256 - alpha ) );
+	uint16x8_t threshold = vdupq_n_u16( resetThreshold );
+	for ( ; i + 8 <= count; i += 8 )
+	{
+		uint16x8_t v = vld1q_u16( src + i );
+		uint16x8_t s = vld1q_u16( state + i );
+
+		uint32x4_t lo = vmlal_u16( vmull_u16( vget_low_u16( v ), a ), vget_low_u16( s ), b );
+		uint32x4_t hi = vmlal_u16( vmull_u16( vget_high_u16( v ), a ), vget_high_u16( s ), b );
+		uint16x8_t avg = vcombine_u16( vrshrn_n_u32( lo, 8 ), vrshrn_n_u32( hi, 8 ) );
+
+		uint16x8_t reset = vorrq_u16( vceqq_u16( s, vdupq_n_u16( 0 ) ), vcgtq_u16( vabdq_u16( v, s ), threshold ) );
+		uint16x8_t r = vbslq_u16( reset, v, avg );
+		r = vbicq_u16( r, vceqq_u16( v, vdupq_n_u16( 0 ) ) );
+
+		vst1q_u16( state + i, r );
+		vst1q_u16( dst + i, r );
+	}
+#endif
+
+	emaDepthScalar( src + i, state + i, dst + i, count - i, alpha, resetThreshold );
+}
+
+void persistDepthHolesScalar( const uint16_t *src, uint16_t *last, uint16_t *age, uint16_t *dst, size_t count, uint16_t maxAge )
+{
+	for ( size_t i = 0; i < count; i++ )
+	{
+		uint16_t v = src[ i ];
+		if ( v != 0 )
+		{
+			last[ i ] = v;
+			age[ i ] = 0;
+		}
+		else
+		if ( age[ i ] < maxAge )
+			age[ i ]++;
+		else
+			last[ i ] = 0;
+		dst[ i ] = last[ i ];
+	}
+}
+
+void persistDepthHoles( const uint16_t *src, uint16_t *last, uint16_t *age, uint16_t *dst, size_t count, uint16_t maxAge )
+{
+	size_t i = 0;
+
+#if defined( CINI_SSE2 )
+	__m128i zero = _mm_setzero_si128();
+	__m128i one = _mm_set1_epi16( 1 );
+	__m128i vMaxAge = _mm_set1_epi16( (short)maxAge );
+	for ( ; i + 8 <= count; i += 8 )
+	{
+		__m128i v = _mm_loadu_si128( reinterpret_cast< const __m128i * >( src + i ) );
+		__m128i l = _mm_loadu_si128( reinterpret_cast< const __m128i * >( last + i ) );
+		__m128i a = _mm_loadu_si128( reinterpret_cast< const __m128i * >( age + i ) );
+
+		__m128i hole = _mm_cmpeq_epi16( v, zero );
+		// age < maxAge as unsigned words
+		__m128i young = _mm_xor_si128( _mm_cmpeq_epi16( _mm_subs_epu16( vMaxAge, a ), zero ), _mm_set1_epi16( -1 ) );
+		__m128i expired = _mm_andnot_si128( young, hole );
+
+		a = _mm_and_si128( hole, _mm_add_epi16( a, _mm_and_si128( young, one ) ) );
+		l = _mm_andnot_si128( expired, _mm_or_si128( _mm_and_si128( hole, l ), v ) );
+
+		_mm_storeu_si128( reinterpret_cast< __m128i * >( age + i ), a );
+		_mm_storeu_si128( reinterpret_cast< __m128i * >( last + i ), l );
+		_mm_storeu_si128( reinterpret_cast< __m128i * >( dst + i ), l );
+	}
+#elif defined( CINI_NEON )
+	uint16x8_t vMaxAge = vdupq_n_u16( maxAge );
+	for ( ; i + 8 <= count; i += 8 )
+	{
+		uint16x8_t v = vld1q_u16( src + i );
+		uint16x8_t l = vld1q_u16( last + i );
+		uint16x8_t a = vld1q_u16( age + i );
+
+		uint16x8_t hole = vceqq_u16( v, vdupq_n_u16( 0 ) );
+		uint16x8_t young = vcltq_u16( a, vMaxAge );
+		uint16x8_t expired = vbicq_u16( hole, young );
+
+		a = vandq_u16( hole, vsubq_u16( a, young ) );
+		l = vbicq_u16( vbslq_u16( hole, l, v ), expired );
+
+		vst1q_u16( age + i, a );
+		vst1q_u16( last + i, l );
+		vst1q_u16( dst + i, l );
+	}
+#endif
+
+	persistDepthHolesScalar( src + i, last + i, age + i, dst + i, count - i, maxAge );
+}
+
+void colorizeDepthScalar( const uint16_t *depth, const uint32_t *lut, uint8_t *dst, size_t count )
+{
+	for ( size_t i = 0; i < count; i++ )
+	{
+		uint32_t c = lut[ depth[ i ] ];
+		dst[ i * 3 ] = c & 0xff;
+		dst[ i * 3 + 1 ] = ( c >> 8 ) & 0xff;
+		dst[ i * 3 + 2 ] = ( c >> 16 ) & 0xff;
+	}
+}
+
+void colorizeDepth( const uint16_t *depth, const uint32_t *lut, uint8_t *dst, size_t count )
+{
+	size_t i = 0;
+
+#if defined( CINI_AVX2 )
+	// drops the fourth byte of every entry, packing each lane's four pixels to its low 12 bytes
+	__m256i pack = _mm256_setr_epi8( 0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+									 0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1 );
+	// the 16-byte stores of the 12-byte halves write 4 bytes past the 8 pixels, which the next pixels overwrite,
+	// so the loop stops 2 pixels early
+	for ( ; i + 10 <= count; i += 8 )
+	{
+		__m256i d = _mm256_cvtepu16_epi32( _mm_loadu_si128( reinterpret_cast< const __m128i * >( depth + i ) ) );
+		__m256i c = _mm256_shuffle_epi8( _mm256_i32gather_epi32( reinterpret_cast< const int * >( lut ), d, 4 ), pack );
+		_mm_storeu_si128( reinterpret_cast< __m128i * >( dst + i * 3 ), _mm256_castsi256_si128( c ) );
+		_mm_storeu_si128( reinterpret_cast< __m128i * >( dst + i * 3 + 12 ), _mm256_extracti128_si256( c, 1 ) );
+	}
+#endif
+
+	colorizeDepthScalar( depth + i, lut, dst + i * 3, count - i );
+}
+
+void downsampleDepthScalar( const uint16_t *row0, const uint16_t *row1, uint16_t *dst, size_t count, bool median )
+{
+	for ( size_t i = 0; i < count; i++ )
+	{
+		uint16_t block[ 4 ] = { row0[ i * 2 ], row0[ i * 2 + 1 ], row1[ i * 2 ], row1[ i * 2 + 1 ] };
+		uint16_t values[ 4 ];
+		size_t n = 0;
+		for ( size_t b = 0; b < 4; b++ )
+		{
+			uint16_t v = block[ b ];
+			if ( v == 0 )
+				continue;
+			size_t j = n++;
+			for ( ; ( j > 0 ) && ( values[ j - 1 ] > v ); j-- )
+				values[ j ] = values[ j - 1 ];
+			values[ j ] = v;
+		}
+		if ( n == 0 )
+			dst[ i ] = 0;
+		else
+			dst[ i ] = median ? values[ ( n - 1 ) / 2 ] : values[ 0 ];
+	}
+}
+
+// the values are decremented, which wraps zeros to the largest value, so they sort last and the k nonzero values come
+// first. the median of the block is the second sorted value if the third one is valid, the first one otherwise
+void downsampleDepth( const uint16_t *row0, const uint16_t *row1, uint16_t *dst, size_t count, bool median )
+{
+	size_t i = 0;
+
+#if defined( CINI_SSE2 )
+	// SSE2 only compares signed words, the bias maps the unsigned order to the signed one, which also lets the
+	// saturating pack of the sign extended even and odd words separate them exactly
+	__m128i one = _mm_set1_epi16( 1 );
+	__m128i bias = _mm_set1_epi16( (short)0x8000 );
+	__m128i invalid = _mm_set1_epi16( 0x7fff );
+	for ( ; i + 8 <= count; i += 8 )
+	{
+		__m128i a0 = _mm_xor_si128( _mm_sub_epi16( _mm_loadu_si128( reinterpret_cast< const __m128i * >( row0 + i * 2 ) ), one ), bias );
+		__m128i a1 = _mm_xor_si128( _mm_sub_epi16( _mm_loadu_si128( reinterpret_cast< const __m128i * >( row0 + i * 2 + 8 ) ), one ), bias );
+		__m128i b0 = _mm_xor_si128( _mm_sub_epi16( _mm_loadu_si128( reinterpret_cast< const __m128i * >( row1 + i * 2 ) ), one ), bias );
+		__m128i b1 = _mm_xor_si128( _mm_sub_epi16( _mm_loadu_si128( reinterpret_cast< const __m128i * >( row1 + i * 2 + 8 ) ), one ), bias );
+		__m128i v0 = _mm_packs_epi32( _mm_srai_epi32( _mm_slli_epi32( a0, 16 ), 16 ), _mm_srai_epi32( _mm_slli_epi32( a1, 16 ), 16 ) );
+		__m128i v1 = _mm_packs_epi32( _mm_srai_epi32( a0, 16 ), _mm_srai_epi32( a1, 16 ) );
+		__m128i v2 = _mm_packs_epi32( _mm_srai_epi32( _mm_slli_epi32( b0, 16 ), 16 ), _mm_srai_epi32( _mm_slli_epi32( b1, 16 ), 16 ) );
+		__m128i v3 = _mm_packs_epi32( _mm_srai_epi32( b0, 16 ), _mm_srai_epi32( b1, 16 ) );
+
+		__m128i r;
+		if ( median )
+		{
+			// sorting network, the largest value is not needed
+			__m128i lo01 = _mm_min_epi16( v0, v1 );
+			__m128i hi01 = _mm_max_epi16( v0, v1 );
+			__m128i lo23 = _mm_min_epi16( v2, v3 );
+			__m128i hi23 = _mm_max_epi16( v2, v3 );
+			__m128i s0 = _mm_min_epi16( lo01, lo23 );
+			__m128i mid0 = _mm_max_epi16( lo01, lo23 );
+			__m128i mid1 = _mm_min_epi16( hi01, hi23 );
+			__m128i s1 = _mm_min_epi16( mid0, mid1 );
+			__m128i s2 = _mm_max_epi16( mid0, mid1 );
+			__m128i m = _mm_cmpeq_epi16( s2, invalid );
+			r = _mm_or_si128( _mm_and_si128( m, s0 ), _mm_andnot_si128( m, s1 ) );
+		}
+		else
+		{
+			r = _mm_min_epi16( _mm_min_epi16( v0, v1 ), _mm_min_epi16( v2, v3 ) );
+		}
+		_mm_storeu_si128( reinterpret_cast< __m128i * >( dst + i ), _mm_add_epi16( _mm_xor_si128( r, bias ), one ) );
+	}
+#elif defined( CINI_NEON )
+	uint16x8_t one = vdupq_n_u16( 1 );
+	for ( ; i + 8 <= count; i += 8 )
+	{
+		uint16x8x2_t a = vld2q_u16( row0 + i * 2 );
+		uint16x8x2_t b = vld2q_u16( row1 + i * 2 );
+		uint16x8_t v0 = vsubq_u16( a.val[ 0 ], one );
+		uint16x8_t v1 = vsubq_u16( a.val[ 1 ], one );
+		uint16x8_t v2 = vsubq_u16( b.val[ 0 ], one );
+		uint16x8_t v3 = vsubq_u16( b.val[ 1 ], one );
+
+		uint16x8_t r;
+		if ( median )
+		{
+			uint16x8_t lo01 = vminq_u16( v0, v1 );
+			uint16x8_t hi01 = vmaxq_u16( v0, v1 );
+			uint16x8_t lo23 = vminq_u16( v2, v3 );
+			uint16x8_t hi23 = vmaxq_u16( v2, v3 );
+			uint16x8_t s0 = vminq_u16( lo01, lo23 );
+			uint16x8_t mid0 = vmaxq_u16( lo01, lo23 );
+			uint16x8_t mid1 = vminq_u16( hi01, hi23 );
+			uint16x8_t s1 = vminq_u16( mid0, mid1 );
+			uint16x8_t s2 = vmaxq_u16( mid0, mid1 );
+			r = vbslq_u16( vceqq_u16( s2, vdupq_n_u16( 0xffff ) ), s0, s1 );
+		}
+		else
+		{
+			r = vminq_u16( vminq_u16( v0, v1 ), vminq_u16( v2, v3 ) );
+		}
+		vst1q_u16( dst + i, vaddq_u16( r, one ) );
+	}
+#endif
+
+	downsampleDepthScalar( row0 + i * 2, row1 + i * 2, dst + i, count - i, median );
+}
+
+} } // namespace mndl::ni
@@ -0,0 +1,134 @@
+/*
+ Copyright (c) 2012, Gabor Papp, All rights reserved.
+
+ This code is intended for use with the Cinder C++ library:
+ http://libcinder.org
+
+ Partially based on the Cinder-Kinect block:
+ https://github.com/cinder/Cinder-Kinect
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <stddef.h>
+
+#include "cinder/Cinder.h"
+
+namespace mndl { namespace ni {
+
+//! Pixel conversion kernels used by the capture thread. The vector path is chosen at compile time
+//! from the enabled instruction sets, every kernel has a scalar version producing identical output.
+
+//! Returns the name of the instruction set the kernels were compiled for.
+const char *getKernelInstructionSet();
+
+//! Scales \a count depth values as ( \a scale * v ) >> 16 with 32-bit wrap-around.
+void scaleDepth( const uint16_t *src, uint16_t *dst, size_t count, uint32_t scale );
+void scaleDepthScalar( const uint16_t *src, uint16_t *dst, size_t count, uint32_t scale );
+
+//! Converts \a count depth values in one pass to any combination of the outputs, NULL outputs are skipped:
+//! \a dst16 receives the values scaled as scaleDepth() does, a \a scale of 0x10000 copies them,
+//! \a dst8 receives 255 - ( ( ( v - \a nearClip ) * \a windowScale ) >> 16 ) for v in [ \a nearClip, \a farClip ], 0 outside,
+//! \a mask receives 255 for v in [ \a nearClip, \a farClip ], 0 outside.
+//! \a windowScale has to map the range to at most 255, as ( 255 << 16 ) / ( \a farClip - \a nearClip ) does.
+//! A \a nearClip of 0 is raised to 1, holes are always out of range.
+void convertDepthMulti( const uint16_t *src, uint16_t *dst16, uint32_t scale, uint8_t *dst8, uint8_t *mask, uint16_t nearClip, uint16_t farClip, uint32_t windowScale, size_t count );
+void convertDepthMultiScalar( const uint16_t *src, uint16_t *dst16, uint32_t scale, uint8_t *dst8, uint8_t *mask, uint16_t nearClip, uint16_t farClip, uint32_t windowScale, size_t count );
+
+//! Converts \a count IR values to 8 bits as v / 4, truncated to the low byte.
+void convertIR( const uint16_t *src, uint8_t *dst, size_t count );
+void convertIRScalar( const uint16_t *src, uint8_t *dst, size_t count );
+
+//! Maximum number of users splitUserLabels() creates bit-packed masks for.
+const size_t kMaxUserMasks = 15;
+
+//! Splits \a count user labels in one pass into \a labelMap, the labels truncated to the low byte, and bit-packed masks,
+//! one bit per pixel, least significant bit first. \a bitMasks[ 0 ] receives the mask of all users, \a bitMasks[ i ] the
+//! mask of \a userIds[ i - 1 ]. \a numUsers has to be at most kMaxUserMasks. Unused bits of the last byte are cleared.
+void splitUserLabels( const uint16_t *labels, uint8_t *labelMap, uint8_t * const *bitMasks, const uint16_t *userIds, size_t numUsers, size_t count );
+void splitUserLabelsScalar( const uint16_t *labels, uint8_t *labelMap, uint8_t * const *bitMasks, const uint16_t *userIds, size_t numUsers, size_t count );
+
+//! Writes the mask of \a userId from \a count labels of a label map, or the mask of all users if \a userId is 0.
+//! Masked pixels are set to the label if \a fillWithUserId is true, 255 otherwise.
+void maskUserLabels( const uint8_t *labelMap, uint8_t *dst, size_t count, uint8_t userId, bool fillWithUserId );
+void maskUserLabelsScalar( const uint8_t *labelMap, uint8_t *dst, size_t count, uint8_t userId, bool fillWithUserId );
+
+//! Adds the pixels set in the first \a count bits of the bit-packed mask \a bits, least significant bit first, to the statistics of a row
+//! and returns their number. \a sumX receives the sum of their positions, \a minX, \a maxX, \a minDepth and \a maxDepth are widened to
+//! the range of their positions and of their nonzero values in \a depth. Unused bits of the last byte have to be cleared.
+uint32_t accumulateMaskRow( const uint8_t *bits, const uint16_t *depth, size_t count, uint64_t *sumX, int32_t *minX, int32_t *maxX, uint16_t *minDepth, uint16_t *maxDepth );
+uint32_t accumulateMaskRowScalar( const uint8_t *bits, const uint16_t *depth, size_t count, uint64_t *sumX, int32_t *minX, int32_t *maxX, uint16_t *minDepth, uint16_t *maxDepth );
+
+//! Expands \a count bits of a bit-packed mask, least significant bit first, to bytes set to \a value where the bit is set and 0 elsewhere.
+void expandBitMask( const uint8_t *bits, uint8_t *dst, size_t count, uint8_t value );
+void expandBitMaskScalar( const uint8_t *bits, uint8_t *dst, size_t count, uint8_t value );
+
+//! Projects \a count depth values, read from every \a step th element of \a depth, along the rays of a depth row. Point i is
+//! ( \a rayX[ i ] * z, \a rayY * z, z ) with z = depth * \a zScale, written to the \a x, \a y and \a z arrays. Points of zero depth
+//! are skipped if \a compact is true. Returns the number of points written. Only a \a step of 1 is vectorized.
+size_t projectDepth( const uint16_t *depth, size_t step, const float *rayX, float rayY, float zScale, float *x, float *y, float *z, size_t count, bool compact );
+size_t projectDepthScalar( const uint16_t *depth, size_t step, const float *rayX, float rayY, float zScale, float *x, float *y, float *z, size_t count, bool compact );
+
+//! Same as projectDepth() writing interleaved x, y, z triplets to \a xyz.
+size_t projectDepthInterleaved( const uint16_t *depth, size_t step, const float *rayX, float rayY, float zScale, float *xyz, size_t count, bool compact );
+size_t projectDepthInterleavedScalar( const uint16_t *depth, size_t step, const float *rayX, float rayY, float zScale, float *xyz, size_t count, bool compact );
+
+//! Reprojects \a count depth values of a row to another view. A pixel of depth z maps to ( X, Y, W ) = z * ( \a colX[ i ] + \a row[ 0 ],
+//! \a colY[ i ] + \a row[ 1 ], \a colZ[ i ] + \a row[ 2 ] ) + \a offset and to the target pixel ( X / W, Y / W ) rounded to the nearest.
+//! \a index receives y * \a width + x of the target pixel, or -1 if the depth is zero or the pixel falls outside of \a width x \a height,
+//! \a targetDepth receives W rounded and clamped to 16 bits, 0 for invalid pixels. The scalar version may differ by a rounding step
+//! where the compiler contracts it to fused multiply-adds.
+void reprojectDepth( const uint16_t *depth, const float *colX, const float *colY, const float *colZ, const float *row, const float *offset, int width, int height, int32_t *index, int32_t *targetDepth, size_t count );
+void reprojectDepthScalar( const uint16_t *depth, const float *colX, const float *colY, const float *colZ, const float *row, const float *offset, int width, int height, int32_t *index, int32_t *targetDepth, size_t count );
+
+//! Maximum number of frames medianDepth() accepts.
+const size_t kMaxMedianFrames = 8;
+
+//! Writes the median of the nonzero values of \a numFrames depth maps per pixel to \a dst, the lower one of the middle values
+//! for an even count, 0 if all values are zero. \a numFrames has to be at most kMaxMedianFrames.
+void medianDepth( const uint16_t * const *frames, size_t numFrames, uint16_t *dst, size_t count );
+void medianDepthScalar( const uint16_t * const *frames, size_t numFrames, uint16_t *dst, size_t count );
+
+//! Updates the exponential moving average \a state with \a count depth values and writes it to \a dst. The state is set to
+//! ( v * \a alpha + s * ( 256 - \a alpha ) + 128 ) >> 8, reset to v if it was zero or differs from v by more than \a resetThreshold,
+//! and cleared where v is zero. \a alpha is in [ 0, 256 ], depth values have to be below 32768.
+void emaDepth( const uint16_t *src, uint16_t *state, uint16_t *dst, size_t count, int alpha, uint16_t resetThreshold );
+void emaDepthScalar( const uint16_t *src, uint16_t *state, uint16_t *dst, size_t count, int alpha, uint16_t resetThreshold );
+
+//! Keeps the last nonzero value of a pixel for up to \a maxAge frames where \a src is zero. \a last and \a age hold the state per pixel.
+void persistDepthHoles( const uint16_t *src, uint16_t *last, uint16_t *age, uint16_t *dst, size_t count, uint16_t maxAge );
+void persistDepthHolesScalar( const uint16_t *src, uint16_t *last, uint16_t *age, uint16_t *dst, size_t count, uint16_t maxAge );
+
+//! Looks up \a count depth values in the 65536 entry table \a lut and writes them as RGB triplets to \a dst. The entries hold
+//! the red, green and blue bytes in their low, second and third byte. Only the AVX2 build has a vector path, using gathers.
+void colorizeDepth( const uint16_t *depth, const uint32_t *lut, uint8_t *dst, size_t count );
+void colorizeDepthScalar( const uint16_t *depth, const uint32_t *lut, uint8_t *dst, size_t count );
+
+//! Reduces two rows of depth, \a row0 and \a row1, to \a count pixels of half the width, one per 2x2 block. Zeros are
+//! skipped, a block is zero only if all of its values are. Writes the smallest value of the block, or the median if
+//! \a median is true, the lower one of the middle values for an even count.
+void downsampleDepth( const uint16_t *row0, const uint16_t *row1, uint16_t *dst, size_t count, bool median );
+void downsampleDepthScalar( const uint16_t *row0, const uint16_t *row1, uint16_t *dst, size_t count, bool median );
+
+} } // namespace mndl::ni
+
@@ -0,0 +1,163 @@
+/*
+ Copyright (c) 2012, Gabor Papp, All rights reserved.
+
+ This code is intended for use with the Cinder C++ library:
+ http://libcinder.org
+
+ Partially based on the Cinder-Kinect block:
+ https://github.com/cinder/Cinder-Kinect
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <cmath>
+#include <algorithm>
+#include <new>
+
+#include "CiNIPointCloud.h"
+#include "CiNIKernels.h"
+
+using namespace ci;
+using namespace std;
+
+namespace mndl { namespace ni {
+
+PointCloud::PointCloud( OpenNI ni, const Options &options )
+{
+	XnFieldOfView fov;
+	fov.fHFOV = fov.fVFOV = 0;
+	xn::DepthGenerator &depthGenerator = ni.getNativeDepthGenerator();
+	if ( depthGenerator.IsValid() )
+		depthGenerator.GetFieldOfView( fov );
+	mObj = shared_ptr< Obj >( new Obj( fov, depthGenerator.IsValid() ? depthGenerator.GetDeviceMaxDepth() : 10000, options ) );
+}
+
+PointCloud::PointCloud( const XnFieldOfView &fov, int maxDepth, const Options &options )
+	: mObj( new Obj( fov, maxDepth, options ) )
+{
+}
+
+PointCloud::Obj::Obj( const XnFieldOfView &fov, int maxDepth, const Options &options )
+	: mOptions( options ), mFov( fov ), mMaxDepth( std::max( maxDepth, 1 ) ),
+	  mDepthWidth( 0 ), mDepthHeight( 0 ), mDepthX( 0 ), mDepthY( 0 ), mFullWidth( 0 ), mFullHeight( 0 ), mWidth( 0 ), mHeight( 0 ),
+	  mRayX( NULL ), mRayY( NULL ), mXYZ( NULL ), mCapacity( 0 ), mNumPoints( 0 )
+{
+	mOptions.setStep( std::max( mOptions.getStep(), 1 ) );
+}
+
+PointCloud::Obj::~Obj()
+{
+	AlignedAllocator::deallocate( mRayX );
+	AlignedAllocator::deallocate( mRayY );
+	AlignedAllocator::deallocate( mXYZ );
+}
+
+// the pinhole rays are separable, a column table and a row table describe the ray of every pixel
+// frames of a region of interest use the rays of their pixels in the sensor frame
+void PointCloud::Obj::setupRays( const Frame<uint16_t> &depth )
+{
+	releaseRays();
+
+	int step = mOptions.getStep();
+	mDepthWidth = depth.getWidth();
+	mDepthHeight = depth.getHeight();
+	mDepthX = depth.getX();
+	mDepthY = depth.getY();
+	mFullWidth = depth.getFullWidth();
+	mFullHeight = depth.getFullHeight();
+	mWidth = ( mDepthWidth + step - 1 ) / step;
+	mHeight = ( mDepthHeight + step - 1 ) / step;
+
+	// same as xn::DepthGenerator::ConvertProjectiveToRealWorld()
+	float xToZ = 2.f * tan( mFov.fHFOV / 2. );
+	float yToZ = 2.f * tan( mFov.fVFOV / 2. );
+
+	// round the arrays up to the alignment, so all three start aligned in the SoA layout
+	const size_t alignment = AlignedAllocator::kAlignment / sizeof( float );
+	mCapacity = ( size_t( mWidth ) * mHeight + alignment - 1 ) & ~( alignment - 1 );
+	mRayX = static_cast< float * >( AlignedAllocator::allocate( mWidth * sizeof( float ), false ) );
+	mRayY = static_cast< float * >( AlignedAllocator::allocate( mHeight * sizeof( float ), false ) );
+	mXYZ = static_cast< float * >( AlignedAllocator::allocate( 3 * mCapacity * sizeof( float ), false ) );
+	if ( ( mRayX == NULL ) || ( mRayY == NULL ) || ( mXYZ == NULL ) )
+	{
+		releaseRays();
+		throw std::bad_alloc();
+	}
+
+	for ( int x = 0; x < mWidth; x++ )
+		mRayX[ x ] = ( float( mDepthX + x * step ) / mFullWidth - .5f ) * xToZ;
+	for ( int y = 0; y < mHeight; y++ )
+		mRayY[ y ] = ( .5f - float( mDepthY + y * step ) / mFullHeight ) * yToZ;
+}
+
+// leaves the point cloud empty, the rays are set up again with the next update()
+void PointCloud::Obj::releaseRays()
+{
+	AlignedAllocator::deallocate( mRayX );
+	AlignedAllocator::deallocate( mRayY );
+	AlignedAllocator::deallocate( mXYZ );
+	mRayX = NULL;
+	mRayY = NULL;
+	mXYZ = NULL;
+	mDepthWidth = 0;
+	mDepthHeight = 0;
+	mWidth = 0;
+	mHeight = 0;
+	mCapacity = 0;
+	mNumPoints = 0;
+}
+
+size_t PointCloud::update( const Frame<uint16_t> &depth )
+{
+	if ( !depth )
+		return 0;
+
+	if ( ( depth.getWidth() != mObj->mDepthWidth ) || ( depth.getHeight() != mObj->mDepthHeight ) ||
+		 ( depth.getX() != mObj->mDepthX ) || ( depth.getY() != mObj->mDepthY ) ||
+		 ( depth.getFullWidth() != mObj->mFullWidth ) || ( depth.getFullHeight() != mObj->mFullHeight ) )
+		mObj->setupRays( depth );
+
+	// inverse of the scaling done by the capture thread
+	float zScale = 1.f;
+	if ( depth.getFormat() == FORMAT_DEPTH_SCALED )
+		zScale = 65536.f / ( 0xffff0000 / mObj->mMaxDepth );
+
+	size_t step = mObj->mOptions.getStep();
+	bool compact = mObj->mOptions.getCompactEnabled();
+	float *x = mObj->mXYZ;
+	float *y = mObj->mXYZ + mObj->mCapacity;
+	float *z = mObj->mXYZ + 2 * mObj->mCapacity;
+	size_t n = 0;
+	for ( int row = 0; row < mObj->mHeight; row++ )
+	{
+		const uint16_t *src = depth.getRow( row * step );
+		if ( mObj->mOptions.getLayout() == LAYOUT_VEC3F )
+			n += projectDepthInterleaved( src, step, mObj->mRayX, mObj->mRayY[ row ], zScale, x + n * 3, mObj->mWidth, compact );
+		else
+			n += projectDepth( src, step, mObj->mRayX, mObj->mRayY[ row ], zScale, x + n, y + n, z + n, mObj->mWidth, compact );
+	}
+
+	mObj->mNumPoints = n;
+	mObj->mInfo = depth.getInfo();
+	return n;
+}
+
+} } // namespace mndl::ni
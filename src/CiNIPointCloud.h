@@ -0,0 +1,139 @@
+/*
+ Copyright (c) 2012, Gabor Papp, All rights reserved.
+
+ This code is intended for use with the Cinder C++ library:
+ http://libcinder.org
+
+ Partially based on the Cinder-Kinect block:
+ https://github.com/cinder/Cinder-Kinect
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "cinder/Cinder.h"
+#include "cinder/Vector.h"
+
+#include <XnCppWrapper.h>
+
+#include "CiNI.h"
+
+namespace mndl { namespace ni {
+
+//! Converts depth frames to point clouds in millimetres, in the coordinate system of xn::DepthGenerator::ConvertProjectiveToRealWorld().
+//! The rays of the pixels are computed once from the field of view, each update only scales them by the depth of the pixels.
+class PointCloud
+{
+	public:
+		//! Memory layout of the points
+		enum Layout
+		{
+			LAYOUT_VEC3F,	//!< interleaved ci::Vec3f points, see getPoints()
+			LAYOUT_SOA		//!< separate x, y and z arrays, see getX(), getY() and getZ()
+		};
+
+		class Options
+		{
+			public:
+				Options() : mLayout( LAYOUT_VEC3F ), mStep( 1 ), mCompactEnabled( false ) {}
+
+				Options &layout( Layout layout ) { mLayout = layout; return *this; }
+				Layout getLayout() const { return mLayout; }
+				void setLayout( Layout layout ) { mLayout = layout; }
+
+				//! Uses every \a step th pixel of every \a step th row.
+				Options &step( int step ) { mStep = step; return *this; }
+				int getStep() const { return mStep; }
+				void setStep( int step ) { mStep = step; }
+
+				//! Leaves out the pixels without depth instead of writing points at the origin. The point cloud loses its grid layout.
+				Options &enableCompact( bool enable = true ) { mCompactEnabled = enable; return *this; }
+				bool getCompactEnabled() const { return mCompactEnabled; }
+				void setCompactEnabled( bool enable = true ) { mCompactEnabled = enable; }
+
+			protected:
+				Layout mLayout;
+				int mStep;
+				bool mCompactEnabled;
+		};
+
+		PointCloud() {}
+		//! Uses the field of view and maximum depth of the depth generator of \a ni. Has to be created after setDepthAligned(), which changes the field of view.
+		PointCloud( OpenNI ni, const Options &options = Options() );
+		//! \a maxDepth is the depth in millimetres FORMAT_DEPTH_SCALED frames are scaled from.
+		PointCloud( const XnFieldOfView &fov, int maxDepth, const Options &options = Options() );
+
+		//! Fills the point cloud from \a depth, a FORMAT_DEPTH_MILLIMETERS or FORMAT_DEPTH_SCALED frame. The rays are recomputed if the
+		//! resolution changes, the buffers are reused otherwise. Returns the number of points. Throws std::bad_alloc if the buffers of a
+		//! new resolution can't be allocated, the point cloud is empty then.
+		size_t				update( const Frame<uint16_t> &depth );
+
+		//! Returns the points of the last update() with the LAYOUT_VEC3F layout, NULL otherwise.
+		const ci::Vec3f		*getPoints() const { return mObj->mOptions.getLayout() == LAYOUT_VEC3F ? reinterpret_cast< const ci::Vec3f * >( mObj->mXYZ ) : NULL; }
+		//! Returns the x, y or z coordinates of the points of the last update() with the LAYOUT_SOA layout, NULL otherwise.
+		const float			*getX() const { return mObj->mOptions.getLayout() == LAYOUT_SOA ? mObj->mXYZ : NULL; }
+		const float			*getY() const { return mObj->mOptions.getLayout() == LAYOUT_SOA ? mObj->mXYZ + mObj->mCapacity : NULL; }
+		const float			*getZ() const { return mObj->mOptions.getLayout() == LAYOUT_SOA ? mObj->mXYZ + 2 * mObj->mCapacity : NULL; }
+
+		size_t				getNumPoints() const { return mObj->mNumPoints; }
+		//! Returns the size of the point grid, the depth resolution divided by the step. Compacted point clouds have fewer points.
+		int					getWidth() const { return mObj->mWidth; }
+		int					getHeight() const { return mObj->mHeight; }
+		//! Returns the info of the depth frame of the last update().
+		const FrameInfo		&getFrameInfo() const { return mObj->mInfo; }
+
+		const Options		&getOptions() const { return mObj->mOptions; }
+
+	protected:
+		struct Obj
+		{
+			Obj( const XnFieldOfView &fov, int maxDepth, const Options &options );
+			~Obj();
+
+			void setupRays( const Frame<uint16_t> &depth );
+			void releaseRays();
+
+			Options mOptions;
+			XnFieldOfView mFov;
+			int mMaxDepth;
+
+			int mDepthWidth, mDepthHeight;
+			int mDepthX, mDepthY;	//!< position of the depth frame in the sensor frame
+			int mFullWidth, mFullHeight;
+			int mWidth, mHeight;
+			float *mRayX;			//!< x of the rays per column of the grid at a depth of 1
+			float *mRayY;			//!< y of the rays per row of the grid at a depth of 1
+			float *mXYZ;			//!< interleaved points or the x, y and z arrays of mCapacity elements
+			size_t mCapacity;
+
+			size_t mNumPoints;
+			FrameInfo mInfo;
+
+			private:
+				Obj( const Obj & );
+				Obj &operator=( const Obj & );
+		};
+
+		std::shared_ptr<Obj> mObj;
+};
+
+} } // namespace mndl::ni
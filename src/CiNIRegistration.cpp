@@ -0,0 +1,156 @@
+/*
+ Copyright (c) 2012, Gabor Papp, All rights reserved.
+
+ This code is intended for use with the Cinder C++ library:
+ http://libcinder.org
+
+ Partially based on the Cinder-Kinect block:
+ https://github.com/cinder/Cinder-Kinect
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <algorithm>
+#include <string.h>
+
+#include "CiNIRegistration.h"
+#include "CiNIKernels.h"
+
+using namespace ci;
+using namespace std;
+
+namespace mndl { namespace ni {
+
+static Vec3f applyIntrinsics( const CameraIntrinsics &k, float sx, float sy, const Vec3f &v )
+{
+	return Vec3f( k.fx * sx * v.x + k.cx * sx * v.z, k.fy * sy * v.y + k.cy * sy * v.z, v.z );
+}
+
+DepthRegistration::DepthRegistration( const RegistrationCalibration &calibration, int numThreads )
+	: mCalibration( calibration ), mWorkers( numThreads ), mWidth( 0 ), mHeight( 0 ), mMirrored( false )
+{
+	mTask.mRegistration = this;
+}
+
+void DepthRegistration::setCalibration( const RegistrationCalibration &calibration )
+{
+	mCalibration = calibration;
+	mWidth = 0;
+	mHeight = 0;
+}
+
+void DepthRegistration::setupTables( int width, int height, bool mirrored )
+{
+	mWidth = width;
+	mHeight = height;
+	mMirrored = mirrored;
+
+	// the calibrations are scaled to the resolution of the depth map
+	const CameraIntrinsics &depth = mCalibration.depth;
+	const CameraIntrinsics &color = mCalibration.color;
+	float dsx = float( width ) / depth.width;
+	float dsy = float( height ) / depth.height;
+	float csx = float( width ) / color.width;
+	float csy = float( height ) / color.height;
+
+	// with the ray ( a, b, 1 ) of a depth pixel, K_color * R * ray = K_color * R * ( a, 0, 0 ) + K_color * R * ( 0, b, 1 )
+	mColX.resize( width );
+	mColY.resize( width );
+	mColZ.resize( width );
+	for ( int x = 0; x < width; x++ )
+	{
+		int u = mirrored ? width - 1 - x : x;
+		Vec3f c = applyIntrinsics( color, csx, csy, mCalibration.rotation * Vec3f( ( u - depth.cx * dsx ) / ( depth.fx * dsx ), 0.f, 0.f ) );
+		// mirroring the target column, ( W - 1 ) - X / Z = ( ( W - 1 ) * Z - X ) / Z, is linear as well
+		if ( mirrored )
+			c.x = ( width - 1 ) * c.z - c.x;
+		mColX[ x ] = c.x;
+		mColY[ x ] = c.y;
+		mColZ[ x ] = c.z;
+	}
+
+	mRow.resize( height );
+	for ( int y = 0; y < height; y++ )
+	{
+		Vec3f r = applyIntrinsics( color, csx, csy, mCalibration.rotation * Vec3f( 0.f, ( y - depth.cy * dsy ) / ( depth.fy * dsy ), 1.f ) );
+		if ( mirrored )
+			r.x = ( width - 1 ) * r.z - r.x;
+		mRow[ y ] = r;
+	}
+
+	mOffset = applyIntrinsics( color, csx, csy, mCalibration.translation );
+	if ( mirrored )
+		mOffset.x = ( width - 1 ) * mOffset.z - mOffset.x;
+
+	mIndex.resize( size_t( width ) * height );
+	mTargetDepth.resize( size_t( width ) * height );
+}
+
+void DepthRegistration::ReprojectTask::run( int index )
+{
+	DepthRegistration *reg = mRegistration;
+	int areaWidth = mArea.getWidth();
+	int areaHeight = mArea.getHeight();
+	int y1 = areaHeight * index / mNumBands;
+	int y2 = areaHeight * ( index + 1 ) / mNumBands;
+
+	for ( int y = y1; y < y2; y++ )
+	{
+		size_t offset = size_t( y ) * areaWidth;
+		int x1 = mArea.x1;
+		const Vec3f &row = reg->mRow[ mArea.y1 + y ];
+		float rowTerm[ 3 ] = { row.x, row.y, row.z };
+		float offsetTerm[ 3 ] = { reg->mOffset.x, reg->mOffset.y, reg->mOffset.z };
+		reprojectDepth( mDepth + offset, &reg->mColX[ x1 ], &reg->mColY[ x1 ], &reg->mColZ[ x1 ], rowTerm, offsetTerm,
+						reg->mWidth, reg->mHeight, &reg->mIndex[ offset ], &reg->mTargetDepth[ offset ], areaWidth );
+	}
+}
+
+void DepthRegistration::registerDepth( const uint16_t *depth, const Area &area, int width, int height, bool mirrored, uint16_t *dst )
+{
+	if ( ( width != mWidth ) || ( height != mHeight ) || ( mirrored != mMirrored ) )
+		setupTables( width, height, mirrored );
+
+	// the reprojection is split to bands of rows, the z-buffered scatter has to run on one thread
+	mTask.mDepth = depth;
+	mTask.mArea = area;
+	mTask.mNumBands = std::min( mWorkers.getNumThreads(), std::max( area.getHeight(), 1 ) );
+	mWorkers.run( &mTask, mTask.mNumBands );
+
+	memset( dst, 0, size_t( width ) * height * sizeof( uint16_t ) );
+
+	size_t count = size_t( area.getWidth() ) * area.getHeight();
+	const int32_t *index = &mIndex[ 0 ];
+	const int32_t *targetDepth = &mTargetDepth[ 0 ];
+	for ( size_t i = 0; i < count; i++ )
+	{
+		int32_t target = index[ i ];
+		if ( target < 0 )
+			continue;
+
+		uint16_t &d = dst[ target ];
+		uint16_t z = (uint16_t)targetDepth[ i ];
+		if ( ( d == 0 ) || ( z < d ) )
+			d = z;
+	}
+}
+
+} } // namespace mndl::ni
@@ -0,0 +1,118 @@
+/*
+ Copyright (c) 2012, Gabor Papp, All rights reserved.
+
+ This code is intended for use with the Cinder C++ library:
+ http://libcinder.org
+
+ Partially based on the Cinder-Kinect block:
+ https://github.com/cinder/Cinder-Kinect
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <vector>
+
+#include "cinder/Cinder.h"
+#include "cinder/Vector.h"
+#include "cinder/Matrix.h"
+#include "cinder/Area.h"
+
+#include "CiNIWorkerPool.h"
+
+namespace mndl { namespace ni {
+
+//! Pinhole intrinsics of a camera in pixels of a \a width x \a height image.
+struct CameraIntrinsics
+{
+	CameraIntrinsics() : fx( 0 ), fy( 0 ), cx( 0 ), cy( 0 ), width( 0 ), height( 0 ) {}
+	CameraIntrinsics( float aFx, float aFy, float aCx, float aCy, int aWidth, int aHeight )
+		: fx( aFx ), fy( aFy ), cx( aCx ), cy( aCy ), width( aWidth ), height( aHeight ) {}
+
+	float fx, fy;
+	float cx, cy;
+	int width, height;
+};
+
+//! Calibration of a depth and color camera pair. A point in the depth camera's coordinate system maps to
+//! \a rotation * p + \a translation in the color camera's, both in millimetres.
+struct RegistrationCalibration
+{
+	RegistrationCalibration() { rotation.setToIdentity(); }
+
+	CameraIntrinsics depth;
+	CameraIntrinsics color;
+	ci::Matrix33f rotation;
+	ci::Vec3f translation;
+};
+
+//! Reprojects millimetre depth maps to the view point of the color camera on the CPU, for devices and recordings
+//! without the alternative view point capability. The output has the resolution of the depth map, the color intrinsics
+//! are scaled to it. Where several depth pixels land on the same output pixel the nearest one is kept.
+class DepthRegistration
+{
+	public:
+		//! \a numThreads is the number of threads the reprojection is split to, 0 uses the number of hardware threads.
+		DepthRegistration( const RegistrationCalibration &calibration, int numThreads = 0 );
+
+		//! Registers \a depth, which is packed and covers \a area of a \a width x \a height frame, to the packed \a width x \a height
+		//! map \a dst. \a mirrored flips both views horizontally, as the global mirror does.
+		void	registerDepth( const uint16_t *depth, const ci::Area &area, int width, int height, bool mirrored, uint16_t *dst );
+
+		//! Replaces the calibration, the tables are rebuilt for the next frame.
+		void	setCalibration( const RegistrationCalibration &calibration );
+		const RegistrationCalibration	&getCalibration() const { return mCalibration; }
+
+		int		getNumThreads() const { return mWorkers.getNumThreads(); }
+
+	private:
+		//! Reprojects a band of rows
+		class ReprojectTask : public WorkerPool::Task
+		{
+			public:
+				ReprojectTask() : mRegistration( NULL ), mDepth( NULL ), mNumBands( 1 ) {}
+				void run( int index );
+
+				DepthRegistration *mRegistration;
+				const uint16_t *mDepth;
+				ci::Area mArea;
+				int mNumBands;
+		};
+
+		void	setupTables( int width, int height, bool mirrored );
+
+		RegistrationCalibration mCalibration;
+		WorkerPool mWorkers;
+		ReprojectTask mTask;
+
+		int mWidth, mHeight;
+		bool mMirrored;
+		//! K_color * R * ray of the depth pixels, split to a per-column and a per-row term
+		std::vector<float> mColX, mColY, mColZ;
+		std::vector<ci::Vec3f> mRow;
+		ci::Vec3f mOffset;		//!< K_color * translation
+
+		//! target pixel and target depth per depth pixel, written by the reprojection tasks
+		std::vector<int32_t> mIndex, mTargetDepth;
+};
+
+} } // namespace mndl::ni
@@ -105,7 +105,15 @@ bool UserTracker::Obj::sNeedPose = false;
 XnChar UserTracker::Obj::sCalibrationPose[20] = "";
 
 UserTracker::Obj::Obj( xn::Context context )
-	: mContext( context )
+	: mContext( context ),
+	  mNumBuffers( BufferManager< uint8_t >::kDefaultNumBuffers ),
+	  mOverflowPolicy( OVERFLOW_DROP_NEWEST ),
+	  mRingSize( 0 ),
+	  mBufferFlags( 0 ),
+	  mLazyLabels( false ),
+	  mRawLabelDepth( NULL ),
+	  mRawNumUsers( 0 ),
+	  mConvertedLabelFrameId( 0 )
 {
 	XnStatus rc;
 
@@ -116,7 +124,10 @@ UserTracker::Obj::Obj( xn::Context context )
 	mDepthGenerator.GetMetaData( depthMD );
 	mDepthWidth = depthMD.FullXRes();
 	mDepthHeight = depthMD.FullYRes();
-	mUserBuffers = BufferManager<uint8_t>( mDepthWidth * mDepthHeight, this );
+	mRegion = Area( 0, 0, mDepthWidth, mDepthHeight );
+	mBitMaskRowBytes = ( mDepthWidth + 7 ) / 8;
+	mBitMaskPlaneSize = mBitMaskRowBytes * mDepthHeight;
+	allocateBuffers();
 
 	rc = mContext.FindExistingNode(XN_NODE_TYPE_USER, mUserGenerator);
 	if (rc != XN_STATUS_OK)
@@ -183,6 +194,243 @@ void UserTracker::Obj::stop()
 	}
 }
 
+const uint8_t *UserTracker::Obj::generateLabels()
+{
+	if ( !mUserGenerator.IsValid() || !mUserGenerator.IsGenerating() )
+		return NULL;
+
+	xn::SceneMetaData sceneMD;
+	XnStatus rc = mUserGenerator.GetUserPixels( 0, sceneMD );
+	if ( rc != XN_STATUS_OK )
+		return NULL;
+
+	XnUserID aUsers[ kMaxUserMasks ];
+	XnUInt16 nUsers = kMaxUserMasks;
+	mUserGenerator.GetUsers( aUsers, nUsers );
+
+	xn::DepthMetaData depthMD;
+	mDepthGenerator.GetMetaData( depthMD );
+	const uint16_t *labels = reinterpret_cast< const uint16_t * >( sceneMD.Data() );
+	const uint16_t *depth = reinterpret_cast< const uint16_t * >( depthMD.Data() );
+
+	if ( !mUserGenerator.IsDataNew() )
+	{
+		// the labels did not change, only make them pinnable again
+		if ( mLazyLabels )
+			mRawLabels.publish( labels );
+		return NULL;
+	}
+
+	FrameInfo info;
+	info.frameId = mLabelFrameId.increment();
+	info.sourceFrameId = sceneMD.FrameID();
+	info.timestamp = sceneMD.Timestamp();
+
+	if ( mLazyLabels )
+	{
+		// the capture thread revokes the pin before the next update
+		mRawLabelDepth = depth;
+		mRawLabelInfo = info;
+		std::copy( aUsers, aUsers + nUsers, mRawUserIds );
+		mRawNumUsers = nUsers;
+		mRawLabels.publish( labels );
+		return NULL;
+	}
+
+	uint8_t *labelMap, *bitMask;
+	if ( !acquireLabelBuffers( &labelMap, &bitMask ) ) // every buffer is held by consumers, drop this frame
+		return NULL;
+	splitLabels( labels, depth, aUsers, nUsers, info, labelMap, bitMask );
+	return labelMap;
+}
+
+void UserTracker::Obj::updateLabelsOnDemand()
+{
+	if ( !mLazyLabels )
+		return;
+
+	lock_guard< mutex > lock( mLabelConvertMutex );
+	int32_t frameId = mLabelFrameId.load();
+	if ( frameId == mConvertedLabelFrameId )
+		return;
+
+	// the buffers are taken before the pin, a pool waiting for consumers must not hold up the capture thread through the pin
+	uint8_t *labelMap, *bitMask;
+	if ( !acquireLabelBuffers( &labelMap, &bitMask ) )
+		return;
+
+	const uint16_t *labels = mRawLabels.pin();
+	if ( labels == NULL ) // the capture thread is updating, keep the last split frame
+	{
+		mLabelBuffers.derefBuffer( labelMap );
+		mBitMaskBuffers.derefBuffer( bitMask );
+		return;
+	}
+
+	splitLabels( labels, mRawLabelDepth, mRawUserIds, mRawNumUsers, mRawLabelInfo, labelMap, bitMask );
+	mRawLabels.unpin();
+	mConvertedLabelFrameId = frameId;
+}
+
+bool UserTracker::Obj::acquireLabelBuffers( uint8_t **labelMap, uint8_t **bitMask )
+{
+	*labelMap = mLabelBuffers.getNewBuffer();
+	if ( *labelMap == NULL )
+		return false;
+	*bitMask = mBitMaskBuffers.getNewBuffer();
+	if ( *bitMask == NULL )
+	{
+		mLabelBuffers.derefBuffer( *labelMap );
+		return false;
+	}
+	return true;
+}
+
+void UserTracker::Obj::splitLabels( const uint16_t *labels, const uint16_t *depth, const XnUserID *userIds, unsigned numUsers, const FrameInfo &info,
+									uint8_t *labelMap, uint8_t *bitMask )
+{
+	BitMaskHeader *header = reinterpret_cast< BitMaskHeader * >( bitMask );
+	header->mNumUsers = numUsers;
+	for ( unsigned i = 0; i < numUsers; i++ )
+	{
+		header->mUserIds[ i ] = userIds[ i ];
+
+		StatsAccumulator &acc = header->mStats[ i ];
+		acc.mNumPixels = 0;
+		acc.mSumX = acc.mSumY = 0;
+		acc.mMinX = mDepthWidth;
+		acc.mMinY = mDepthHeight;
+		acc.mMaxX = acc.mMaxY = -1;
+		acc.mMinDepth = 0xffff;
+		acc.mMaxDepth = 0;
+	}
+
+	// one pass over the labels fills the label map and every mask plane, the statistics are then gathered from the
+	// mask planes of the row while they are still in the cache
+	uint8_t *planes[ kMaxUserMasks + 1 ];
+	size_t regionByte = mRegion.x1 / 8;
+	for ( int y = mRegion.y1; y < mRegion.y2; y++ )
+	{
+		size_t row = y * mDepthWidth;
+		uint8_t *labelRow = labelMap + y * mLabelStride;
+		for ( unsigned p = 0; p <= numUsers; p++ )
+			planes[ p ] = bitMask + kBitMaskHeaderSize + p * mBitMaskPlaneSize + y * mBitMaskRowBytes + regionByte;
+		splitUserLabels( labels + row + mRegion.x1, labelRow + mRegion.x1, planes, header->mUserIds, numUsers, mRegion.getWidth() );
+		if ( !mCoverage.empty() )
+			maskCoverage( labelRow + mRegion.x1, planes, numUsers, y - mRegion.y1 );
+		accumulateStats( header, planes, depth + row + mRegion.x1, y );
+	}
+
+	BufferManager< uint8_t >::getFrameInfo( labelMap ) = info;
+	BufferManager< uint8_t >::getFrameInfo( bitMask ) = info;
+	mLabelBuffers.setActiveBuffer( labelMap );
+	mBitMaskBuffers.setActiveBuffer( bitMask );
+	mLabelRing.push( labelMap );
+}
+
+void UserTracker::Obj::setupBuffers( int32_t numBuffers, OverflowPolicy policy, int flags )
+{
+	mNumBuffers = numBuffers;
+	mOverflowPolicy = policy;
+	// a region set before keeps its cleared pools
+	mBufferFlags = flags | ( mBufferFlags & BUFFER_ZERO_FILL );
+	allocateBuffers();
+}
+
+void UserTracker::Obj::setupFrameRing( int32_t size )
+{
+	mRingSize = size;
+}
+
+void UserTracker::Obj::setRegion( const Area &region, const vector< Area > &regions )
+{
+	// the bit mask rows of the region have to start at a byte
+	mRegion = Area( std::max( region.x1, 0 ) & ~7, std::max( region.y1, 0 ),
+					std::min( ( region.x2 + 7 ) & ~7, mDepthWidth ), std::min( region.y2, mDepthHeight ) );
+
+	mCoverage.clear();
+	mCoverageBits.clear();
+	if ( regions.size() > 1 )
+	{
+		// the pixels of the region outside of every one of \a regions are cleared after the split
+		int width = mRegion.getWidth();
+		size_t rowBytes = ( width + 7 ) / 8;
+		mCoverage.resize( width * mRegion.getHeight(), 0 );
+		mCoverageBits.resize( rowBytes * mRegion.getHeight(), 0 );
+		for ( size_t i = 0; i < regions.size(); i++ )
+		{
+			Area area = regions[ i ].getClipBy( mRegion );
+			for ( int y = area.y1; y < area.y2; y++ )
+			{
+				int row = y - mRegion.y1;
+				for ( int x = area.x1 - mRegion.x1; x < area.x2 - mRegion.x1; x++ )
+				{
+					mCoverage[ row * width + x ] = 0xff;
+					mCoverageBits[ row * rowBytes + x / 8 ] |= uint8_t( 1 << ( x & 7 ) );
+				}
+			}
+		}
+	}
+
+	// the pools are cleared once, the maps stay empty outside of the region
+	mBufferFlags |= BUFFER_ZERO_FILL;
+	allocateBuffers();
+}
+
+void UserTracker::Obj::maskCoverage( uint8_t *labelRow, uint8_t * const *planes, unsigned numUsers, int regionRow )
+{
+	int width = mRegion.getWidth();
+	const uint8_t *coverage = &mCoverage[ regionRow * width ];
+	for ( int x = 0; x < width; x++ )
+		labelRow[ x ] &= coverage[ x ];
+
+	size_t rowBytes = ( width + 7 ) / 8;
+	const uint8_t *coverageBits = &mCoverageBits[ regionRow * rowBytes ];
+	for ( unsigned p = 0; p <= numUsers; p++ )
+	{
+		for ( size_t b = 0; b < rowBytes; b++ )
+			planes[ p ][ b ] &= coverageBits[ b ];
+	}
+}
+
+size_t UserTracker::Obj::getFrameBytes( bool padded ) const
+{
+	return BufferManager< uint8_t >::calcStride( mDepthWidth, padded ) * mDepthHeight + kBitMaskHeaderSize + ( kMaxUserMasks + 1 ) * mBitMaskPlaneSize;
+}
+
+void UserTracker::Obj::allocateBuffers()
+{
+	// the ring references buffers of the pool that is about to be replaced
+	mLabelRing.clear();
+	mLabelStride = BufferManager< uint8_t >::calcStride( mDepthWidth, ( mBufferFlags & BUFFER_PADDED_STRIDE ) != 0 );
+	mLabelBuffers.setup( mLabelStride * mDepthHeight, mNumBuffers + mRingSize, mOverflowPolicy, mBufferFlags );
+	mLabelRing.setup( &mLabelBuffers, mRingSize );
+	mBitMaskBuffers.setup( kBitMaskHeaderSize + ( kMaxUserMasks + 1 ) * mBitMaskPlaneSize, mNumBuffers, mOverflowPolicy, mBufferFlags );
+}
+
+void UserTracker::Obj::accumulateStats( BitMaskHeader *header, uint8_t * const *planes, const uint16_t *depthRow, int y )
+{
+	// each user is counted on the mask plane just written for it, eight pixels at a time, only the depth range looks at the pixels
+	for ( unsigned u = 0; u < header->mNumUsers; u++ )
+	{
+		uint64_t sumX = 0;
+		int32_t minX = mRegion.getWidth();
+		int32_t maxX = -1;
+		StatsAccumulator &acc = header->mStats[ u ];
+		uint32_t numPixels = accumulateMaskRow( planes[ u + 1 ], depthRow, mRegion.getWidth(), &sumX, &minX, &maxX, &acc.mMinDepth, &acc.mMaxDepth );
+		if ( numPixels == 0 )
+			continue;
+
+		acc.mNumPixels += numPixels;
+		acc.mSumX += sumX + uint64_t( numPixels ) * mRegion.x1;
+		acc.mSumY += uint64_t( numPixels ) * y;
+		acc.mMinX = std::min( acc.mMinX, minX + mRegion.x1 );
+		acc.mMaxX = std::max( acc.mMaxX, maxX + mRegion.x1 );
+		acc.mMinY = std::min( acc.mMinY, y );
+		acc.mMaxY = std::max( acc.mMaxY, y );
+	}
+}
+
 void UserTracker::start()
 {
 	mObj->start();
@@ -324,8 +572,10 @@ Vec3f UserTracker::getUserCenter( XnUserID userId )
 
 class ImageSourceOpenNIUserMask : public ImageSource {
 	public:
-		ImageSourceOpenNIUserMask( uint8_t *buffer, int w, int h, shared_ptr<UserTracker::Obj> ownerObj )
-			: ImageSource(), mData( buffer ), mOwnerObj( ownerObj )
+		//! Serves the rows of \a buffer of \a buffers as they are if \a plane is NULL, the label map of all users filled with their ids,
+		//! otherwise expands the bit-packed mask \a plane with rows \a stride bytes apart to \a value. A NULL \a buffer serves a blank mask.
+		ImageSourceOpenNIUserMask( uint8_t *buffer, BufferManager< uint8_t > *buffers, const uint8_t *plane, int w, int h, size_t stride, const Area &region, uint8_t value, shared_ptr<UserTracker::Obj> ownerObj )
+			: ImageSource(), mOwnerObj( ownerObj ), mBuffers( buffers ), mData( buffer ), mPlane( plane ), mStride( stride ), mRegion( region ), mValue( value )
 		{
 			setSize( w, h );
 			setColorModel( ImageIo::CM_GRAY );
@@ -336,89 +586,169 @@ class ImageSourceOpenNIUserMask : public ImageSource {
 		~ImageSourceOpenNIUserMask()
 		{
 			// let the owner know we are done with the buffer
-			mOwnerObj->mUserBuffers.derefBuffer( mData );
+			mBuffers->derefBuffer( mData );
 		}
 
 		virtual void load( ImageTargetRef target )
 		{
 			ImageSource::RowFunc func = setupRowFunc( target );
 
+			vector< uint8_t > blank( mWidth, 0 );
+			if ( mData == NULL )
+			{
+				for( int32_t row = 0; row < mHeight; ++row )
+					((*this).*func)( target, row, &blank[ 0 ] );
+				return;
+			}
+
+			if ( mPlane == NULL )
+			{
+				for( int32_t row = 0; row < mHeight; ++row )
+					((*this).*func)( target, row, mData + row * mStride );
+				return;
+			}
+
+			// the masks are empty outside of the region, only the region is expanded
+			vector< uint8_t > mask( mWidth, 0 );
 			for( int32_t row = 0; row < mHeight; ++row )
-				((*this).*func)( target, row, mData + row * mWidth );
+			{
+				if ( ( row < mRegion.y1 ) || ( row >= mRegion.y2 ) )
+				{
+					((*this).*func)( target, row, &blank[ 0 ] );
+					continue;
+				}
+				expandBitMask( mPlane + row * mStride + mRegion.x1 / 8, &mask[ mRegion.x1 ], mRegion.getWidth(), mValue );
+				((*this).*func)( target, row, &mask[ 0 ] );
+			}
 		}
 
 	protected:
 		shared_ptr<UserTracker::Obj>	mOwnerObj;
+		BufferManager< uint8_t >		*mBuffers;
 		uint8_t							*mData;
+		const uint8_t					*mPlane;
+		size_t							mStride;
+		Area							mRegion;
+		uint8_t							mValue;
 };
 
 ImageSourceRef UserTracker::getUserMask( XnUserID userId /* = 0 */, bool fillWithUserId /* = false */ )
 {
-	mObj->mUserBuffers.derefActiveBuffer(); // finished with current active buffer
-	uint8_t *destPixels = mObj->mUserBuffers.getNewBuffer();  // request a new buffer
+	mObj->updateLabelsOnDemand();
 
-	xn::SceneMetaData sceneMD;
-    XnStatus rc = mObj->mUserGenerator.GetUserPixels( userId, sceneMD);
-	checkRc( rc, "UserGenerator GetUserPixels" );
-	if ( rc == XN_STATUS_OK )
+	// the label map already is the mask of all users filled with their ids
+	if ( ( userId == 0 ) && fillWithUserId )
+	{
+		// without a frame yet the mask is blank
+		uint8_t *labelMap = mObj->mLabelBuffers.refActiveBuffer();
+		return ImageSourceRef( new ImageSourceOpenNIUserMask( labelMap, &mObj->mLabelBuffers, NULL, mObj->mDepthWidth, mObj->mDepthHeight,
+															  mObj->mLabelStride, mObj->mRegion, 0, mObj ) );
+	}
+
+	// other masks are expanded from the mask plane of the user, found by the full id in the header
+	uint8_t *bitMask = mObj->mBitMaskBuffers.refActiveBuffer();
+	if ( bitMask == NULL )
+		return ImageSourceRef( new ImageSourceOpenNIUserMask( NULL, &mObj->mBitMaskBuffers, NULL, mObj->mDepthWidth, mObj->mDepthHeight,
+															  0, mObj->mRegion, 0, mObj ) );
+
+	const Obj::BitMaskHeader *header = reinterpret_cast< const Obj::BitMaskHeader * >( bitMask );
+	size_t plane = 0;
+	Area region = mObj->mRegion;
+	if ( userId != 0 )
+	{
+		while ( ( plane < header->mNumUsers ) && ( header->mUserIds[ plane ] != userId ) )
+			plane++;
+		// the mask of a user who is not in the frame is empty everywhere
+		if ( plane == header->mNumUsers )
+			region = Area( 0, 0, 0, 0 );
+		else
+			plane++;
+	}
+
+	uint8_t value = fillWithUserId ? uint8_t( userId & 255 ) : 255;
+	return ImageSourceRef( new ImageSourceOpenNIUserMask( bitMask, &mObj->mBitMaskBuffers, bitMask + Obj::kBitMaskHeaderSize + plane * mObj->mBitMaskPlaneSize,
+														  mObj->mDepthWidth, mObj->mDepthHeight, mObj->mBitMaskRowBytes, region, value, mObj ) );
+}
+
+shared_ptr< const uint8_t > UserTracker::getUserBitMask( XnUserID userId /* = 0 */ )
+{
+	mObj->updateLabelsOnDemand();
+
+	uint8_t *bitMask = mObj->mBitMaskBuffers.refActiveBuffer();
+	shared_ptr< uint8_t > buffer( bitMask, DataDeleter< uint8_t >( &mObj->mBitMaskBuffers, mObj ) );
+	if ( bitMask == NULL )
+		return shared_ptr< const uint8_t >();
+
+	const Obj::BitMaskHeader *header = reinterpret_cast< const Obj::BitMaskHeader * >( bitMask );
+	size_t plane = 0;
+	if ( userId != 0 )
+	{
+		while ( ( plane < header->mNumUsers ) && ( header->mUserIds[ plane ] != userId ) )
+			plane++;
+		if ( plane == header->mNumUsers )
+			return shared_ptr< const uint8_t >();
+		plane++;
+	}
+
+	// shares the reference of the whole buffer
+	return shared_ptr< const uint8_t >( buffer, bitMask + Obj::kBitMaskHeaderSize + plane * mObj->mBitMaskPlaneSize );
+}
+
+Frame< uint8_t > UserTracker::getUserLabelFrame()
+{
+	mObj->updateLabelsOnDemand();
+
+	uint8_t *labelMap = mObj->mLabelBuffers.refActiveBuffer();
+	return makeFrame( &mObj->mLabelBuffers, labelMap, mObj, mObj->mDepthWidth, mObj->mDepthHeight, 1, mObj->mLabelStride, FORMAT_USER_LABELS );
+}
+
+vector< UserTracker::UserStats > UserTracker::getUserStats()
+{
+	mObj->updateLabelsOnDemand();
+
+	vector< UserStats > stats;
+
+	uint8_t *bitMask = mObj->mBitMaskBuffers.refActiveBuffer();
+	if ( bitMask == NULL )
+		return stats;
+
+	const Obj::BitMaskHeader *header = reinterpret_cast< const Obj::BitMaskHeader * >( bitMask );
+	for ( unsigned i = 0; i < header->mNumUsers; i++ )
 	{
-		const uint16_t *userPixels = reinterpret_cast< const uint16_t * >( sceneMD.Data() );
+		const Obj::StatsAccumulator &acc = header->mStats[ i ];
 
-		if ( fillWithUserId )
+		UserStats userStats;
+		userStats.id = header->mUserIds[ i ];
+		userStats.numPixels = acc.mNumPixels;
+		if ( acc.mNumPixels > 0 )
 		{
-			if ( userId == 0 )
-			{
-				// mask for all users
-				for ( size_t i = 0 ; i < mObj->mDepthWidth * mObj->mDepthHeight; i++ )
-				{
-					destPixels[i] = userPixels[i] & 255;
-				}
-			}
-			else
-			{
-				// mask for specified user id
-				for ( size_t i = 0 ; i < mObj->mDepthWidth * mObj->mDepthHeight; i++ )
-				{
-					if ( userPixels[i] == userId )
-						destPixels[i] = userPixels[i] & 255;
-					else
-						destPixels[i] = 0;
-				}
-			}
+			userStats.bounds = Area( acc.mMinX, acc.mMinY, acc.mMaxX + 1, acc.mMaxY + 1 );
+			userStats.centroid = Vec2f( float( acc.mSumX ) / acc.mNumPixels, float( acc.mSumY ) / acc.mNumPixels );
 		}
-		else
+		if ( acc.mMaxDepth > 0 )
 		{
-			if ( userId == 0 )
-			{
-				// mask for all users
-				for ( size_t i = 0 ; i < mObj->mDepthWidth * mObj->mDepthHeight; i++ )
-				{
-					if ( userPixels[i] != 0 )
-						destPixels[i] = 255;
-					else
-						destPixels[i] = 0;
-				}
-			}
-			else
-			{
-				// mask for specified user id
-				for ( size_t i = 0 ; i < mObj->mDepthWidth * mObj->mDepthHeight; i++ )
-				{
-					if ( userPixels[i] == userId )
-						destPixels[i] = 255;
-					else
-						destPixels[i] = 0;
-				}
-			}
+			userStats.minDepth = acc.mMinDepth;
+			userStats.maxDepth = acc.mMaxDepth;
 		}
+		stats.push_back( userStats );
 	}
 
-	// set this new buffer to be the current active buffer
-	mObj->mUserBuffers.setActiveBuffer( destPixels );
+	mObj->mBitMaskBuffers.derefBuffer( bitMask );
+	return stats;
+}
 
-	uint8_t *activeMask = mObj->mUserBuffers.refActiveBuffer();
-	return ImageSourceRef( new ImageSourceOpenNIUserMask( activeMask, mObj->mDepthWidth, mObj->mDepthHeight, mObj ) );
+bool UserTracker::getUserStats( XnUserID userId, UserStats *stats )
+{
+	vector< UserStats > allStats = getUserStats();
+	for ( vector< UserStats >::const_iterator it = allStats.begin(); it != allStats.end(); ++it )
+	{
+		if ( it->id == userId )
+		{
+			*stats = *it;
+			return true;
+		}
+	}
+	return false;
 }
 
 } } // namespace mndl::ni
-
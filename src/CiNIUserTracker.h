@@ -5,6 +5,7 @@
 
 #include "cinder/Cinder.h"
 #include "cinder/Vector.h"
+#include "cinder/Area.h"
 #include "cinder/Exception.h"
 #include "cinder/Surface.h"
 
@@ -14,9 +15,12 @@
 #include <XnLog.h>
 
 #include "CiNIBufferManager.h"
+#include "CiNIKernels.h"
 
 namespace mndl { namespace ni {
 
+class OpenNI;
+
 class UserTracker
 {
 	public:
@@ -30,6 +34,19 @@ class UserTracker
 			unsigned id;
 		};
 
+		//! Segmentation statistics of a user, gathered while splitting the user labels of a frame
+		struct UserStats
+		{
+			UserStats() : id( 0 ), numPixels( 0 ), minDepth( 0 ), maxDepth( 0 ) {}
+
+			XnUserID	id;
+			ci::Area	bounds;		//!< bounding box in depth pixels
+			uint32_t	numPixels;
+			ci::Vec2f	centroid;	//!< in depth pixels
+			uint16_t	minDepth;	//!< in millimetres, 0 if none of the pixels have a valid depth
+			uint16_t	maxDepth;	//!< in millimetres
+		};
+
 		class Listener
 		{
 			public:
@@ -58,8 +75,27 @@ class UserTracker
 		void addListener( Listener *listener );
 
 		//! Returns mask for the given \a userId. Or a mask for all users if \a userId is 0 (the default). If \a fillWithUserId is set the user mask is filled with the userId instead of white color.
+		//! The mask is a view of the label map or the bit-packed user mask computed on the capture thread once per frame, it is only expanded when loaded.
+		//! Users are found by their full id, the fill value is the low byte of the id like in the label map. Users beyond kMaxUserMasks get an empty mask.
+		//! The mask is blank until the first frame is available, it is never a null ImageSourceRef.
 		ci::ImageSourceRef getUserMask( XnUserID userId = 0, bool fillWithUserId = false );
 
+		//! Returns the bit-packed mask of \a userId, or of all users if \a userId is 0, one bit per pixel, least significant bit first.
+		//! Rows are getUserBitMaskRowBytes() apart. Returns an empty pointer if the user is not in the latest frame.
+		std::shared_ptr<const uint8_t> getUserBitMask( XnUserID userId = 0 );
+		size_t getUserBitMaskRowBytes() const { return mObj->mBitMaskRowBytes; }
+
+		//! Returns the label map of the latest frame with its id and timestamp, see FORMAT_USER_LABELS.
+		Frame<uint8_t> getUserLabelFrame();
+
+		//! Returns the segmentation statistics of the users in the latest frame. The statistics are computed on the capture thread with the label map.
+		std::vector< UserStats > getUserStats();
+		//! Returns the segmentation statistics of \a userId in the latest frame. Returns false if the user is not in the frame.
+		bool getUserStats( XnUserID userId, UserStats *stats );
+
+		//! Returns the occupancy and drop counters of the label map buffer pool behind getUserMask().
+		BufferStats getUserMaskBufferStats() const { return mObj->mLabelBuffers.getStats(); }
+
 	protected:
 		struct Obj : BufferObj {
 			Obj( xn::Context context );
@@ -79,10 +115,78 @@ class UserTracker
 			static bool sNeedPose;
 			static XnChar sCalibrationPose[20];
 
-			BufferManager<uint8_t> mUserBuffers;
+			//! Splits the user labels of the current frame into the label map and the bit-packed masks. Called from the capture thread.
+			//! With lazy labels the frame is only pinned for updateLabelsOnDemand(). Returns the published label map or NULL.
+			const uint8_t *generateLabels();
+			//! Splits the pinned user labels if they have not been split yet, lazy labels only.
+			void updateLabelsOnDemand();
+			//! Takes a label map and a bit mask buffer, returns false if the frame has to be dropped.
+			bool acquireLabelBuffers( uint8_t **labelMap, uint8_t **bitMask );
+			void splitLabels( const uint16_t *labels, const uint16_t *depth, const XnUserID *userIds, unsigned numUsers, const FrameInfo &info,
+							  uint8_t *labelMap, uint8_t *bitMask );
+
+			//! Reallocates the label and bit mask pools with \a numBuffers buffers, \a policy and the BufferFlags \a flags of the OpenNI options.
+			void setupBuffers( int32_t numBuffers, OverflowPolicy policy, int flags );
+			//! Keeps the last \a size label maps for timestamp matching, the label pool gets additional buffers for them with the next setupBuffers().
+			void setupFrameRing( int32_t size );
+			//! Splits the labels only inside \a region of the depth frame, widened to whole bytes of the bit masks. With several \a regions
+			//! the labels of \a region outside of every one of them are cleared as well. Reallocates the pools cleared, so the maps stay
+			//! empty outside of the region. Has to be called before the capture thread is started.
+			void setRegion( const ci::Area &region, const std::vector< ci::Area > &regions = std::vector< ci::Area >() );
+			//! Clears the labels and mask bits of row \a regionRow of the region outside of the regions of interest.
+			void maskCoverage( uint8_t *labelRow, uint8_t * const *planes, unsigned numUsers, int regionRow );
+			//! Returns the bytes of one label map and one bit mask buffer with \a padded rows.
+			size_t getFrameBytes( bool padded ) const;
+			void allocateBuffers();
+			ci::Area mRegion;
+			std::vector< uint8_t > mCoverage; // 0xff inside the regions of interest over mRegion, only used for several regions
+			std::vector< uint8_t > mCoverageBits; // the same bit-packed like the mask rows
+			int32_t mNumBuffers;
+			OverflowPolicy mOverflowPolicy;
+			int32_t mRingSize;
+			int mBufferFlags;
+
+			// lazy labels, the driver frames are pinned until the next update and split at most once per frame
+			bool mLazyLabels;
+			PinnedBuffer< uint16_t > mRawLabels;
+			const uint16_t *mRawLabelDepth;
+			FrameInfo mRawLabelInfo;
+			XnUserID mRawUserIds[ kMaxUserMasks ];
+			unsigned mRawNumUsers;
+			AtomicInt mLabelFrameId;
+			std::mutex mLabelConvertMutex;
+			int32_t mConvertedLabelFrameId;
+
+			struct StatsAccumulator
+			{
+				uint32_t	mNumPixels;
+				uint64_t	mSumX, mSumY;
+				int32_t		mMinX, mMinY, mMaxX, mMaxY;
+				uint16_t	mMinDepth, mMaxDepth;
+			};
+
+			// bit-packed mask buffers start with the users of the frame and their statistics followed by one mask plane for all users and one per user
+			struct BitMaskHeader
+			{
+				uint32_t			mNumUsers;
+				uint16_t			mUserIds[ kMaxUserMasks ];
+				StatsAccumulator	mStats[ kMaxUserMasks ];
+			};
+			static const size_t kBitMaskHeaderSize = ( sizeof( BitMaskHeader ) + 63 ) & ~63;
+
+			//! Adds row \a y of the region to the statistics of the users of \a header from their mask \a planes, which start at the region like \a depthRow.
+			void accumulateStats( BitMaskHeader *header, uint8_t * const *planes, const uint16_t *depthRow, int y );
+
+			BufferManager<uint8_t> mLabelBuffers;
+			BufferManager<uint8_t> mBitMaskBuffers;
+			FrameRing<uint8_t> mLabelRing;
+			size_t mLabelStride;
+			size_t mBitMaskRowBytes;
+			size_t mBitMaskPlaneSize;
 		};
 		std::shared_ptr<Obj> mObj;
 
+		friend class OpenNI;
 		friend class ImageSourceOpenNIUserMask;
 
 		static void XN_CALLBACK_TYPE newUserCB( xn::UserGenerator &generator, XnUserID nId, void *pCookie );
@@ -0,0 +1,109 @@
+/*
+ Copyright (c) 2012, Gabor Papp, All rights reserved.
+
+ This code is intended for use with the Cinder C++ library:
+ http://libcinder.org
+
+ Partially based on the Cinder-Kinect block:
+ https://github.com/cinder/Cinder-Kinect
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <algorithm>
+
+#include "CiNIWorkerPool.h"
+
+using namespace std;
+
+namespace mndl { namespace ni {
+
+WorkerPool::WorkerPool( int numThreads )
+	: mTask( NULL ), mCount( 0 ), mNext( 0 ), mPending( 0 ), mGeneration( 0 ), mShouldDie( false )
+{
+	if ( numThreads <= 0 )
+		numThreads = std::max( (int)thread::hardware_concurrency(), 1 );
+
+	for ( int i = 1; i < numThreads; i++ )
+		mThreads.push_back( shared_ptr<thread>( new thread( &WorkerPool::workerFunc, this ) ) );
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		lock_guard<mutex> lock( mMutex );
+		mShouldDie = true;
+	}
+	mStartCond.notify_all();
+
+	for ( size_t i = 0; i < mThreads.size(); i++ )
+		mThreads[ i ]->join();
+}
+
+void WorkerPool::run( Task *task, int count )
+{
+	unique_lock<mutex> lock( mMutex );
+	mTask = task;
+	mCount = count;
+	mNext = 0;
+	mPending = count;
+	mGeneration++;
+	mStartCond.notify_all();
+
+	runTasks( lock );
+	while ( mPending > 0 )
+		mDoneCond.wait( lock );
+	mTask = NULL;
+}
+
+void WorkerPool::runTasks( unique_lock<mutex> &lock )
+{
+	while ( ( mTask != NULL ) && ( mNext < mCount ) )
+	{
+		Task *task = mTask;
+		int index = mNext++;
+
+		lock.unlock();
+		task->run( index );
+		lock.lock();
+
+		if ( --mPending == 0 )
+			mDoneCond.notify_all();
+	}
+}
+
+void WorkerPool::workerFunc()
+{
+	unique_lock<mutex> lock( mMutex );
+	uint32_t generation = mGeneration;
+	while ( true )
+	{
+		while ( !mShouldDie && ( generation == mGeneration ) )
+			mStartCond.wait( lock );
+		if ( mShouldDie )
+			return;
+
+		generation = mGeneration;
+		runTasks( lock );
+	}
+}
+
+} } // namespace mndl::ni
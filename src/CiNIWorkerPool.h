@@ -0,0 +1,81 @@
+/*
+ Copyright (c) 2012, Gabor Papp, All rights reserved.
+
+ This code is intended for use with the Cinder C++ library:
+ http://libcinder.org
+
+ Partially based on the Cinder-Kinect block:
+ https://github.com/cinder/Cinder-Kinect
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <vector>
+
+#include "cinder/Cinder.h"
+#include "cinder/Thread.h"
+
+namespace mndl { namespace ni {
+
+//! Persistent threads splitting per-frame work into tasks, so the frame stages do not start threads for every frame.
+class WorkerPool
+{
+	public:
+		//! Unit of work, run() is called once for every index in [ 0, count ) of WorkerPool::run().
+		class Task
+		{
+			public:
+				virtual ~Task() {}
+				virtual void run( int index ) = 0;
+		};
+
+		//! Starts \a numThreads - 1 worker threads, the thread calling run() works as well. 0 uses the number of hardware threads.
+		explicit WorkerPool( int numThreads = 0 );
+		~WorkerPool();
+
+		//! Runs \a count indices of \a task and returns when all of them finished. Has to be called from one thread at a time.
+		void	run( Task *task, int count );
+
+		int		getNumThreads() const { return (int)mThreads.size() + 1; }
+
+	private:
+		WorkerPool( const WorkerPool & );
+		WorkerPool &operator=( const WorkerPool & );
+
+		void	workerFunc();
+		//! Runs indices until none are left, \a lock is held on return.
+		void	runTasks( std::unique_lock<std::mutex> &lock );
+
+		std::vector< std::shared_ptr<std::thread> > mThreads;
+
+		std::mutex mMutex;
+		std::condition_variable mStartCond, mDoneCond;
+		Task *mTask;
+		int mCount;
+		int mNext;
+		int mPending;
+		uint32_t mGeneration;
+		bool mShouldDie;
+};
+
+} } // namespace mndl::ni